@@ -11,8 +11,16 @@
 // Information declarations
 #define SIMU_FUNC_DEFINED 1							// Denotes whether or not the simulation package is included. 
 #define SIMU_LATTICE_GROUP_POWER 1					// I forgot what this denotes.
+//#define CELL_TYPE_USE_FIXED_POINT					// If defined, cells hold Q1.14 fixed point charges with saturating arithmetic rather than floats.
+#ifdef CELL_TYPE_USE_FIXED_POINT
+#define CELL_TYPE short								// The data type used by each cell
+#define CELL_FIXED_BITS 14							// Fraction bits of a fixed point charge.
+#define CELL_ONE (1 << CELL_FIXED_BITS)				// A charge of 1. Charges saturate just short of +-2, so overflow past +-1 is still seen.
+												// Integrators carry the parts of a step too small to move a charge over to the ticks that follow.
+#else
 #define CELL_TYPE float								// The data type used by each cell
-//#define CELL_TYPE_USE_FIXED_POINT
+#define CELL_ONE 1									// A charge of 1.
+#endif
 #define OPTIM_MEMORY true							// If defined, utilizes optimized memory for faster memory by rounding dimensions to the nearest power of 2.
 
 // Core program flags
@@ -52,6 +60,33 @@
 #define LATTICE_NOISE_MODE_RESISTIVE 4			// Applies a resistive noise (some resistance is measured across connections and reduces the charge slightly).
 #define LATTICE_NOISE_MODE_HEAT_RESISTIVE 8		// If resistive noise is enabled, heat increases due to resistance which creates more heat.
 
+// Run modes
+#define LATTICE_RUN_THREADED 0				// A simulation thread ticks the lattice continuously. Each tick advances by its wall time, scaled by the time factor.
+#define LATTICE_RUN_STEPPED 1				// No simulation thread. The lattice only ticks in SIMU_Lattice_Step, advancing by a fixed timestep.
+
+// Storage modes
+#define LATTICE_STORAGE_DENSE 0				// Every cell is stored, row by row along X, then Y, then Z.
+#define LATTICE_STORAGE_SPARSE 1			// Cells are stored in 8x8x8 bricks, allocated when a cell in them is first programmed. Unprogrammed bricks read as 0.
+#define LATTICE_STORAGE_PADDED 2			// As dense, with X and Y rounded up to powers of 2 so cells are found with shifts.
+#define LATTICE_STORAGE_TILED 3				// Every cell is stored, in 8x8x8 bricks in Z-order, so neighbours along all three axes are usually close in memory.
+#ifdef OPTIM_MEMORY
+#define LATTICE_STORAGE_DEFAULT LATTICE_STORAGE_PADDED
+#else
+#define LATTICE_STORAGE_DEFAULT LATTICE_STORAGE_DENSE
+#endif
+
+// SIMD levels
+#define LATTICE_SIMD_NONE 0					// Cells are evaluated one at a time.
+#define LATTICE_SIMD_AVX2 1					// Cells are evaluated 8 at a time with AVX2.
+#define LATTICE_SIMD_AVX512 2				// Cells are evaluated 16 at a time with AVX-512.
+
+// Integration methods
+#define LATTICE_INTEGRATE_EULER 0			// Each tick adds an integrator's inputs times the tick's timestep to it (forward Euler).
+#define LATTICE_INTEGRATE_HEUN 1			// Heun's method, a second order Runge-Kutta method. The lattice is evaluated twice per tick.
+#define LATTICE_INTEGRATE_RK4 2				// The classic fourth order Runge-Kutta method. The lattice is evaluated four times per tick.
+#define LATTICE_INTEGRATE_ADAPTIVE 3		// The Bogacki-Shampine method, third order with an embedded second order error estimate. Each tick
+											// takes as many steps as keep the error of every integrator within SIMU_Integration_Tolerance.
+
 // Return values
 #define LATTICE_STATE_OKAY 0				// No errors.
 #define LATTICE_STATE_ERR_OVERFLOW_CELL 1	// A cell overflowed its bounds.
@@ -62,9 +97,83 @@
 #define LATTICE_STATE_ERR_BAD_CELL_POS 32	// Attempted to load a cell out of bounds.
 #define LATTICE_STATE_ERR_UNDEFINED 64		// This function has not been defined yet.
 #define LATTICE_STATE_ERR_NO_CONNECTION 128 // No connection here.
+#define LATTICE_STATE_ERR_BAD_FILE 256		// A program image could not be read or written.
+#define LATTICE_STATE_ERR_NO_PEER 512		// A neighbouring slab of a domain could not be reached, or is ticking out of step.
 
 #define LATTICE_DEFAULT_DIV_ZERO 0			// Value to default to when a DIV ZERO has occurred.
 
+// A simulated lattice created by SIMU_Lattice_Init. Every function has an overload taking a handle as its first parameter;
+// the overloads without one act on a default lattice.
+typedef struct lattice* LatticeHandle;
+// A lattice as it was at a moment of its run, taken by SIMU_Lattice_Checkpoint.
+typedef struct lattice_checkpoint* CheckpointHandle;
+
+// Stats
+#define LATTICE_STATS_BUCKETS 32			// Buckets of the tick duration histogram.
+#define LATTICE_STATS_FLAGS 16				// LATTICE_STATE flags counted, by bit: flagTicks[0] is OVERFLOW_CELL, flagTicks[4] is DIV_ZERO.
+#define LATTICE_STATS_REGIONS 8				// Regions that can be counted separately with SIMU_Stats_Region.
+
+// Counters of a region of the lattice set with SIMU_Stats_Region.
+typedef struct lattice_region_stats {
+	long long cellsEvaluated;				// Cells of the region evaluated.
+	long long flaggedTicks;					// Ticks that raised a flag while evaluating cells of the region.
+	int flags;								// Every LATTICE_STATE flag raised while evaluating cells of the region.
+} lattice_region_stats;
+
+// Counters of the ticks run by a lattice since it was created or SIMU_Reset_Stats was called, filled by SIMU_Get_Stats.
+typedef struct lattice_stats {
+	long long ticks;						// Ticks run.
+	long long activeTicks;					// Ticks that evaluated any cell.
+	long long cellsEvaluated;				// Cells evaluated. Divided by ticks, the cells evaluated per tick.
+	long long lastTickCells;				// Cells evaluated by the last tick.
+	long long connectionsTraversed;			// Lines read by the cells evaluated.
+	long long tickNanos;					// Wall time spent in ticks.
+	long long maxTickNanos;					// Wall time of the longest tick.
+	long long tickHistogram[LATTICE_STATS_BUCKETS];	// Ticks by wall time: [0] under 1us, [b] from 2^(b-1) to 2^b us, the last any longer.
+	long long flagTicks[LATTICE_STATS_FLAGS];	// Ticks that raised each LATTICE_STATE flag, by bit.
+	int flags;								// Every LATTICE_STATE flag raised by a tick.
+	long long pacedTicks;					// Ticks started on the schedule set by SIMU_Tick_Rate.
+	long long missedTicks;					// Ticks of the schedule skipped because the tick before overran them.
+	long long jitterNanos;					// How late paced ticks started, in total.
+	long long maxJitterNanos;				// The most any paced tick started late.
+	long long jitterHistogram[LATTICE_STATS_BUCKETS];	// Paced ticks by how late they started, bucketed as tickHistogram.
+	long long integrationSteps;				// Steps taken by the integrators: one per tick, or as many as needed with LATTICE_INTEGRATE_ADAPTIVE.
+	long long rejectedSteps;				// Steps of LATTICE_INTEGRATE_ADAPTIVE taken again, shorter, for missing the tolerance.
+	lattice_region_stats regions[LATTICE_STATS_REGIONS];
+} lattice_stats;
+
+// Subscription triggers: what a cell of the output layer must do for Lattice_Subscribe to notify of it.
+#define LATTICE_TRIGGER_CROSS 0				// The cell crosses the level, rising to it or falling below it.
+#define LATTICE_TRIGGER_CHANGE 1			// The cell moves by more than the level from the value it was last notified at.
+#define LATTICE_TRIGGER_SETTLE 2			// The cell keeps within the level of one value for the given number of ticks.
+
+// A cell of the output layer that met the trigger of a subscription at the end of a tick.
+typedef struct lattice_event {
+	int subscription;						// The subscription, as returned by Lattice_Subscribe.
+	int Y, Z;								// The cell.
+	int trigger;							// The LATTICE_TRIGGER of the subscription.
+	CELL_TYPE value;						// The charge of the cell at the end of the tick.
+	long long tick;							// The tick, as counted by Lattice_Read_Tick.
+} lattice_event;
+
+// Receives the events of a subscription raised by a tick, all in one call.
+typedef void (*lattice_callback)(void* context, const lattice_event* events, int count);
+
+// Domain axes: the axis a domain is split into slabs along, one slab per process.
+#define LATTICE_DOMAIN_X 0					// Slabs across X. The first holds the input layer and the last the output layer.
+#define LATTICE_DOMAIN_Z 2					// Slabs across Z. Each holds its own rows of the input and output layers.
+
+// Carries the charges at the edges of slabs between the processes of a domain. Messages to a rank arrive in the order they were
+// sent, as over a stream socket. send must not wait for the message to be received: the slabs send to each other before they
+// receive, so a transport must buffer at least two messages of each neighbour. receive waits for the whole message.
+typedef struct lattice_transport {
+	void* context;
+	int (*connect)(void* context, int bytes);								// Called once before any message, with the largest that will be sent.
+	int (*send)(void* context, int rank, const void* data, int bytes);		// Each returns a LATTICE_STATE value.
+	int (*receive)(void* context, int rank, void* data, int bytes);
+	void (*close)(void* context);											// Called once the lattice is destroyed.
+} lattice_transport;
+
 // SIMU Functions: functions dedicated to manipulating the simulated library. These will be undefined if SIMU_FUNC_DEFINED is not 1.
 
 /// <summary>
@@ -79,12 +188,102 @@
 /// <returns>An integer corresponding to the LATTICE_STATE values.</returns>
 int SIMU_Lattice_Init(int X, int Y, int Z, int noise, double ts);
 /// <summary>
+/// Initializes the simulated lattice as above, with the given LATTICE_STORAGE mode rather than LATTICE_STORAGE_DEFAULT. Sparse storage suits
+/// large lattices of which only a small part is programmed, as memory is only used by the bricks holding programmed cells. Tiled storage
+/// keeps neighbours close in memory, which pays off once the lattice no longer fits in cache.
+/// </summary>
+/// <param name="X"></param>
+/// <param name="Y"></param>
+/// <param name="Z"></param>
+/// <param name="noise"></param>
+/// <param name="ts"></param>
+/// <param name="storage"></param>
+/// <returns>An integer corresponding to the LATTICE_STATE values.</returns>
+int SIMU_Lattice_Init(int X, int Y, int Z, int noise, double ts, int storage);
+/// <summary>
+/// Initializes the simulated lattice as one slab of an X*Y*Z lattice split across count processes, so a lattice can outgrow the memory
+/// and cores of one process. Every process makes the same calls with the coordinates of the whole lattice, and each keeps what falls in
+/// its slab: cores and lines into its cells are programmed and the rest ignored, and only its part of the output layer is kept up to date.
+/// Each tick, the charges of the cells along the faces of each slab are sent to the neighbouring slabs, so a line across a face reads
+/// its source as the last tick left it. The slabs tick in step, each waiting on its neighbours, so every process must run its lattice
+/// the same number of ticks. Storage is always LATTICE_STORAGE_SPARSE, holding only the slab. Unlike SIMU_Lattice_Init, the lattice
+/// starts in LATTICE_RUN_STEPPED mode, so each process can program it before the slabs tick together with SIMU_Lattice_Step, or with
+/// SIMU_Run_Mode(LATTICE_RUN_THREADED) from which there is no switching back until it is destroyed.
+/// </summary>
+/// <param name="X"></param>
+/// <param name="Y"></param>
+/// <param name="Z"></param>
+/// <param name="noise"></param>
+/// <param name="ts"></param>
+/// <param name="axis">A LATTICE_DOMAIN axis, split evenly between the processes.</param>
+/// <param name="rank">The slab of this process, from 0 at the low end of the axis to count - 1.</param>
+/// <param name="count"></param>
+/// <param name="transport">Taken over by the lattice, which closes it when destroyed or if it cannot be initialized. Unused if count is 1.</param>
+/// <returns>LATTICE_STATE_ERR_NO_PEER if the transport cannot connect.</returns>
+int SIMU_Lattice_Init_Domain(int X, int Y, int Z, int noise, double ts, int axis, int rank, int count, const lattice_transport* transport);
+/// <summary>
+/// Creates a transport between processes on one machine over shared memory, for SIMU_Lattice_Init_Domain. Every process of the domain
+/// passes the same name, which must not be in use by another domain. Rank 0 creates the memory and the rest wait for it as they connect.
+/// </summary>
+/// <param name="name">A name for the shared memory, starting with '/' on POSIX systems.</param>
+/// <param name="rank"></param>
+/// <param name="count"></param>
+/// <param name="transport">Receives the transport.</param>
+/// <returns></returns>
+int SIMU_Transport_Shared(const char* name, int rank, int count, lattice_transport* transport);
+/// <summary>
+/// Initializes the simulated lattice from a program image written by SIMU_Lattice_Save. The image holds the dimensions, storage mode,
+/// program, charges and compiled schedule of the lattice it was saved from, and is mapped into memory and copied in whole, so even a
+/// large program is running within milliseconds rather than after a Lattice_Program call per cell.
+/// </summary>
+/// <param name="path"></param>
+/// <param name="noise"></param>
+/// <param name="ts"></param>
+/// <returns>LATTICE_STATE_ERR_BAD_FILE if the file cannot be read, or is not an image saved by this build of the library.</returns>
+int SIMU_Lattice_Load(const char* path, int noise, double ts);
+/// <summary>
+/// Saves the program of the simulated lattice, along with its charges and compiled schedule, as a program image for SIMU_Lattice_Load.
+/// Images hold charges as the library stores them, so they only load into a library built with the same CELL_TYPE.
+/// </summary>
+/// <param name="path"></param>
+/// <returns>LATTICE_STATE_ERR_BAD_FILE if the file cannot be written.</returns>
+int SIMU_Lattice_Save(const char* path);
+/// <summary>
+/// Takes a checkpoint of the simulated lattice: its program, charges and compiled schedule as a program image held in memory, along
+/// with its input layer, tick counter, noise state and integration settings. Taken between ticks.
+/// </summary>
+/// <param name="checkpoint">Receives the checkpoint, kept until SIMU_Checkpoint_Destroy.</param>
+/// <returns>An integer corresponding to the LATTICE_STATE values.</returns>
+int SIMU_Lattice_Checkpoint(CheckpointHandle* checkpoint);
+/// <summary>
+/// Winds the simulated lattice back to a checkpoint taken of it, or of another lattice of the same dimensions and storage mode. If
+/// the lattice has not been reprogrammed since the checkpoint only its charges are copied back; otherwise its program and compiled
+/// schedule are too. The outputs are published again and Lattice_Read_Tick reports the tick of the checkpoint, so ticks after it
+/// repeat, noise included. The tick rate, run mode and subscriptions are kept; subscriptions measure from the restored outputs.
+/// </summary>
+/// <param name="checkpoint"></param>
+/// <returns>LATTICE_STATE_ERR_BAD_CONFIG if the checkpoint is of a lattice of other dimensions or storage mode.</returns>
+int SIMU_Lattice_Restore(CheckpointHandle checkpoint);
+/// <summary>
+/// Initializes the simulated lattice as a copy of a checkpoint, with its timestep, noise mode and run mode, without compiling.
+/// </summary>
+/// <param name="checkpoint"></param>
+/// <returns>An integer corresponding to the LATTICE_STATE values.</returns>
+int SIMU_Lattice_Fork(CheckpointHandle checkpoint);
+/// <summary>
+/// Frees a checkpoint. Lattices restored or forked from it are not affected.
+/// </summary>
+/// <param name="checkpoint"></param>
+/// <returns></returns>
+int SIMU_Checkpoint_Destroy(CheckpointHandle checkpoint);
+/// <summary>
 /// Destroys the simulated lattice
 /// </summary>
 /// <returns></returns>
 int SIMU_Lattice_Destroy();
 /// <summary>
-/// Examines any cell in the lattice for the purpose of debugging the simulation.
+/// Examines any cell in the lattice for the purpose of debugging the simulation. Cells inside the lattice are read as they are,
+/// which may be partway through a tick; the output layer is read as of the last tick, as Lattice_Read.
 /// </summary>
 /// <param name="X"></param>
 /// <param name="Y"></param>
@@ -94,12 +293,14 @@ int SIMU_Lattice_Destroy();
 int SIMU_Lattice_Examine(int X, int Y, int Z, CELL_TYPE* cell);
 /// <summary>
 /// Changes the noise mode applied to the simulation on connections. Note that the more noise introduced, the longer compute time will run.
+/// Noise is added to the charge read through each line every tick, so while any noise mode is set the whole program is evaluated every tick.
+/// Random noise is reproducible: a lattice with the same program and inputs runs the same whatever its thread count or SIMD level.
 /// </summary>
-/// <param name="mode"></param>
-/// <returns></returns>
+/// <param name="mode">Any combination of the LATTICE_NOISE_MODE flags.</param>
+/// <returns>An integer corresponding to the LATTICE_STATE values.</returns>
 int SIMU_Lattice_NoiseMode(int mode);
 /// <summary>
-/// Changes the minimum wait time inbetween polls of the simulation.
+/// Changes the simulated time advanced by each tick in LATTICE_RUN_STEPPED mode, and by the first tick in LATTICE_RUN_THREADED mode.
 /// </summary>
 /// <param name="ts"></param>
 /// <returns></returns>
@@ -109,6 +310,123 @@ int SIMU_Thread_Speed(double ts);
 /// </summary>
 /// <returns></returns>
 int SIMU_Poll_Rate();
+/// <summary>
+/// Selects a LATTICE_RUN mode, starting or stopping the simulation thread. Lattices start in LATTICE_RUN_THREADED mode.
+/// </summary>
+/// <param name="mode"></param>
+/// <returns>LATTICE_STATE_ERR_BAD_CONFIG on stopping the thread of a slab of a domain, which only SIMU_Lattice_Destroy can.</returns>
+int SIMU_Run_Mode(int mode);
+/// <summary>
+/// Runs n ticks back to back on the calling thread, each advancing the lattice by the timestep. Only valid in LATTICE_RUN_STEPPED mode;
+/// the same program, inputs and timestep always give the same result.
+/// </summary>
+/// <param name="n"></param>
+/// <returns>The LATTICE_STATE flags raised by the ticks, or LATTICE_STATE_ERR_BAD_CONFIG if the lattice is not in LATTICE_RUN_STEPPED mode.</returns>
+int SIMU_Lattice_Step(int n);
+/// <summary>
+/// Sets the simulated seconds that pass per second of wall time in LATTICE_RUN_THREADED mode. Defaults to 1 (real time).
+/// </summary>
+/// <param name="factor"></param>
+/// <returns></returns>
+int SIMU_Time_Factor(double factor);
+/// <summary>
+/// Selects the LATTICE_INTEGRATE method integrators advance by. Other than with LATTICE_INTEGRATE_EULER, the integrators are taken
+/// as the state of the lattice: each tick evaluates the rest of the lattice from trial values of the integrators a few times, reading
+/// the lines into each integrator as its rate of change, and then moves them all together. Only cells that read a changed cell are
+/// evaluated again, so the cost of a tick grows with the cells that depend on the integrators. Larger timesteps then keep the
+/// same accuracy: the error of Heun's method falls with the square of the timestep, and of RK4 with its fourth power.
+/// </summary>
+/// <param name="method"></param>
+/// <returns></returns>
+int SIMU_Integration_Method(int method);
+/// <summary>
+/// Sets the largest error LATTICE_INTEGRATE_ADAPTIVE allows in any integrator per step, as a charge. Defaults to 1e-5. A tick that
+/// cannot keep within it in 256 steps takes the 256 steps regardless.
+/// </summary>
+/// <param name="tolerance"></param>
+/// <returns></returns>
+int SIMU_Integration_Tolerance(double tolerance);
+/// <summary>
+/// Paces LATTICE_RUN_THREADED mode at the given number of ticks per second rather than running flat out. Ticks are due at fixed
+/// intervals, so the rate does not drift; the thread sleeps until just before each is due and spins the rest of the way, so ticks
+/// start within microseconds of when they are due without the thread holding a core between them. A tick that runs past one or
+/// more later ticks skips them rather than catching up. Each tick advances the lattice by the wall time since the last one. See
+/// the pacing counters of SIMU_Get_Stats for how closely the rate is kept.
+/// </summary>
+/// <param name="hz">Ticks per second, or 0 to run flat out (the default).</param>
+/// <returns></returns>
+int SIMU_Tick_Rate(double hz);
+/// <summary>
+/// Pins the simulation thread to one CPU, or lets it run on any. Threads added by SIMU_Thread_Count are not pinned.
+/// Kept through SIMU_Run_Mode, and applied whenever the simulation thread starts.
+/// </summary>
+/// <param name="cpu">The CPU to run on, or -1 for any (the default).</param>
+/// <returns>LATTICE_STATE_ERR_BAD_CONFIG if the CPU does not exist or the platform refused.</returns>
+int SIMU_Thread_Affinity(int cpu);
+/// <summary>
+/// Runs the simulation thread under the realtime scheduler: SCHED_FIFO on Linux, which needs CAP_SYS_NICE, or time critical
+/// priority on Windows. Kept through SIMU_Run_Mode, and applied whenever the simulation thread starts.
+/// </summary>
+/// <param name="realtime">Nonzero for the realtime scheduler, 0 for the normal one (the default).</param>
+/// <returns>LATTICE_STATE_ERR_BAD_CONFIG if the platform refused.</returns>
+int SIMU_Thread_Realtime(int realtime);
+/// <summary>
+/// Sets the number of threads that evaluate each tick, including the simulation thread. Levels of the lattice too small to be
+/// worth splitting are always evaluated by the simulation thread alone.
+/// </summary>
+/// <param name="threads"></param>
+/// <returns></returns>
+int SIMU_Thread_Count(int threads);
+/// <summary>
+/// Reports how well ticks have been spread across threads since the last call.
+/// </summary>
+/// <param name="parallel">The fraction of evaluated cells that were split across threads.</param>
+/// <param name="speedup">The average number of threads busy while a split level ran.</param>
+/// <returns></returns>
+int SIMU_Thread_Scaling(double* parallel, double* speedup);
+/// <summary>
+/// Selects the LATTICE_SIMD level used to evaluate the lattice. The highest level supported by the CPU is selected on initialization.
+/// </summary>
+/// <param name="level"></param>
+/// <returns>LATTICE_STATE_ERR_BAD_CONFIG if the level is not supported by this CPU or build.</returns>
+int SIMU_Lattice_SIMD(int level);
+/// <summary>
+/// Returns the LATTICE_SIMD level currently used to evaluate the lattice.
+/// </summary>
+/// <returns></returns>
+int SIMU_SIMD_Level();
+/// <summary>
+/// Returns the number of bytes of storage used per cell of the lattice.
+/// </summary>
+/// <returns></returns>
+int SIMU_Cell_Size();
+/// <summary>
+/// Reads the counters of every tick run since the lattice was created or the counters were reset. Overflows and divisions by zero
+/// are counted here even when nothing reads the flags a tick returns, as in LATTICE_RUN_THREADED mode. Counting costs a few atomic
+/// adds per tick, and per task of a region's cells while any region is set.
+/// </summary>
+/// <param name="stats"></param>
+/// <returns></returns>
+int SIMU_Get_Stats(lattice_stats* stats);
+/// <summary>
+/// Sets every counter read by SIMU_Get_Stats back to 0. Regions set with SIMU_Stats_Region are kept.
+/// </summary>
+/// <returns></returns>
+int SIMU_Reset_Stats();
+/// <summary>
+/// Counts the cells in a box of the lattice separately, as regions[region] of SIMU_Get_Stats, and resets its counters. Evaluation is
+/// counted in tasks of up to 512 cells of the same level, so a flag raised by a task is counted against every region with a cell in it.
+/// A width, height or depth of 0 stops counting the region.
+/// </summary>
+/// <param name="region">Which of the LATTICE_STATS_REGIONS regions to set.</param>
+/// <param name="X"></param>
+/// <param name="Y"></param>
+/// <param name="Z"></param>
+/// <param name="width">The size of the box along X.</param>
+/// <param name="height">The size of the box along Y.</param>
+/// <param name="depth">The size of the box along Z.</param>
+/// <returns>LATTICE_STATE_ERR_BAD_CONFIG if the region does not exist, or the box is not inside the lattice.</returns>
+int SIMU_Stats_Region(int region, int X, int Y, int Z, int width, int height, int depth);
 
 // AnalogLibrary lattice functions: proper accessible functions for general use functions.
 
@@ -131,6 +449,18 @@ int Lattice_Program_Core(int X, int Y, int Z, int code);
 /// <returns></returns>
 int Lattice_Program_Connect(int X, int Y, int Z, int code); 
 /// <summary>
+/// Opens a programming transaction. Until Lattice_Program_Commit, Lattice_Program_Core and Lattice_Program_Connect calls are only
+/// checked and staged, each with the underbus charge set when it was made, and the lattice keeps running its current program.
+/// </summary>
+/// <returns>LATTICE_STATE_ERR_BAD_CONFIG if a transaction is already open.</returns>
+int Lattice_Program_Begin();
+/// <summary>
+/// Applies every call staged since Lattice_Program_Begin in order and compiles the result, all while the simulation is held between
+/// ticks, so no tick sees part of the transaction. Reprogramming a whole lattice this way takes one pass over the calls and one compile.
+/// </summary>
+/// <returns>The LATTICE_STATE flags of the staged calls, or LATTICE_STATE_ERR_BAD_CONFIG if no transaction is open.</returns>
+int Lattice_Program_Commit();
+/// <summary>
 /// Sets the current underbus value. Whenever a configuration is written that uses a set value, the underbus is used.
 /// </summary>
 /// <param name="charge"></param>
@@ -151,7 +481,7 @@ int Lattice_Program_SetUnderbus(CELL_TYPE value, CELL_TYPE range);
 /// <returns></returns>
 int Lattice_Program_SetUnderbus(int value, int range);
 /// <summary>
-/// Inputs a value to {X=0, Y, Z} (input layer).
+/// Inputs a value to {X=0, Y, Z} (input layer). Inputs are applied to the lattice at the start of the next tick.
 /// </summary>
 /// <param name="Y"></param>
 /// <param name="Z"></param>
@@ -177,7 +507,7 @@ int Lattice_Write(int Y, int Z, CELL_TYPE value, CELL_TYPE range);
 /// <returns></returns>
 int Lattice_Write(int Y, int Z, int value, int range);
 /// <summary>
-/// Reads the value from cell {X=MAX-1, Y, Z} (output layer).
+/// Reads the value from cell {X=MAX-1, Y, Z} (output layer), as of the end of the last tick. Never waits on the simulation.
 /// </summary>
 /// <param name="Y"></param>/// 
 /// <param name="Z"></param>/// 
@@ -203,10 +533,271 @@ int Lattice_Read(int Y, int Z, CELL_TYPE range, CELL_TYPE* output);
 /// <returns></returns>
 int Lattice_Read(int Y, int Z, int range, int* output);
 /// <summary>
-/// Unlocks all integrators, allowing them to operate.
+/// Writes the whole input layer from a buffer of Y*Z values, where {Y, Z} is at [Z * Y_MAX + Y].
+/// </summary>
+/// <param name="charges"></param>
+/// <returns></returns>
+int Lattice_Write_Plane(const CELL_TYPE* charges);
+/// <summary>
+/// Writes the whole input layer from a buffer of Y*Z values scaled to the given range, where {Y, Z} is at [Z * Y_MAX + Y].
+/// </summary>
+/// <param name="values"></param>
+/// <param name="range"></param>
+/// <returns></returns>
+int Lattice_Write_Plane(const int* values, int range);
+/// <summary>
+/// Reads the whole output layer into a buffer of Y*Z values, where {Y, Z} is at [Z * Y_MAX + Y].
+/// </summary>
+/// <param name="output"></param>
+/// <returns></returns>
+int Lattice_Read_Plane(CELL_TYPE* output);
+/// <summary>
+/// Reads the whole output layer into a buffer of Y*Z values scaled to the given range, where {Y, Z} is at [Z * Y_MAX + Y].
+/// </summary>
+/// <param name="range"></param>
+/// <param name="output"></param>
+/// <returns></returns>
+int Lattice_Read_Plane(int range, int* output);
+/// <summary>
+/// Writes a height*depth region of the input layer starting at {Y, Z}. {Y + i, Z + j} is read from charges[j * stride + i].
+/// </summary>
+/// <param name="Y"></param>
+/// <param name="Z"></param>
+/// <param name="height"></param>
+/// <param name="depth"></param>
+/// <param name="charges"></param>
+/// <param name="stride">The distance between rows of the buffer, at least height.</param>
+/// <returns></returns>
+int Lattice_Write_Region(int Y, int Z, int height, int depth, const CELL_TYPE* charges, int stride);
+/// <summary>
+/// Writes a height*depth region of the input layer starting at {Y, Z}, scaled to the given range. {Y + i, Z + j} is read from values[j * stride + i].
+/// </summary>
+/// <param name="Y"></param>
+/// <param name="Z"></param>
+/// <param name="height"></param>
+/// <param name="depth"></param>
+/// <param name="values"></param>
+/// <param name="range"></param>
+/// <param name="stride">The distance between rows of the buffer, at least height.</param>
+/// <returns></returns>
+int Lattice_Write_Region(int Y, int Z, int height, int depth, const int* values, int range, int stride);
+/// <summary>
+/// Reads a height*depth region of the output layer starting at {Y, Z}. {Y + i, Z + j} is written to output[j * stride + i].
+/// </summary>
+/// <param name="Y"></param>
+/// <param name="Z"></param>
+/// <param name="height"></param>
+/// <param name="depth"></param>
+/// <param name="output"></param>
+/// <param name="stride">The distance between rows of the buffer, at least height.</param>
+/// <returns></returns>
+int Lattice_Read_Region(int Y, int Z, int height, int depth, CELL_TYPE* output, int stride);
+/// <summary>
+/// Reads a height*depth region of the output layer starting at {Y, Z}, scaled to the given range. {Y + i, Z + j} is written to output[j * stride + i].
+/// </summary>
+/// <param name="Y"></param>
+/// <param name="Z"></param>
+/// <param name="height"></param>
+/// <param name="depth"></param>
+/// <param name="range"></param>
+/// <param name="output"></param>
+/// <param name="stride">The distance between rows of the buffer, at least height.</param>
+/// <returns></returns>
+int Lattice_Read_Region(int Y, int Z, int height, int depth, int range, int* output, int stride);
+/// <summary>
+/// Reads the whole output layer as of one complete tick into a buffer of Y*Z values, where {Y, Z} is at [Z * Y_MAX + Y], along with
+/// the number of that tick. Never waits on the simulation, and every value comes from the same tick.
+/// </summary>
+/// <param name="output"></param>
+/// <param name="tick">The tick the outputs are from.</param>
+/// <returns></returns>
+int Lattice_Read_Snapshot(CELL_TYPE* output, long long* tick);
+/// <summary>
+/// Reads the whole output layer as of one complete tick into a buffer of Y*Z values scaled to the given range, where {Y, Z} is at
+/// [Z * Y_MAX + Y], along with the number of that tick. Never waits on the simulation, and every value comes from the same tick.
+/// </summary>
+/// <param name="range"></param>
+/// <param name="output"></param>
+/// <param name="tick">The tick the outputs are from.</param>
+/// <returns></returns>
+int Lattice_Read_Snapshot(int range, int* output, long long* tick);
+/// <summary>
+/// Reads the number of ticks the lattice has completed, wound back by SIMU_Lattice_Restore. A lattice with nothing left to evaluate
+/// stops ticking until it is written, reprogrammed or integration is started.
+/// </summary>
+/// <param name="tick"></param>
+/// <returns></returns>
+int Lattice_Read_Tick(long long* tick);
+/// <summary>
+/// Waits until the lattice has completed the given number of ticks, or has settled with everything written so far applied.
+/// Inputs written before the call are seen by the outputs after 2 ticks, so waiting for 2 replaces waiting on a timer.
+/// </summary>
+/// <param name="ticks"></param>
+/// <returns>LATTICE_STATE_ERR_BAD_CONFIG if the lattice is not in LATTICE_RUN_THREADED mode.</returns>
+int Lattice_Wait(int ticks);
+/// <summary>
+/// Subscribes to a height*depth region of the output layer starting at {Y, Z}, so that changes are pushed rather than polled for
+/// with Lattice_Read. The region is checked at the end of every tick, and each cell that meets the trigger raises an event. The
+/// first tick after subscribing only records where each cell starts. Events of a tick are delivered together once it completes:
+/// to the callback, on the thread that ran the tick, or if there is no callback, queued for Lattice_Wait_Events. A callback may
+/// read, write or unsubscribe, but must not program the lattice or step it.
+/// </summary>
+/// <param name="Y"></param>
+/// <param name="Z"></param>
+/// <param name="height"></param>
+/// <param name="depth"></param>
+/// <param name="trigger">A LATTICE_TRIGGER value.</param>
+/// <param name="level">The charge crossed for LATTICE_TRIGGER_CROSS, or the change allowed for the others.</param>
+/// <param name="ticks">The ticks a cell must keep within level for LATTICE_TRIGGER_SETTLE. Ignored otherwise.</param>
+/// <param name="callback">Receives the events, or NULL to queue them for Lattice_Wait_Events.</param>
+/// <param name="context">Passed to the callback.</param>
+/// <param name="subscription">Receives the subscription, for Lattice_Unsubscribe.</param>
+/// <returns>LATTICE_STATE_ERR_BAD_CONFIG if the region is not inside the output layer or the trigger is not valid.</returns>
+int Lattice_Subscribe(int Y, int Z, int height, int depth, int trigger, CELL_TYPE level, int ticks, lattice_callback callback, void* context, int* subscription);
+/// <summary>
+/// Ends a subscription, dropping any of its events not yet delivered. Its callback is not called once this returns.
+/// </summary>
+/// <param name="subscription"></param>
+/// <returns>LATTICE_STATE_ERR_BAD_CONFIG if there is no such subscription.</returns>
+int Lattice_Unsubscribe(int subscription);
+/// <summary>
+/// Waits for events of subscriptions without a callback, and takes up to capacity of them, oldest first. Events are queued as ticks
+/// raise them, so none are missed between calls unless more than 65536 build up, when the oldest are dropped.
+/// </summary>
+/// <param name="events"></param>
+/// <param name="capacity"></param>
+/// <param name="timeout">Milliseconds to wait for an event, 0 to not wait, or -1 to wait for as long as it takes.</param>
+/// <param name="count">Receives the number of events taken, 0 if the wait timed out.</param>
+/// <returns></returns>
+int Lattice_Wait_Events(lattice_event* events, int capacity, int timeout, int* count);
+/// <summary>
+/// Evaluates the program for many input layers at once, as one tick would evaluate each, without advancing the simulation. Inputs
+/// holds count planes of Y*Z charges one after the other, each laid out as for Lattice_Write_Plane, and outputs receives count
+/// output planes laid out the same way. Every query starts from the charges of the lattice as they are, and the lattice itself
+/// is left untouched. Queries are evaluated side by side across SIMD lanes, so many lookups cost far less than a write, step and
+/// read for each.
+/// </summary>
+/// <param name="inputs"></param>
+/// <param name="count">The number of queries.</param>
+/// <param name="outputs"></param>
+/// <returns>The LATTICE_STATE flags raised by any query, or LATTICE_STATE_ERR_BAD_CONFIG if integration is on with integrators
+/// programmed, or noise is on.</returns>
+int Lattice_Evaluate_Batch(const CELL_TYPE* inputs, int count, CELL_TYPE* outputs);
+/// <summary>
+/// Evaluates the program for many input layers at once, with inputs and outputs scaled to the given range. See Lattice_Evaluate_Batch.
+/// </summary>
+/// <param name="values"></param>
+/// <param name="range"></param>
+/// <param name="count">The number of queries.</param>
+/// <param name="outputs"></param>
+/// <returns></returns>
+int Lattice_Evaluate_Batch(const int* values, int range, int count, int* outputs);
+/// <summary>
+/// Unlocks all integrators, allowing them to operate. Integrators are locked when the lattice is initialized.
 /// </summary>/// <returns></returns>
 int Lattice_Start_Integration();
 /// <summary>
 /// Locks all integrators, forcing them to hold their current value.
 /// </summary>/// <returns></returns>
-int Lattice_Stop_Integration();
\ No newline at end of file
+int Lattice_Stop_Integration();
+
+// Handle functions: the functions above, acting on a given lattice rather than the default one. Each lattice has its own
+// program, storage and simulation thread, so any number can run in one process.
+
+/// <summary>
+/// Initializes a new simulated lattice with the given dimensions and starts its simulation thread. See SIMU_Lattice_Init.
+/// </summary>
+/// <param name="handle">Receives the new lattice.</param>
+/// <param name="X"></param>
+/// <param name="Y"></param>
+/// <param name="Z"></param>
+/// <param name="noise"></param>
+/// <param name="ts"></param>
+/// <returns>An integer corresponding to the LATTICE_STATE values.</returns>
+int SIMU_Lattice_Init(LatticeHandle* handle, int X, int Y, int Z, int noise, double ts);
+int SIMU_Lattice_Init(LatticeHandle* handle, int X, int Y, int Z, int noise, double ts, int storage);
+/// <summary>
+/// Initializes a new simulated lattice as one slab of a domain, in LATTICE_RUN_STEPPED mode. See SIMU_Lattice_Init_Domain.
+/// </summary>
+/// <param name="handle">Receives the new lattice.</param>
+/// <returns></returns>
+int SIMU_Lattice_Init_Domain(LatticeHandle* handle, int X, int Y, int Z, int noise, double ts, int axis, int rank, int count,
+    const lattice_transport* transport);
+/// <summary>
+/// Initializes a new simulated lattice from a program image and starts its simulation thread. See SIMU_Lattice_Load.
+/// </summary>
+/// <param name="handle">Receives the new lattice.</param>
+/// <param name="path"></param>
+/// <param name="noise"></param>
+/// <param name="ts"></param>
+/// <returns></returns>
+int SIMU_Lattice_Load(LatticeHandle* handle, const char* path, int noise, double ts);
+int SIMU_Lattice_Save(LatticeHandle lattice, const char* path);
+int SIMU_Lattice_Checkpoint(LatticeHandle lattice, CheckpointHandle* checkpoint);
+int SIMU_Lattice_Restore(LatticeHandle lattice, CheckpointHandle checkpoint);
+/// <summary>
+/// Initializes a new simulated lattice as a copy of a checkpoint and starts its simulation thread. See SIMU_Lattice_Fork.
+/// </summary>
+/// <param name="handle">Receives the new lattice.</param>
+/// <param name="checkpoint"></param>
+/// <returns></returns>
+int SIMU_Lattice_Fork(LatticeHandle* handle, CheckpointHandle checkpoint);
+/// <summary>
+/// Stops and destroys a lattice. The handle is invalid afterwards.
+/// </summary>
+/// <param name="lattice"></param>
+/// <returns></returns>
+int SIMU_Lattice_Destroy(LatticeHandle lattice);
+int SIMU_Lattice_Examine(LatticeHandle lattice, int X, int Y, int Z, CELL_TYPE* cell);
+int SIMU_Lattice_NoiseMode(LatticeHandle lattice, int mode);
+int SIMU_Thread_Speed(LatticeHandle lattice, double ts);
+int SIMU_Poll_Rate(LatticeHandle lattice);
+int SIMU_Run_Mode(LatticeHandle lattice, int mode);
+int SIMU_Lattice_Step(LatticeHandle lattice, int n);
+int SIMU_Time_Factor(LatticeHandle lattice, double factor);
+int SIMU_Integration_Method(LatticeHandle lattice, int method);
+int SIMU_Integration_Tolerance(LatticeHandle lattice, double tolerance);
+int SIMU_Tick_Rate(LatticeHandle lattice, double hz);
+int SIMU_Thread_Affinity(LatticeHandle lattice, int cpu);
+int SIMU_Thread_Realtime(LatticeHandle lattice, int realtime);
+int SIMU_Thread_Count(LatticeHandle lattice, int threads);
+int SIMU_Thread_Scaling(LatticeHandle lattice, double* parallel, double* speedup);
+int SIMU_Lattice_SIMD(LatticeHandle lattice, int level);
+int SIMU_SIMD_Level(LatticeHandle lattice);
+int SIMU_Get_Stats(LatticeHandle lattice, lattice_stats* stats);
+int SIMU_Reset_Stats(LatticeHandle lattice);
+int SIMU_Stats_Region(LatticeHandle lattice, int region, int X, int Y, int Z, int width, int height, int depth);
+
+int Lattice_Program_Core(LatticeHandle lattice, int X, int Y, int Z, int code);
+int Lattice_Program_Connect(LatticeHandle lattice, int X, int Y, int Z, int code);
+int Lattice_Program_Begin(LatticeHandle lattice);
+int Lattice_Program_Commit(LatticeHandle lattice);
+int Lattice_Program_SetUnderbus(LatticeHandle lattice, CELL_TYPE charge);
+int Lattice_Program_SetUnderbus(LatticeHandle lattice, CELL_TYPE value, CELL_TYPE range);
+int Lattice_Program_SetUnderbus(LatticeHandle lattice, int value, int range);
+int Lattice_Write(LatticeHandle lattice, int Y, int Z, CELL_TYPE charge);
+int Lattice_Write(LatticeHandle lattice, int Y, int Z, CELL_TYPE value, CELL_TYPE range);
+int Lattice_Write(LatticeHandle lattice, int Y, int Z, int value, int range);
+int Lattice_Read(LatticeHandle lattice, int Y, int Z, CELL_TYPE* output);
+int Lattice_Read(LatticeHandle lattice, int Y, int Z, CELL_TYPE range, CELL_TYPE* output);
+int Lattice_Read(LatticeHandle lattice, int Y, int Z, int range, int* output);
+int Lattice_Write_Plane(LatticeHandle lattice, const CELL_TYPE* charges);
+int Lattice_Write_Plane(LatticeHandle lattice, const int* values, int range);
+int Lattice_Read_Plane(LatticeHandle lattice, CELL_TYPE* output);
+int Lattice_Read_Plane(LatticeHandle lattice, int range, int* output);
+int Lattice_Write_Region(LatticeHandle lattice, int Y, int Z, int height, int depth, const CELL_TYPE* charges, int stride);
+int Lattice_Write_Region(LatticeHandle lattice, int Y, int Z, int height, int depth, const int* values, int range, int stride);
+int Lattice_Read_Region(LatticeHandle lattice, int Y, int Z, int height, int depth, CELL_TYPE* output, int stride);
+int Lattice_Read_Region(LatticeHandle lattice, int Y, int Z, int height, int depth, int range, int* output, int stride);
+int Lattice_Read_Snapshot(LatticeHandle lattice, CELL_TYPE* output, long long* tick);
+int Lattice_Read_Snapshot(LatticeHandle lattice, int range, int* output, long long* tick);
+int Lattice_Read_Tick(LatticeHandle lattice, long long* tick);
+int Lattice_Wait(LatticeHandle lattice, int ticks);
+int Lattice_Subscribe(LatticeHandle lattice, int Y, int Z, int height, int depth, int trigger, CELL_TYPE level, int ticks, lattice_callback callback,
+    void* context, int* subscription);
+int Lattice_Unsubscribe(LatticeHandle lattice, int subscription);
+int Lattice_Wait_Events(LatticeHandle lattice, lattice_event* events, int capacity, int timeout, int* count);
+int Lattice_Evaluate_Batch(LatticeHandle lattice, const CELL_TYPE* inputs, int count, CELL_TYPE* outputs);
+int Lattice_Evaluate_Batch(LatticeHandle lattice, const int* values, int range, int count, int* outputs);
+int Lattice_Start_Integration(LatticeHandle lattice);
+int Lattice_Stop_Integration(LatticeHandle lattice);
@@ -4,13 +4,17 @@
 */
 #include "pch.h"
 #include "AnalogLibrary.h"
-#include <malloc.h>
-#include <Windows.h>
-#include <iostream>
+#include "lattice.h"
 #include <thread>
 #include <vector>
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+#include <climits>
 
+#ifdef _WIN32
 BOOL APIENTRY DllMain( HMODULE hModule,
                        DWORD  ul_reason_for_call,
                        LPVOID lpReserved
@@ -26,117 +30,236 @@ BOOL APIENTRY DllMain( HMODULE hModule,
     }
     return TRUE;
 }
-
-#define POS_X 0
-#define POS_Y 1
-#define POS_Z 2
-#define NEG_X 3
-#define NEG_Y 4
-#define NEG_Z 5
-
-#define OPTIM_CONNECTIONS
-#define ALL_CONNECTIONS 6
-#ifdef OPTIM_CONNECTIONS
-    #define CONNECTION_COUNT 3
-#else
-    #define CONNECTION_COUNT 6
 #endif
 
-#define LATTICE_PROG_CONNECT_CONFIG_ACTIVE 7		// Internal use only!
 #define NANOS_SECOND (double)1000000000
 
 #define abs(x) (x < 0 ? -x : x)
 
-typedef struct connect {
-    CELL_TYPE modifier;
-    char config;
-
-    // TODO: some heat val
-
-    connect() {
-        modifier = 0;
-        config = 0;
-    }
-};
-
-typedef struct cell {
-    CELL_TYPE charge;
-    bool flipswitch;
-    char config;
-    int x, y, z;
-    connect connections[CONNECTION_COUNT];
-
-    cell() {
-        x = y = z = 0;
-        flipswitch = false;
-        charge = 0;
-        config = 0;
-        for (int i = 0; i < CONNECTION_COUNT; i++) {
-            connections[i] = connect();
-        }
-    }
-    cell(int X, int Y, int Z) {
-        for (int i = 0; i < CONNECTION_COUNT; i++) {
-            connections[i] = connect();
-        }
-        x = X, y = Y, z = Z;
-        flipswitch = false;
-        charge = 0;
-        config = 0;
-    }
-};
-
-cell* cells;
-double timestep;
-int MAX, xMax, yMax, zMax, XYMax;
-
-int connectionDelta[ALL_CONNECTIONS];
-
-int noiseProfile;
-
-int isIntegrating;
+// The lattice acted on by the functions that take no handle.
+LatticeHandle _simu_default = 0;
 
-CELL_TYPE underbusCharge;
-
-int _simu_running;
-std::thread _simu_thread;
-std::vector<int> _simu_integrators;
-std::vector<int> _simu_endpoints;
+/// <summary>
+/// wakes the simulation thread if it is sleeping for want of work. Called after anything it waits on has changed.
+/// </summary>
+/// <param name="lattice"></param>
+void wake_lattice(LatticeHandle lattice) {
+    if (!lattice->idle.load()) return;
+    std::lock_guard<std::mutex> lock(lattice->idleLock);
+    lattice->idleWake.notify_one();
+}
 
 std::chrono::high_resolution_clock _clock;
 
 /// <summary>
-/// gets the position in memory corresponding to the given values
+/// returns true if the given coordinates lie inside the lattice
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="x"></param>
+/// <param name="y"></param>
+/// <param name="z"></param>
+/// <returns></returns>
+bool get_in_bounds(LatticeHandle lattice, int x, int y, int z) {
+    return x >= 0 && y >= 0 && z >= 0 && x < lattice->xMax && y < lattice->yMax && z < lattice->zMax;
+}
+/// <summary>
+/// returns the number of the brick holding the given coordinates, counting bricks along X, then Y, then Z
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="x"></param>
+/// <param name="y"></param>
+/// <param name="z"></param>
+/// <returns></returns>
+int get_brick(LatticeHandle lattice, int x, int y, int z) {
+    return (x >> BRICK_BITS)
+        + (y >> BRICK_BITS) * lattice->bricksX
+        + (z >> BRICK_BITS) * lattice->bricksX * lattice->bricksY;
+}
+/// <summary>
+/// returns the smallest power of two, as a shift, that is at least n
+/// </summary>
+/// <param name="n"></param>
+/// <returns></returns>
+int get_shift(int n) {
+    int shift = 0;
+    while ((1LL << shift) < n) shift++;
+    return shift;
+}
+/// <summary>
+/// spreads the low BRICK_BITS bits of v three bits apart, so coordinates can be interleaved into a Morton code
+/// </summary>
+/// <param name="v"></param>
+/// <returns></returns>
+int spread_bits(int v) {
+    int spread = 0;
+    for (int b = 0; b < BRICK_BITS; b++)
+        spread |= ((v >> b) & 1) << (3 * b);
+    return spread;
+}
+/// <summary>
+/// the inverse of spread_bits
+/// </summary>
+/// <param name="v"></param>
+/// <returns></returns>
+int compact_bits(int v) {
+    int compact = 0;
+    for (int b = 0; b < BRICK_BITS; b++)
+        compact |= ((v >> (3 * b)) & 1) << b;
+    return compact;
+}
+/// <summary>
+/// gets the position in memory corresponding to the given values, or -1 if they lie outside the lattice or in a brick that has not been allocated
 /// </summary>
+/// <param name="lattice"></param>
 /// <param name="x"></param>
 /// <param name="y"></param>
 /// <param name="z"></param>
 /// <returns></returns>
-int get_mem_pos(int x, int y, int z) {
+int get_mem_pos(LatticeHandle lattice, int x, int y, int z) {
+    if (!get_in_bounds(lattice, x, y, z)) return -1;
+    switch (lattice->storage) {
+    case LATTICE_STORAGE_PADDED:
+        return x | (y << lattice->xShift) | (z << (lattice->xShift + lattice->yShift));
+    case LATTICE_STORAGE_SPARSE:
+    case LATTICE_STORAGE_TILED: {
+        // Cells within a brick are in Morton order, so all six neighbours of most cells are in the same brick.
+        int brick = get_brick(lattice, x, y, z);
+        int slot = lattice->storage == LATTICE_STORAGE_SPARSE ? lattice->brickTable[brick] : brick;
+        if (slot < 0) return -1;
+        return slot * BRICK_CELLS
+            + spread_bits(x & BRICK_MASK)
+            + (spread_bits(y & BRICK_MASK) << 1)
+            + (spread_bits(z & BRICK_MASK) << 2);
+    }
+    }
     // use Z as the largest factor, Y medium, X smallest
     return x
-        + (y * xMax)
-        + (z * XYMax);
+        + (y * lattice->xMax)
+        + (z * lattice->XYMax);
+}
+/// <summary>
+/// gets the coordinates of the cell stored at the given position in memory
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="idx"></param>
+/// <param name="x"></param>
+/// <param name="y"></param>
+/// <param name="z"></param>
+void get_coords(LatticeHandle lattice, int idx, int* x, int* y, int* z) {
+    switch (lattice->storage) {
+    case LATTICE_STORAGE_PADDED:
+        *x = idx & ((1 << lattice->xShift) - 1);
+        *y = (idx >> lattice->xShift) & ((1 << lattice->yShift) - 1);
+        *z = idx >> (lattice->xShift + lattice->yShift);
+        return;
+    case LATTICE_STORAGE_SPARSE:
+    case LATTICE_STORAGE_TILED: {
+        int slot = idx / BRICK_CELLS;
+        int brick = lattice->storage == LATTICE_STORAGE_SPARSE ? lattice->brickIds[slot] : slot;
+        int offset = idx % BRICK_CELLS;
+        int bricksXY = lattice->bricksX * lattice->bricksY;
+        *x = ((brick % lattice->bricksX) << BRICK_BITS) + compact_bits(offset);
+        *y = ((brick % bricksXY / lattice->bricksX) << BRICK_BITS) + compact_bits(offset >> 1);
+        *z = ((brick / bricksXY) << BRICK_BITS) + compact_bits(offset >> 2);
+        return;
+    }
+    }
+    *z = idx / lattice->XYMax;
+    idx -= *z * lattice->XYMax;
+    *y = idx / lattice->xMax;
+    *x = idx - *y * lattice->xMax;
+}
+/// <summary>
+/// moves the given coordinates one cell along a connection
+/// </summary>
+/// <param name="connection"></param>
+/// <param name="x"></param>
+/// <param name="y"></param>
+/// <param name="z"></param>
+void step_coords(int connection, int* x, int* y, int* z) {
+    switch (connection) {
+    case POS_X: *x += 1; break;
+    case POS_Y: *y += 1; break;
+    case POS_Z: *z += 1; break;
+    case NEG_X: *x -= 1; break;
+    case NEG_Y: *y -= 1; break;
+    case NEG_Z: *z -= 1; break;
+    }
+}
+
+/// <summary>
+/// reallocates the cell storage to hold the given number of cells, keeping what is stored. Must be called with the program lock held.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="cells"></param>
+void resize_storage(LatticeHandle lattice, int cells) {
+    int kept = std::min(cells, lattice->MAX);
+    CELL_TYPE* charges = new CELL_TYPE[cells + 1](); // the spare cell lets kernels read fixed point charges in pairs
+    char* cores = new char[cells]();
+    std::copy(lattice->charges, lattice->charges + kept, charges);
+    std::copy(lattice->cores, lattice->cores + kept, cores);
+    delete[] lattice->charges;
+    delete[] lattice->cores;
+    lattice->charges = charges;
+    lattice->cores = cores;
+    for (int i = 0; i < CONNECTION_COUNT; i++) {
+        char* links = new char[cells]();
+        CELL_TYPE* modifiers = new CELL_TYPE[cells]();
+        std::copy(lattice->links[i], lattice->links[i] + kept, links);
+        std::copy(lattice->modifiers[i], lattice->modifiers[i] + kept, modifiers);
+        delete[] lattice->links[i];
+        delete[] lattice->modifiers[i];
+        lattice->links[i] = links;
+        lattice->modifiers[i] = modifiers;
+    }
+    lattice->integratorIndex.resize(cells, -1);
+    lattice->MAX = cells;
+}
+/// <summary>
+/// returns the position in memory of the given cell, allocating its brick first if the lattice is sparse. Must be called with the
+/// program lock held.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="x"></param>
+/// <param name="y"></param>
+/// <param name="z"></param>
+/// <returns>-1 if the cell lies outside the lattice, or its brick would not fit in the storage.</returns>
+int allocate_cell(LatticeHandle lattice, int x, int y, int z) {
+    if (!get_in_bounds(lattice, x, y, z)) return -1;
+    if (lattice->storage == LATTICE_STORAGE_SPARSE) {
+        int brick = get_brick(lattice, x, y, z);
+        if (lattice->brickTable[brick] < 0) {
+            int slot = (int)lattice->brickIds.size();
+            if (slot >= INT_MAX / BRICK_CELLS) return -1;
+            if ((slot + 1) * BRICK_CELLS > lattice->MAX)
+                resize_storage(lattice, (int)std::min((long long)lattice->MAX * 2, (long long)(INT_MAX / BRICK_CELLS) * BRICK_CELLS));
+            lattice->brickTable[brick] = slot;
+            lattice->brickIds.push_back(brick);
+        }
+    }
+    return get_mem_pos(lattice, x, y, z);
 }
 /// <summary>
 /// returns the connection to be modified
 /// </summary>
+/// <param name="lattice"></param>
 /// <param name="x"></param>
 /// <param name="y"></param>
 /// <param name="z"></param>
 /// <param name="connection"></param>
 /// <param name="ret"></param>
 /// <returns></returns>
-int get_connection(int x, int y, int z, int connection, connect** ret) {
-    int idx = get_mem_pos(x, y, z);
-    if (idx < 0 || idx >= MAX) return LATTICE_STATE_ERR_BAD_CELL_POS;
-    if (connection < 0 || connection > ALL_CONNECTIONS) return LATTICE_STATE_ERR_BAD_CELL_POS;
+int get_connection(LatticeHandle lattice, int x, int y, int z, int connection, port* ret) {
+    if (!get_in_bounds(lattice, x, y, z)) return LATTICE_STATE_ERR_BAD_CELL_POS;
+    if (connection < 0 || connection >= ALL_CONNECTIONS) return LATTICE_STATE_ERR_BAD_CELL_POS;
+    int idx = get_mem_pos(lattice, x, y, z);
+    if (idx < 0) return LATTICE_STATE_ERR_NO_CONNECTION; // nothing has been programmed in this brick
 
 #ifdef OPTIM_CONNECTIONS
     if (connection < 3) {
 #endif
-        cell* cell = &cells[idx];
-        *ret = &cell->connections[connection];
+        ret->cell = idx;
+        ret->axis = connection;
         return LATTICE_STATE_OKAY;
 #ifdef OPTIM_CONNECTIONS
     }
@@ -153,353 +276,1584 @@ int get_connection(int x, int y, int z, int connection, connect** ret) {
             break;
         }
         if (x < 0 || y < 0 || z < 0) return LATTICE_STATE_ERR_NO_CONNECTION;
-        return get_connection(x, y, z, connection - 3, ret);
+        return get_connection(lattice, x, y, z, connection - 3, ret);
     }
 #endif
 }
+
+int register_into_vector(int idx, std::vector<int>* vector, std::vector<int>* index = 0) {
+    if (index) index->operator[](idx) = (int)vector->size();
+    vector->push_back(idx);
+    return 0;
+}
+/// <summary>
+/// removes idx from a vector registered with an index of the position of each cell, moving the last entry into its place
+/// </summary>
+/// <param name="idx"></param>
+/// <param name="vector"></param>
+/// <param name="index"></param>
+/// <returns></returns>
+int deregister_into_vector(int idx, std::vector<int>* vector, std::vector<int>* index) {
+    int i = index->at(idx);
+    if (i < 0) return 0;
+    int last = vector->back();
+    vector->operator[](i) = last;
+    index->operator[](last) = i;
+    vector->pop_back();
+    index->operator[](idx) = -1;
+    return 0;
+}
+
+// returns 1 if the given connection flows to origin, else 0
+int get_is_connection_to_me(LatticeHandle lattice, int oX, int oY, int oZ, int connection) {
+    port connector;
+    int code = get_connection(lattice, oX, oY, oZ, connection, &connector);
+    if (code != LATTICE_STATE_OKAY) return 0;
+    char config = lattice->links[connector.axis][connector.cell];
+    if (!(config & LATTICE_PROG_CONNECT_CONFIG_ACTIVE)) return 0;
+
+    // Get the connection: if it is on a negative axis (>2) and is to positive, its to me, OR if it is on positive axis <3 and to negative
+    if ((connection < 3 && (config & LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG)) ||
+        (connection > 2 && !(config & LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG))) {
+        return 1;
+    }
+    return 0;
+}
+/// <summary>
+/// returns the noise modes that take effect from a set of LATTICE_NOISE_MODE flags. Heat only builds up with resistive noise.
+/// </summary>
+/// <param name="mode"></param>
+/// <returns></returns>
+int get_noise_mode(int mode) {
+    if (!(mode & LATTICE_NOISE_MODE_RESISTIVE)) mode &= ~LATTICE_NOISE_MODE_HEAT_RESISTIVE;
+    return mode;
+}
 /// <summary>
-/// returns the connection indicated
+/// returns the index of the neighbour of idx along the given connection, or -1 if it lies outside the lattice or has not been allocated
 /// </summary>
+/// <param name="lattice"></param>
 /// <param name="idx"></param>
 /// <param name="connection"></param>
-/// <param name="ret"></param>
 /// <returns></returns>
-int get_connection(int idx, int connection, connect** ret) {
-    if (idx < 0 || idx >= MAX) return -1;
-    if (connection < 0 || connection > ALL_CONNECTIONS) return -2;
+int get_neighbour(LatticeHandle lattice, int idx, int connection) {
+    int x, y, z;
+    get_coords(lattice, idx, &x, &y, &z);
+    step_coords(connection, &x, &y, &z);
+    if (!get_in_bounds(lattice, x, y, z)) return -1;
+    if (lattice->connectionDelta[connection] == 0) return get_mem_pos(lattice, x, y, z);
+    return idx + lattice->connectionDelta[connection];
+}
 
-#ifdef OPTIM_CONNECTIONS
-    if (connection < 3) {
-#endif
-        cell* cell = &cells[idx];
-        *ret = &cell->connections[connection];
-        return 0;
-#ifdef OPTIM_CONNECTIONS
+/// <summary>
+/// returns the number of lines into idx, filling in the cell each comes from and the port it is stored at
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="idx"></param>
+/// <param name="sources"></param>
+/// <param name="connectors"></param>
+/// <returns></returns>
+int get_inputs(LatticeHandle lattice, int idx, int* sources, port* connectors) {
+    int x, y, z;
+    get_coords(lattice, idx, &x, &y, &z);
+
+    int k = 0;
+    for (int i = 0; i < ALL_CONNECTIONS; i++) {
+        int src = get_neighbour(lattice, idx, i);
+        if (src < 0) continue;
+        if (!get_is_connection_to_me(lattice, x, y, z, i)) continue;
+        get_connection(lattice, x, y, z, i, &connectors[k]);
+        sources[k++] = src;
     }
-    else {
-        idx -= connectionDelta[connection];
-        if (idx < 0) return LATTICE_STATE_ERR_NO_CONNECTION;
-        return get_connection(idx, connection - 3, ret);
+    return k;
+}
+
+/// <summary>
+/// appends idx to the schedule with the lines into it
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="idx"></param>
+void compile_cell(LatticeHandle lattice, int idx) {
+    int sources[ALL_CONNECTIONS];
+    port connectors[ALL_CONNECTIONS];
+    int k = get_inputs(lattice, idx, sources, connectors);
+
+    instruction op;
+    op.cell = idx;
+    op.config = lattice->cores[idx];
+    lattice->schedule.push_back(op);
+    for (int i = 0; i < k; i++) {
+        port line = connectors[i];
+        lattice->edges.push_back(edge(sources[i], lattice->modifiers[line.axis][line.cell], lattice->links[line.axis][line.cell]));
     }
-#endif
+    lattice->edgeOffsets.push_back((int)lattice->edges.size());
 }
 
-int register_into_vector(int idx, std::vector<int>* vector) {
-    vector->push_back(idx);
-    return 0;
+/// <summary>
+/// sorts cells by x, then y, then z
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="cells"></param>
+void sort_cells(LatticeHandle lattice, std::vector<int>* cells) {
+    std::vector<std::pair<long long, int>> order(cells->size());
+    for (int i = 0; i < cells->size(); i++) {
+        int x, y, z;
+        get_coords(lattice, cells->at(i), &x, &y, &z);
+        order[i] = std::make_pair(((long long)x * lattice->yMax + y) * lattice->zMax + z, cells->at(i));
+    }
+    std::sort(order.begin(), order.end());
+    for (int i = 0; i < cells->size(); i++)
+        cells->at(i) = order[i].second;
+}
+
+void search_loops(LatticeHandle lattice, loop_search* search, int root, bool whole);
+
+/// <summary>
+/// appends the cells of a feedback loop to the schedule. Integrators hold the state of a loop: the other cells are scheduled first,
+/// after everything in the loop they read other than its integrators, and read the integrators as the last tick left them. Then
+/// the integrators follow, each reading the loop as this tick leaves it. Any loop left among the other cells, and the integrators
+/// themselves, are evaluated in order of x, then y, then z, so a cell reads those before it as this tick leaves them and those
+/// after it as the last tick left them.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="search"></param>
+/// <param name="cells"></param>
+void compile_loop(LatticeHandle lattice, loop_search* search, std::vector<int>* cells) {
+    std::vector<int> integrating, others;
+    for (int i = 0; i < cells->size(); i++) {
+        int idx = cells->at(i);
+        if ((lattice->cores[idx] & LATTICE_PROG_CORE_MASK) == LATTICE_PROG_CORE_INT) integrating.push_back(idx);
+        else others.push_back(idx);
+    }
+    sort_cells(lattice, &integrating);
+    sort_cells(lattice, &others);
+
+    // The other cells are searched again, without the lines out of the integrators.
+    for (int i = 0; i < others.size(); i++) {
+        search->reached[others[i]] = -1;
+        search->inside[others[i]] = 1;
+    }
+    for (int i = 0; i < others.size(); i++) {
+        if (search->reached[others[i]] < 0) search_loops(lattice, search, others[i], false);
+    }
+    for (int i = 0; i < others.size(); i++)
+        search->inside[others[i]] = 0;
+
+    for (int i = 0; i < integrating.size(); i++)
+        compile_cell(lattice, integrating[i]);
 }
-int deregister_into_vector(int idx, std::vector<int>* vector) {
-    for (int i = 0; i < vector->size(); i++) {
-        if (vector->at(i) == idx) {
-            vector->operator[](i) = vector->at(vector->size() - 1);
-            vector->pop_back();
-            return 0;
+
+/// <summary>
+/// schedules everything flowing into root that the search has not reached yet. The cells are searched depth first from a stack of
+/// their own rather than the call stack, so a chain may be as long as memory allows, and feedback loops are found as they are left
+/// (Tarjan's strongly connected components). A cell is scheduled after everything flowing into it, and a loop after everything
+/// flowing into any of its cells.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="search"></param>
+/// <param name="root"></param>
+/// <param name="whole">false to search only the cells marked inside, scheduling any loop among them in order of position.</param>
+void search_loops(LatticeHandle lattice, loop_search* search, int root, bool whole) {
+    std::vector<int>& reached = search->reached;
+    std::vector<int>& lowest = search->lowest;
+    std::vector<int>& component = search->component;
+    std::vector<search_frame>& path = search->path;
+    size_t base = path.size();
+
+    int idx = root;
+    while (true) {
+        if (idx >= 0) {
+            reached[idx] = lowest[idx] = search->next++;
+            search->open[idx] = 1;
+            component.push_back(idx);
+            search_frame frame;
+            frame.cell = idx;
+            frame.connection = 0;
+            get_coords(lattice, idx, &frame.x, &frame.y, &frame.z);
+            path.push_back(frame);
+        }
+        idx = -1;
+
+        search_frame* top = &path.back();
+        if (top->connection < ALL_CONNECTIONS) {
+            int i = top->connection++;
+            int src = get_neighbour(lattice, top->cell, i);
+            if (src < 0 || (!whole && !search->inside[src])) continue;
+            if (!get_is_connection_to_me(lattice, top->x, top->y, top->z, i)) continue;
+            if (reached[src] < 0) idx = src;
+            else if (search->open[src]) lowest[top->cell] = std::min(lowest[top->cell], reached[src]);
+            continue;
         }
+
+        int cell = top->cell;
+        path.pop_back();
+        if (path.size() > base) lowest[path.back().cell] = std::min(lowest[path.back().cell], lowest[cell]);
+        if (lowest[cell] == reached[cell]) {
+            // Everything opened since this cell reads it and is read by it: a loop, or the cell on its own.
+            size_t first = component.size();
+            while (component[--first] != cell);
+            std::vector<int> cells(component.begin() + first, component.end());
+            component.resize(first);
+            for (int i = 0; i < cells.size(); i++)
+                search->open[cells[i]] = 0;
+
+            if (cells.size() == 1) compile_cell(lattice, cell);
+            else if (whole) compile_loop(lattice, search, &cells);
+            else {
+                sort_cells(lattice, &cells);
+                for (int i = 0; i < cells.size(); i++)
+                    compile_cell(lattice, cells[i]);
+            }
+        }
+        if (path.size() == base) break;
     }
-    return 0;
 }
 
-// returns 1 if the given connection flows to origin, else 0
-int get_is_connection_to_me(int oX, int oY, int oZ, int connection) {
-    connect* connector = 0;
-    int code = get_connection(oX, oY, oZ, connection, &connector);
-    if (code == LATTICE_STATE_ERR_NO_CONNECTION) return 0;
-    if (!(connector->config & LATTICE_PROG_CONNECT_CONFIG_ACTIVE)) return 0;
+/// <summary>
+/// rebuilds the schedule from the integrators and endpoints. Must be called with the program lock held.
+/// </summary>
+/// <param name="lattice"></param>
+void compile_schedule(LatticeHandle lattice) {
+    loop_search search;
+    search.reached.assign(lattice->MAX, -1);
+    search.lowest.assign(lattice->MAX, 0);
+    search.open.assign(lattice->MAX, 0);
+    search.inside.assign(lattice->MAX, 0);
+    search.next = 0;
+    lattice->schedule.clear();
+    lattice->edges.clear();
+    lattice->edgeOffsets.assign(1, 0);
 
-    // Get the connection: if it is on a negative axis (>2) and is to positive, its to me, OR if it is on positive axis <3 and to negative
-    if ((connection < 3 && (connector->config & LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG)) ||
-        (connection > 2 && !(connector->config & LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG))) {
-        return 1;
+    for (int i = 0; i < lattice->integrators.size(); i++) {
+        if (search.reached[lattice->integrators[i]] < 0) search_loops(lattice, &search, lattice->integrators[i], true);
+    }
+    for (int i = 0; i < lattice->endpoints.size(); i++) {
+        if (search.reached[lattice->endpoints[i]] < 0) search_loops(lattice, &search, lattice->endpoints[i], true);
     }
-    return 0;
 }
-int get_value_through_connection(int idx, connect* connection, CELL_TYPE* output) {
-    int flags = 0;
-    CELL_TYPE val = cells[idx].charge;
-    char config = connection->config;
 
-    if (!(config & LATTICE_PROG_CONNECT_CONFIG_ACTIVE)) return 0;
+void link_batches(LatticeHandle lattice) {
+#ifdef CELL_TYPE_USE_FIXED_POINT
+    // Integrators start again from their charges, with nothing carried.
+    int integrators = 0;
+    for (int b = 0; b < lattice->batches.size(); b++) {
+        if ((lattice->batches[b].core & LATTICE_PROG_CORE_MASK) == LATTICE_PROG_CORE_INT) integrators += lattice->batches[b].count;
+    }
+    lattice->residuals.assign(integrators, 0);
+#endif
+    for (int b = 0, cellOffset = 0, lineOffset = 0, residualOffset = 0; b < lattice->batches.size(); b++) {
+        batch* work = &lattice->batches[b];
+        work->cells = lattice->batchCells.data() + cellOffset;
+        work->sources = lattice->batchSources.data() + lineOffset;
+        work->modifiers = lattice->batchModifiers.data() + lineOffset;
+        work->noise = 0;
+        work->residuals = 0;
+        if (!lattice->residuals.empty() && (work->core & LATTICE_PROG_CORE_MASK) == LATTICE_PROG_CORE_INT) {
+            work->residuals = lattice->residuals.data() + residualOffset;
+            residualOffset += work->count;
+        }
+        work->features = get_kernel_features(work);
+        if (lattice->noiseProfile && work->core != LATTICE_PROG_CORE_HOLDVAL) work->features |= KERNEL_NOISE;
+        work->kernel = lattice->kernels(work->core, work->features);
+        cellOffset += work->count;
+        lineOffset += work->count * work->inputs;
+    }
+}
 
-    // ignore directionality, as its assumed to be correct.
-    
-    switch (config & LATTICE_PROG_CONNECT_CONFIG_MOD_MASK) {
-    case LATTICE_PROG_CONNECT_CONFIG_MOD_COEFF:
-        val *= connection->modifier;
-        break;
-    case LATTICE_PROG_CONNECT_CONFIG_MOD_DIVIS:
-        if (connection->modifier == 0) {
-            val = LATTICE_DEFAULT_DIV_ZERO;
-            flags |= LATTICE_STATE_ERR_DIV_ZERO;
+/// <summary>
+/// groups the schedule into batches for the kernels. Each cell is given the lowest level above the cells that feed it,
+/// and a cell that reads a later cell around a feedback loop keeps that cell on a higher level, so it still sees the previous tick's value.
+/// </summary>
+/// <param name="lattice"></param>
+void compile_batches(LatticeHandle lattice) {
+    std::vector<instruction>& schedule = lattice->schedule;
+    std::vector<int>& edgeOffsets = lattice->edgeOffsets;
+    std::vector<edge>& edges = lattice->edges;
+
+    int count = (int)schedule.size();
+    std::vector<int> position(lattice->MAX, -1);
+    for (int s = 0; s < count; s++)
+        position[schedule[s].cell] = s;
+
+    std::vector<int> level(count, 0);
+    std::vector<std::pair<unsigned long long, int>> keys(count);
+    for (int s = 0; s < count; s++) {
+        int begin = edgeOffsets[s], end = edgeOffsets[s + 1];
+        for (int e = begin; e < end; e++) {
+            int p = position[edges[e].source];
+            if (p < s) level[s] = std::max(level[s], level[p] + 1);
         }
-        else {
-            val = val / connection->modifier; 
-            if (abs(val) > 1) {
-                val = 0;
-                flags |= LATTICE_STATE_ERR_OVERFLOW_CELL;
+        unsigned long long key = 0;
+        for (int e = begin; e < end; e++) {
+            int p = position[edges[e].source];
+            if (p > s) level[p] = std::max(level[p], level[s] + 1);
+            key |= (unsigned long long)((edges[e].config & LATTICE_PROG_CONNECT_CONFIG_PATTERN) >> 4) << ((e - begin) * 4);
+        }
+        key |= (unsigned long long)(end - begin) << 24;
+        key |= (unsigned long long)(schedule[s].config & LATTICE_PROG_CORE_MASK) << 27;
+        key |= (unsigned long long)level[s] << 29;
+        keys[s] = std::make_pair(key, s);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    lattice->batches.clear();
+    lattice->batchCells.clear();
+    lattice->batchSources.clear();
+    lattice->batchModifiers.clear();
+    for (int first = 0; first < count;) {
+        int last = first;
+        while (last < count && keys[last].first == keys[first].first) last++;
+
+        int s = keys[first].second;
+        batch work;
+        work.level = level[s];
+        work.core = schedule[s].config & LATTICE_PROG_CORE_MASK;
+        work.inputs = edgeOffsets[s + 1] - edgeOffsets[s];
+        work.count = last - first;
+        for (int k = 0; k < work.inputs; k++)
+            work.pattern[k] = edges[edgeOffsets[s] + k].config & LATTICE_PROG_CONNECT_CONFIG_PATTERN;
+        work.features = get_kernel_features(&work);
+
+        for (int i = first; i < last; i++)
+            lattice->batchCells.push_back(schedule[keys[i].second].cell);
+        for (int k = 0; k < work.inputs; k++) {
+            for (int i = first; i < last; i++) {
+                edge* line = &edges[edgeOffsets[keys[i].second] + k];
+                bool plain = (work.pattern[k] & LATTICE_PROG_CONNECT_CONFIG_MOD_MASK) == 0;
+                lattice->batchSources.push_back(line->source);
+                lattice->batchModifiers.push_back(plain && (work.features & KERNEL_COEFF) ? CELL_ONE : line->modifier);
             }
         }
-        break;
-    case LATTICE_PROG_CONNECT_CONFIG_MOD_COMP:
-        if (val == connection->modifier) val = 0;
-        else if (val < connection->modifier) val = -1;
-        else val = 1;
+        lattice->batches.push_back(work);
+        first = last;
+    }
 
-        break;
+    link_batches(lattice);
+}
+
+void compile_tasks(LatticeHandle lattice) {
+    lattice->tasks.clear();
+    lattice->levelTasks.assign(1, 0);
+    lattice->levelCells.clear();
+    for (int b = 0; b < lattice->batches.size(); b++) {
+        int level = lattice->batches[b].level;
+        while (lattice->levelCells.size() <= level) {
+            lattice->levelCells.push_back(0);
+            lattice->levelTasks.push_back((int)lattice->tasks.size());
+        }
+        for (int begin = 0; begin < lattice->batches[b].count; begin += POOL_TASK_CELLS) {
+            task job;
+            job.batch = b;
+            job.begin = begin;
+            job.end = std::min(begin + POOL_TASK_CELLS, lattice->batches[b].count);
+            lattice->tasks.push_back(job);
+        }
+        lattice->levelCells[level] += lattice->batches[b].count;
+        lattice->levelTasks[level + 1] = (int)lattice->tasks.size();
+    }
+    compile_regions(lattice);
+}
+
+/// <summary>
+/// builds the consumer lists used to mark tasks dirty
+/// </summary>
+/// <param name="lattice"></param>
+void compile_consumers(LatticeHandle lattice) {
+    std::vector<int> slots(lattice->MAX, -1);
+    for (int i = 0; i < lattice->batchCells.size(); i++)
+        slots[lattice->batchCells[i]] = i;
+
+    // (slot read, task reading it) for every line, deduplicated.
+    std::vector<std::pair<int, int>> reads;
+    for (int t = 0; t < lattice->tasks.size(); t++) {
+        task* job = &lattice->tasks[t];
+        const batch* work = &lattice->batches[job->batch];
+        for (int k = 0; k < work->inputs; k++) {
+            for (int i = job->begin; i < job->end; i++)
+                reads.push_back(std::make_pair(slots[work->sources[k * work->count + i]], t));
+        }
     }
+    std::sort(reads.begin(), reads.end());
+    reads.erase(std::unique(reads.begin(), reads.end()), reads.end());
 
-    if (config & LATTICE_PROG_CONNECT_CONFIG_ABSOLUTE) 
-        val = abs(val);
+    lattice->consumerOffsets.assign(lattice->batchCells.size() + 1, 0);
+    lattice->consumers.clear();
+    for (int r = 0; r < reads.size(); r++) {
+        lattice->consumerOffsets[reads[r].first + 1]++;
+        lattice->consumers.push_back(reads[r].second);
+    }
+    for (int i = 0; i < lattice->batchCells.size(); i++)
+        lattice->consumerOffsets[i + 1] += lattice->consumerOffsets[i];
+}
 
-    if (config & LATTICE_PROG_CONNECT_CONFIG_INVERT)
-        val = -val;
+void compile_slots(LatticeHandle lattice) {
+    std::vector<int> slots(lattice->MAX, -1);
+    for (int i = 0; i < lattice->batchCells.size(); i++)
+        slots[lattice->batchCells[i]] = i;
 
-    *output = val;
+    lattice->liveTasks = 0;
+    for (int t = 0; t < lattice->tasks.size(); t++) {
+        if ((lattice->batches[lattice->tasks[t].batch].core & LATTICE_PROG_CORE_MASK) == LATTICE_PROG_CORE_INT) lattice->liveTasks++;
+    }
 
-    return flags;
+    int plane = lattice->yMax * lattice->zMax;
+    lattice->inputSlots.resize(plane);
+    lattice->inputCells.resize(plane);
+    lattice->outputCells.resize(plane);
+    lattice->outputSlots.resize(plane);
+    for (int z = 0, p = 0; z < lattice->zMax; z++) {
+        for (int y = 0; y < lattice->yMax; y++, p++) {
+            int idx = get_mem_pos(lattice, 0, y, z);
+            lattice->inputCells[p] = idx;
+            lattice->inputSlots[p] = idx < 0 ? -1 : slots[idx];
+            lattice->outputCells[p] = get_mem_pos(lattice, lattice->xMax - 1, y, z);
+            lattice->outputSlots[p] = lattice->outputCells[p] < 0 ? -1 : slots[lattice->outputCells[p]];
+        }
+    }
+    lattice->sourceSlots.resize(lattice->batchSources.size());
+    for (int i = 0; i < lattice->batchSources.size(); i++)
+        lattice->sourceSlots[i] = slots[lattice->batchSources[i]];
+
+    delete[] lattice->taskDirty;
+    lattice->taskDirty = new std::atomic<unsigned char>[lattice->tasks.size()];
+    for (int t = 0; t < lattice->tasks.size(); t++)
+        lattice->taskDirty[t] = 1;
+    if (lattice->domainCount > 1) compile_halo(lattice, slots.data());
+}
+
+void mark_consumers(LatticeHandle lattice, int slot) {
+    for (int c = lattice->consumerOffsets[slot]; c < lattice->consumerOffsets[slot + 1]; c++)
+        lattice->taskDirty[lattice->consumers[c]].store(1, std::memory_order_relaxed);
 }
 
-int recursive_operate(int idx, bool flip, double dt) {
-    if (idx == 3) {
-        //std::cout << "Operating on cell #" << idx << std::endl;
-        int k = 1;
+int run_task(LatticeHandle lattice, int index, double dt, bool noise) {
+    const task* job = &lattice->tasks[index];
+    const batch* work = &lattice->batches[job->batch];
+    CELL_TYPE* charges = lattice->charges;
+    int slot = (int)(work->cells - lattice->batchCells.data());
+
+    // An integrator is assumed to change every tick, anything else is compared against its value before the tick.
+    bool integrating = (work->core & LATTICE_PROG_CORE_MASK) == LATTICE_PROG_CORE_INT;
+    CELL_TYPE before[POOL_TASK_CELLS];
+    if (!integrating) {
+        for (int i = job->begin; i < job->end; i++)
+            before[i - job->begin] = charges[work->cells[i]];
     }
+
+    if (noise && (work->features & KERNEL_NOISE)) apply_noise(lattice, index);
+    int flags = work->kernel(charges, work, job->begin, job->end, dt);
+    if (!lattice->taskRegions.empty() && lattice->taskRegions[index]) record_regions(lattice, index, flags);
+
+    for (int i = job->begin; i < job->end; i++) {
+        if (integrating || memcmp(&before[i - job->begin], &charges[work->cells[i]], sizeof(CELL_TYPE)))
+            mark_consumers(lattice, slot + i);
+    }
+    return flags;
+}
+
+/// <summary>
+/// runs one tick over the tasks that need it, level by level. Levels with enough work are spread across the worker pool,
+/// the rest run on the calling thread.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="dt"></param>
+/// <param name="noise">Set on the first evaluation of a tick, which draws the noise of every line.</param>
+/// <param name="active">Set if any task ran.</param>
+/// <param name="evaluated">Receives the number of cells evaluated.</param>
+/// <param name="lines">Receives the number of lines those cells read.</param>
+/// <returns>The accumulated LATTICE_STATE flags of the tick.</returns>
+int operate_tasks(LatticeHandle lattice, double dt, bool noise, bool* active, long long* evaluated, long long* lines) {
     int flags = 0;
-    //if flipped, return instantly as we can assume its been computed
-    if (cells[idx].flipswitch == flip)
-        return -1;
+    // Other methods leave integrators to integrate().
+    bool integrating = lattice->isIntegrating && lattice->integrationMethod == LATTICE_INTEGRATE_EULER;
+    bool noisy = noise && lattice->noiseProfile != 0;
+    worker_pool* pool = &lattice->pool;
+    std::vector<int>& pending = lattice->pending;
+    *evaluated = *lines = 0;
 
-    cells[idx].flipswitch = flip;
+    for (int level = 0; level < lattice->levelCells.size(); level++) {
+        pending.clear();
+        int cells = 0;
+        for (int t = lattice->levelTasks[level]; t < lattice->levelTasks[level + 1]; t++) {
+            task* job = &lattice->tasks[t];
+            int core = lattice->batches[job->batch].core & LATTICE_PROG_CORE_MASK;
+            bool dirty = lattice->taskDirty[t].exchange(0, std::memory_order_relaxed) != 0;
+            // Holding cells never change, and integrators hold while integration is off. With noise, every line changes every tick,
+            // though only once: the later evaluations of a tick keep the noise drawn by the first.
+            if (core == LATTICE_PROG_CORE_HOLDVAL) continue;
+            if (core == LATTICE_PROG_CORE_INT ? !integrating : !(dirty || noisy)) continue;
+            pending.push_back(t);
+            cells += job->end - job->begin;
+            *lines += (long long)(job->end - job->begin) * lattice->batches[job->batch].inputs;
+        }
+        if (pending.empty()) continue;
+        *active = true;
+        lattice->cellsTotal += cells;
+        *evaluated += cells;
 
-    // check all connections to see if theyre TO this cell, or AWAY from this cell
-    CELL_TYPE cell_values[ALL_CONNECTIONS] = { 0, 0, 0, 0, 0, 0 };
-    int k = 0;
-    for (int i = 0; i < ALL_CONNECTIONS; i++) {
-        int toMe = get_is_connection_to_me(cells[idx].x, cells[idx].y, cells[idx].z, i);
-        if (!toMe) continue;
-        flags |= recursive_operate(idx + connectionDelta[i], flip, dt);
-        connect* connector = 0;
-        get_connection(cells[idx].x, cells[idx].y, cells[idx].z, i, &connector);
-        flags |= get_value_through_connection(idx + connectionDelta[i], connector, &cell_values[k++]);
+        if (pool->participants == 1 || cells < POOL_MIN_PARALLEL_CELLS) {
+            for (int p = 0; p < pending.size(); p++)
+                flags |= run_task(lattice, pending[p], dt, noise);
+            continue;
+        }
+        pool->lattice = lattice;
+        pool->tasks = pending.data();
+        pool->dt = dt;
+        pool->noise = noise;
+        auto start = std::chrono::steady_clock::now();
+        flags |= pool->run(0, (int)pending.size());
+        auto end = std::chrono::steady_clock::now();
+        lattice->parallelNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        lattice->cellsParallel += cells;
     }
+    return flags;
+}
 
-    // OPERATE ON ALL VALUES WE RECEIVE IN THIS FRAME
-    switch (cells[idx].config & LATTICE_PROG_CORE_MASK) {
-        case LATTICE_PROG_CORE_SUM:
-            cells[idx].charge = 0;
-            for (int i = 0; i < k; i++) 
-                cells[idx].charge += cell_values[i];
-            break;
-        case LATTICE_PROG_CORE_MULT:
-            cells[idx].charge = 1;
-            for (int i = 0; i < k; i++) 
-                cells[idx].charge *= cell_values[i];
-            break;
-        case LATTICE_PROG_CORE_INT:
-            for (int i = 0; i < k; i++)
-                cells[idx].charge += (CELL_TYPE)(cell_values[i] * dt);
-            break;
+/// <summary>
+/// copies the input plane into the input layer of the lattice if it has been written, marking the readers of any cell that changed
+/// </summary>
+/// <param name="lattice"></param>
+/// <returns>true if any input changed.</returns>
+bool load_inputs(LatticeHandle lattice) {
+    if (!lattice->inputsDirty.exchange(false)) return false;
+    bool changed = false;
+    CELL_TYPE* charges = lattice->charges;
+    const CELL_TYPE* plane = lattice->inputs;
+    const int* cells = lattice->inputCells.data();
+    for (int p = 0; p < lattice->inputCells.size(); p++) {
+        if (cells[p] < 0) continue; // nothing reads an input in an unallocated brick
+        CELL_TYPE* cell = &charges[cells[p]];
+        if (!memcmp(cell, &plane[p], sizeof(CELL_TYPE))) continue;
+        *cell = plane[p];
+        changed = true;
+        if (lattice->inputSlots[p] >= 0) mark_consumers(lattice, lattice->inputSlots[p]);
     }
+    return changed;
+}
+void store_outputs(LatticeHandle lattice) {
+    long long tick = lattice->tick.load(std::memory_order_relaxed) + 1;
+    lattice->publishing.store(tick, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const CELL_TYPE* charges = lattice->charges;
+    CELL_TYPE* plane = lattice->outputs[tick & 1];
+    const int* cells = lattice->outputCells.data();
+    for (int p = 0; p < lattice->outputCells.size(); p++)
+        plane[p] = cells[p] < 0 ? 0 : charges[cells[p]];
+    lattice->outputTicks[tick & 1] = tick - lattice->tickOffset;
+    lattice->tick.store(tick, std::memory_order_release);
+}
+/// <summary>
+/// starts reading the outputs of the last complete tick, returning its output plane
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="tick"></param>
+/// <returns></returns>
+const CELL_TYPE* begin_snapshot(LatticeHandle lattice, long long* tick) {
+    *tick = lattice->tick.load(std::memory_order_acquire);
+    return lattice->outputs[*tick & 1];
+}
+/// <summary>
+/// returns false if the plane returned by begin_snapshot was rewritten while it was read, in which case the read must be retried
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="tick"></param>
+/// <returns></returns>
+bool end_snapshot(LatticeHandle lattice, long long tick) {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return lattice->publishing.load(std::memory_order_relaxed) < tick + 2;
+}
 
-    if (abs(cells[idx].charge) > 1) flags |= LATTICE_STATE_ERR_OVERFLOW_CELL;
+bool compile_program(LatticeHandle lattice) {
+    if (!lattice->dirty.exchange(false)) return false;
+    compile_schedule(lattice);
+    compile_batches(lattice);
+    compile_tasks(lattice);
+    compile_consumers(lattice);
+    compile_slots(lattice);
+    compile_noise(lattice);
+    lattice->inputsDirty = true; // inputs may have landed in newly allocated bricks
+    return true;
+}
 
+/// <summary>
+/// runs one tick, recompiling first if the program has changed. Must be called with the program lock held.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="dt"></param>
+/// <param name="active">Set if the tick did any work.</param>
+/// <returns>The LATTICE_STATE flags of the tick.</returns>
+int lattice_tick(LatticeHandle lattice, double dt, bool* active) {
+    auto start = std::chrono::steady_clock::now();
+    *active = false;
+    if (compile_program(lattice)) *active = true;
+    if (load_inputs(lattice)) *active = true;
+    int flags = lattice->domainCount > 1 ? exchange_halo(lattice, active) : 0;
+    if (lattice->noiseProfile & LATTICE_NOISE_MODE_INDUCTIVE) induce_noise(lattice);
+    long long cells, lines;
+    flags |= operate_tasks(lattice, dt, true, active, &cells, &lines);
+    if (lattice->isIntegrating && lattice->integrationMethod != LATTICE_INTEGRATE_EULER) flags |= integrate(lattice, dt, active, &cells, &lines);
+    store_outputs(lattice);
+    if (lattice->watching.load(std::memory_order_relaxed)) check_subscriptions(lattice);
+    auto end = std::chrono::steady_clock::now();
+    record_tick(lattice, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(), flags, cells, lines);
     return flags;
 }
 
-int SIMU_Lattice_Run() {
-    bool flipswitch = true;
-    double dt = timestep;
-    _simu_running = 1;
-    std::cout << "Simulation running!" << std::endl;
-    while (_simu_running) {
-        auto start = std::chrono::system_clock::now();
+/// <summary>
+/// returns true if the lattice has work for the simulation thread
+/// </summary>
+/// <param name="lattice"></param>
+/// <returns></returns>
+bool has_work(LatticeHandle lattice) {
+    // The slabs of a domain tick in step, so one never sleeps while its neighbours wait on it.
+    return !lattice->running || lattice->dirty || lattice->inputsDirty || (lattice->isIntegrating && lattice->liveTasks)
+        || (lattice->noiseProfile && !lattice->tasks.empty()) || lattice->domainCount > 1;
+}
+/// <summary>
+/// sleeps until the lattice has work. Everything has_work checks is changed before wake_lattice is called, and idle is raised before
+/// has_work is checked, so a change is either seen here or wakes the thread.
+/// </summary>
+/// <param name="lattice"></param>
+void wait_for_work(LatticeHandle lattice) {
+    std::unique_lock<std::mutex> lock(lattice->idleLock);
+    lattice->idle = true;
+    lattice->idleWake.wait(lock, [&] { return has_work(lattice); });
+    lattice->idle = false;
+}
 
-        // check all _simu_integrators
-        for (int i = 0; i < _simu_integrators.size(); i++) {
-            recursive_operate(_simu_integrators[i], flipswitch, dt);
+int SIMU_Lattice_Run(LatticeHandle lattice) {
+    double dt = lattice->timestep;
+    prepare_timing_thread();
+    if (lattice->threadCpu >= 0) set_thread_affinity(current_thread(), lattice->threadCpu);
+    if (lattice->threadRealtime) set_thread_realtime(current_thread(), true);
+    pace_state pace = {};
+    pace.oversleep = PACE_START_OVERSLEEP_NANOS;
+    auto last = std::chrono::steady_clock::now();
+    while (lattice->running) {
+        long long period = lattice->tickPeriod.load(std::memory_order_relaxed);
+        if (period != pace.period) {
+            pace.period = period;
+            pace.restart = true;
+        }
+        if (period) {
+            // A paced tick advances the lattice by the time since the last one started, which keeps to the schedule. The first of
+            // a schedule has no last tick to go by, so it advances by a period.
+            bool first = pace.restart;
+            pace_tick(lattice, &pace);
+            auto now = std::chrono::steady_clock::now();
+            long long nanos = first ? period : std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+            lattice->tickTime = (double)nanos / NANOS_SECOND;
+            dt = lattice->tickTime * lattice->timeFactor;
         }
+        auto start = std::chrono::steady_clock::now();
+        last = start;
 
-        // check all _simu_endpoints
-        for (int i = 0; i < _simu_endpoints.size(); i++) {
-            //std::cout << "Operating on endpoint vector " << (_simu_endpoints[i]) << std::endl;
-            recursive_operate(_simu_endpoints[i], flipswitch, dt);
+        while (lattice->programWaiting.load())
+            std::this_thread::yield();
+        bool active;
+        {
+            std::lock_guard<std::mutex> lock(lattice->programLock);
+            lattice_tick(lattice, dt, &active);
         }
+        deliver_events(lattice);
 
-        
-        auto end = std::chrono::system_clock::now();
-        auto millis = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-        dt = (double)millis / NANOS_SECOND;
-        timestep = dt;
+        if (!period) {
+            auto end = std::chrono::steady_clock::now();
+            auto millis = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            lattice->tickTime = (double)millis / NANOS_SECOND;
+            dt = lattice->tickTime * lattice->timeFactor;
+        }
 
-        flipswitch = !flipswitch;
+        if (!active) {
+            wait_for_work(lattice);
+            pace.restart = true;
+        }
     }
 
     return 0;
 }
-int SIMU_Lattice_Init(int X, int Y, int Z, int noise, double ts) {
-    xMax = X;
-    yMax = Y;
-    zMax = Z;
-
-    MAX = X * Y * Z;
-    XYMax = X * Y;
-    noiseProfile = noise;
-    timestep = ts;
-    cells = new cell[MAX];
-
-    for (int x = 0; x < X; x++) {
-        for (int y = 0; y < Y; y++) {
-            for (int z = 0; z < Z; z++) {
-                int idx = get_mem_pos(x, y, z);
-                cells[idx] = cell(x, y, z);
-            }
-        }
+int create_lattice(LatticeHandle* handle, int X, int Y, int Z, int noise, double ts, int storage) {
+    if (X < 1 || Y < 1 || Z < 1) return LATTICE_STATE_ERR_BAD_CONFIG;
+    if (noise & ~LATTICE_NOISE_MODE_MASK) return LATTICE_STATE_ERR_BAD_CONFIG;
+    int xShift = get_shift(X), yShift = get_shift(Y);
+    long long bricksX = (X + BRICK_MASK) >> BRICK_BITS, bricksY = (Y + BRICK_MASK) >> BRICK_BITS, bricksZ = (Z + BRICK_MASK) >> BRICK_BITS;
+    long long cells;
+    switch (storage) {
+    case LATTICE_STORAGE_DENSE: cells = (long long)X * Y * Z; break;
+    case LATTICE_STORAGE_SPARSE: cells = BRICK_CELLS; break;
+    case LATTICE_STORAGE_PADDED:
+        if (xShift + yShift > 31) return LATTICE_STATE_ERR_BAD_CONFIG;
+        cells = (long long)Z << (xShift + yShift);
+        break;
+    case LATTICE_STORAGE_TILED: cells = bricksX * bricksY * bricksZ * BRICK_CELLS; break;
+    default: return LATTICE_STATE_ERR_BAD_CONFIG;
     }
+    if (cells > INT_MAX || bricksX * bricksY * bricksZ > INT_MAX) return LATTICE_STATE_ERR_BAD_CONFIG;
+    // However the cells are stored, the input and output planes hold Y * Z charges and a layer of X * Y cells is indexed as an int.
+    if ((long long)Y * Z > INT_MAX || (long long)X * Y > INT_MAX) return LATTICE_STATE_ERR_BAD_CONFIG;
+
+    LatticeHandle lattice = new struct lattice();
+    lattice->xMax = X;
+    lattice->yMax = Y;
+    lattice->zMax = Z;
+
+    lattice->XYMax = X * Y;
+    lattice->noiseProfile = get_noise_mode(noise);
+    lattice->timestep = ts;
+    lattice->timeFactor = 1;
+    lattice->tickTime = ts;
+
+    lattice->storage = storage;
+    lattice->xShift = xShift;
+    lattice->yShift = yShift;
+    lattice->bricksX = (int)bricksX;
+    lattice->bricksY = (int)bricksY;
+    if (storage == LATTICE_STORAGE_SPARSE)
+        lattice->brickTable.assign((size_t)(bricksX * bricksY * bricksZ), -1);
+    lattice->MAX = 0;
+    resize_storage(lattice, (int)cells);
+    lattice->inputs = new CELL_TYPE[Y * Z]();
+    lattice->outputs[0] = new CELL_TYPE[Y * Z]();
+    lattice->outputs[1] = new CELL_TYPE[Y * Z]();
 
-    underbusCharge = 0;
+    lattice->underbusCharge = 0;
+    lattice->staging = false;
+    lattice->isIntegrating = 0;
+    lattice->integrationMethod = LATTICE_INTEGRATE_EULER;
+    lattice->integrationTolerance = INTEGRATE_DEFAULT_TOLERANCE;
+    lattice->integrationStep = 0;
+    lattice->taskDirty = 0;
+    lattice->dirty = true;
+    lattice->simdLevel = detect_simd_level();
+    lattice->kernels = get_kernels(lattice->simdLevel);
+    lattice->laneKernels = get_lane_kernels(lattice->simdLevel);
+    lattice->random = get_noise_generator(lattice->simdLevel);
+
+    // The distance in memory to each neighbour, or 0 where it varies from cell to cell and get_neighbour falls back on get_mem_pos.
+    int* connectionDelta = lattice->connectionDelta;
+    switch (storage) {
+    case LATTICE_STORAGE_DENSE:
+        connectionDelta[POS_X] = 1;
+        connectionDelta[POS_Y] = X;
+        connectionDelta[POS_Z] = X * Y;
+        break;
+    case LATTICE_STORAGE_PADDED:
+        connectionDelta[POS_X] = 1;
+        connectionDelta[POS_Y] = 1 << xShift;
+        connectionDelta[POS_Z] = 1 << (xShift + yShift);
+        break;
+    default:
+        connectionDelta[POS_X] = connectionDelta[POS_Y] = connectionDelta[POS_Z] = 0;
+        break;
+    }
+    connectionDelta[NEG_X] = -connectionDelta[POS_X];
+    connectionDelta[NEG_Y] = -connectionDelta[POS_Y];
+    connectionDelta[NEG_Z] = -connectionDelta[POS_Z];
 
-    connectionDelta[POS_X] = get_mem_pos(2, 1, 1) - get_mem_pos(1, 1, 1);
-    connectionDelta[POS_Y] = get_mem_pos(1, 2, 1) - get_mem_pos(1, 1, 1);
-    connectionDelta[POS_Z] = get_mem_pos(1, 1, 2) - get_mem_pos(1, 1, 1);
-    connectionDelta[NEG_X] = get_mem_pos(0, 1, 1) - get_mem_pos(1, 1, 1);
-    connectionDelta[NEG_Y] = get_mem_pos(1, 0, 1) - get_mem_pos(1, 1, 1);
-    connectionDelta[NEG_Z] = get_mem_pos(1, 1, 0) - get_mem_pos(1, 1, 1);
-    
-    _simu_running = 1;
-    _simu_thread = std::thread(SIMU_Lattice_Run);
+    lattice->threadCpu = -1;
+    lattice->mode = LATTICE_RUN_STEPPED;
 
+    *handle = lattice;
     return LATTICE_STATE_OKAY;
 }
-int SIMU_Thread_Speed(double ts) {
+int SIMU_Lattice_Init(LatticeHandle* handle, int X, int Y, int Z, int noise, double ts, int storage) {
+    int flag = create_lattice(handle, X, Y, Z, noise, ts, storage);
+    if (flag != LATTICE_STATE_OKAY) return flag;
+    return SIMU_Run_Mode(*handle, LATTICE_RUN_THREADED);
+}
+int SIMU_Lattice_Init(LatticeHandle* handle, int X, int Y, int Z, int noise, double ts) {
+    return SIMU_Lattice_Init(handle, X, Y, Z, noise, ts, LATTICE_STORAGE_DEFAULT);
+}
+int SIMU_Thread_Speed(LatticeHandle lattice, double ts) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
     if (ts < 0) return LATTICE_STATE_ERR_BAD_CONFIG;
-    timestep = ts;
+    lattice->timestep = ts;
     return LATTICE_STATE_OKAY;
 }
-int SIMU_Lattice_Examine(int X, int Y, int Z, CELL_TYPE* cell) {
-    int idx = get_mem_pos(X, Y, Z);
-    if (idx < 0 || idx >= MAX) return LATTICE_STATE_ERR_BAD_CELL_POS;
-    *cell = cells[idx].charge;
+int SIMU_Lattice_Examine(LatticeHandle lattice, int X, int Y, int Z, CELL_TYPE* cell) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (!get_in_bounds(lattice, X, Y, Z)) return LATTICE_STATE_ERR_BAD_CELL_POS;
+    if (X == 0) *cell = lattice->inputs[Z * lattice->yMax + Y]; // the input layer as it will be at the next tick
+    else if (X == lattice->xMax - 1) return Lattice_Read(lattice, Y, Z, cell);
+    else {
+        // Sparse storage may be reallocated by programming calls.
+        program_guard lock(lattice);
+        int idx = get_mem_pos(lattice, X, Y, Z);
+        *cell = idx < 0 ? 0 : lattice->charges[idx];
+    }
     return LATTICE_STATE_OKAY;
 }
-int SIMU_Lattice_NoiseMode(int mode) {
-    return LATTICE_STATE_ERR_UNDEFINED;
+int SIMU_Lattice_NoiseMode(LatticeHandle lattice, int mode) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (mode & ~LATTICE_NOISE_MODE_MASK) return LATTICE_STATE_ERR_BAD_CONFIG;
+    mode = get_noise_mode(mode);
+    program_guard lock(lattice);
+    if (mode == lattice->noiseProfile) return LATTICE_STATE_OKAY;
+    lattice->noiseProfile = mode;
+    lattice->dirty = true; // batches are recompiled with or without KERNEL_NOISE
+    return LATTICE_STATE_OKAY;
 }
-int SIMU_Lattice_Destroy() {
-    _simu_running = 0;
-    _simu_thread.join();
-    free(cells);
+/// <summary>
+/// stops the simulation thread, if it is running, and leaves the lattice in LATTICE_RUN_STEPPED mode
+/// </summary>
+/// <param name="lattice"></param>
+static void stop_thread(LatticeHandle lattice) {
+    if (lattice->mode == LATTICE_RUN_STEPPED) return;
+    lattice->running = 0;
+    wake_lattice(lattice);
+    lattice->thread.join();
+    lattice->mode = LATTICE_RUN_STEPPED;
+}
+int SIMU_Lattice_Destroy(LatticeHandle lattice) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    stop_thread(lattice);
+    // Closed once the thread has stopped, so its last tick still reaches the neighbours.
+    if (lattice->transport.close) lattice->transport.close(lattice->transport.context);
+    lattice->pool.resize(1);
+    delete[] lattice->charges;
+    delete[] lattice->cores;
+    for (int i = 0; i < CONNECTION_COUNT; i++) {
+        delete[] lattice->links[i];
+        delete[] lattice->modifiers[i];
+    }
+    delete[] lattice->taskDirty;
+    delete[] lattice->inputs;
+    delete[] lattice->outputs[0];
+    delete[] lattice->outputs[1];
+    delete lattice;
     return 0;
 }
-int SIMU_Poll_Rate() {
-    return (int)(1 / timestep);
+int SIMU_Poll_Rate(LatticeHandle lattice) {
+    if (!lattice) return 0;
+    return (int)(1 / lattice->tickTime);
 }
+int SIMU_Run_Mode(LatticeHandle lattice, int mode) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (mode != LATTICE_RUN_THREADED && mode != LATTICE_RUN_STEPPED) return LATTICE_STATE_ERR_BAD_CONFIG;
+    if (mode == lattice->mode) return LATTICE_STATE_OKAY;
 
-int Lattice_Program_SetUnderbus(CELL_TYPE charge) {
-    underbusCharge = charge;
+    if (mode == LATTICE_RUN_STEPPED) {
+        // The slabs of a domain would each stop after a different tick, leaving a neighbour waiting on one that never comes.
+        if (lattice->domainCount > 1) return LATTICE_STATE_ERR_BAD_CONFIG;
+        stop_thread(lattice);
+        return LATTICE_STATE_OKAY;
+    }
+    lattice->running = 1;
+    lattice->thread = std::thread(SIMU_Lattice_Run, lattice);
+    lattice->mode = mode;
     return LATTICE_STATE_OKAY;
 }
-int Lattice_Program_SetUnderbus(CELL_TYPE value, CELL_TYPE range) {
+int SIMU_Lattice_Step(LatticeHandle lattice, int n) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (lattice->mode != LATTICE_RUN_STEPPED || n < 0) return LATTICE_STATE_ERR_BAD_CONFIG;
+    if (n == 0) return LATTICE_STATE_OKAY;
+
+    int flags = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(lattice->programLock);
+        bool active;
+        for (int i = 0; i < n; i++)
+            flags |= lattice_tick(lattice, lattice->timestep, &active);
+    }
+    deliver_events(lattice);
+    auto end = std::chrono::steady_clock::now();
+    lattice->tickTime = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / NANOS_SECOND / n;
+    return flags;
+}
+int SIMU_Time_Factor(LatticeHandle lattice, double factor) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (factor < 0) return LATTICE_STATE_ERR_BAD_CONFIG;
+    lattice->timeFactor = factor;
+    return LATTICE_STATE_OKAY;
+}
+int SIMU_Integration_Method(LatticeHandle lattice, int method) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (method < LATTICE_INTEGRATE_EULER || method > LATTICE_INTEGRATE_ADAPTIVE) return LATTICE_STATE_ERR_BAD_CONFIG;
+    program_guard lock(lattice);
+    lattice->integrationMethod = method;
+    lattice->integrationStep = 0;
+    return LATTICE_STATE_OKAY;
+}
+int SIMU_Integration_Tolerance(LatticeHandle lattice, double tolerance) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (!(tolerance > 0)) return LATTICE_STATE_ERR_BAD_CONFIG;
+    program_guard lock(lattice);
+    lattice->integrationTolerance = tolerance;
+    return LATTICE_STATE_OKAY;
+}
+int SIMU_Tick_Rate(LatticeHandle lattice, double hz) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (!(hz >= 0) || hz > NANOS_SECOND) return LATTICE_STATE_ERR_BAD_CONFIG;
+    lattice->tickPeriod = hz ? (long long)(NANOS_SECOND / hz + 0.5) : 0;
+    return LATTICE_STATE_OKAY;
+}
+int SIMU_Thread_Affinity(LatticeHandle lattice, int cpu) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (cpu < -1) return LATTICE_STATE_ERR_BAD_CONFIG;
+    if (lattice->mode == LATTICE_RUN_THREADED && !set_thread_affinity(lattice->thread.native_handle(), cpu))
+        return LATTICE_STATE_ERR_BAD_CONFIG;
+    lattice->threadCpu = cpu;
+    return LATTICE_STATE_OKAY;
+}
+int SIMU_Thread_Realtime(LatticeHandle lattice, int realtime) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (lattice->mode == LATTICE_RUN_THREADED && !set_thread_realtime(lattice->thread.native_handle(), realtime != 0))
+        return LATTICE_STATE_ERR_BAD_CONFIG;
+    lattice->threadRealtime = realtime != 0;
+    return LATTICE_STATE_OKAY;
+}
+int SIMU_Thread_Count(LatticeHandle lattice, int threads) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (threads < 1) return LATTICE_STATE_ERR_BAD_CONFIG;
+    program_guard lock(lattice);
+    lattice->pool.resize(threads);
+    return LATTICE_STATE_OKAY;
+}
+int SIMU_Thread_Scaling(LatticeHandle lattice, double* parallel, double* speedup) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    long long total = lattice->cellsTotal.exchange(0);
+    long long cells = lattice->cellsParallel.exchange(0);
+    long long nanos = lattice->parallelNanos.exchange(0);
+    long long busy = lattice->pool.take_busy();
+    *parallel = total ? (double)cells / (double)total : 0;
+    *speedup = nanos ? (double)busy / (double)nanos : 1;
+    return LATTICE_STATE_OKAY;
+}
+int SIMU_Lattice_SIMD(LatticeHandle lattice, int level) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    kernel_select kernels = get_kernels(level);
+    if (!kernels) return LATTICE_STATE_ERR_BAD_CONFIG;
+    program_guard lock(lattice);
+    lattice->kernels = kernels;
+    lattice->laneKernels = get_lane_kernels(level);
+    lattice->random = get_noise_generator(level);
+    lattice->simdLevel = level;
+    for (int b = 0; b < lattice->batches.size(); b++)
+        lattice->batches[b].kernel = kernels(lattice->batches[b].core, lattice->batches[b].features);
+    return LATTICE_STATE_OKAY;
+}
+int SIMU_SIMD_Level(LatticeHandle lattice) {
+    if (!lattice) return LATTICE_SIMD_NONE;
+    return lattice->simdLevel;
+}
+int SIMU_Cell_Size() {
+    return sizeof(CELL_TYPE) + sizeof(char) + CONNECTION_COUNT * (sizeof(char) + sizeof(CELL_TYPE));
+}
+
+int Lattice_Program_SetUnderbus(LatticeHandle lattice, CELL_TYPE charge) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    lattice->underbusCharge = charge;
+    return LATTICE_STATE_OKAY;
+}
+int Lattice_Program_SetUnderbus(LatticeHandle lattice, CELL_TYPE value, CELL_TYPE range) {
     if (range < value) return LATTICE_STATE_ERR_OVERFLOW_CELL;
     if (range == 0) return LATTICE_STATE_ERR_DIV_ZERO;
-    underbusCharge = value / range;
-    return LATTICE_STATE_OKAY;
+    return Lattice_Program_SetUnderbus(lattice, cell_ratio(value, range));
 }
-int Lattice_Program_SetUnderbus(int value, int range) {
+int Lattice_Program_SetUnderbus(LatticeHandle lattice, int value, int range) {
     if (range < value) return LATTICE_STATE_ERR_OVERFLOW_CELL;
     if (range == 0) return LATTICE_STATE_ERR_DIV_ZERO;
-    underbusCharge = (double)value / (double)range;
-    return LATTICE_STATE_OKAY;
+    return Lattice_Program_SetUnderbus(lattice, cell_ratio(value, range));
 }
 
-int Lattice_Program_Core(int X, int Y, int Z, int code) {
-    int idx = get_mem_pos(X, Y, Z);
-    if (X == 0) return -1; // input layer cant be programmed.
-    if (idx < 0 || idx >= MAX) return LATTICE_STATE_ERR_BAD_CELL_POS;
+/// <summary>
+/// programs the core of a cell with the given underbus charge. Must be called with the program lock held.
+/// </summary>
+int program_core(LatticeHandle lattice, int X, int Y, int Z, int code, CELL_TYPE underbus) {
+    if (!get_owned(lattice, X, Y, Z)) return LATTICE_STATE_OKAY; // programmed by the slab that owns it
+    int idx = allocate_cell(lattice, X, Y, Z);
+    if (idx < 0) return LATTICE_STATE_ERR_BAD_CONFIG;
+    lattice->dirty = true;
+    lattice->programVersion = 0;
+    char* cores = lattice->cores;
 
-    if (X == xMax - 1 && cells[idx].config == 0) {
-        register_into_vector(idx, &_simu_endpoints);
+    // The faces of a slab are read by its neighbours, so they are evaluated as the output layer is.
+    if ((X == lattice->xMax - 1 || get_on_face(lattice, X, Y, Z)) && cores[idx] == 0) {
+        register_into_vector(idx, &lattice->endpoints);
     }
 
     switch (code & LATTICE_PROG_CORE_MASK) {
         case LATTICE_PROG_CORE_INT:
-            if ((cells[idx].config & LATTICE_PROG_CORE_MASK) != LATTICE_PROG_CORE_INT)
-                register_into_vector(idx, &_simu_integrators);
-            cells[idx].config = code;
+            if ((cores[idx] & LATTICE_PROG_CORE_MASK) != LATTICE_PROG_CORE_INT)
+                register_into_vector(idx, &lattice->integrators, &lattice->integratorIndex);
+            cores[idx] = code;
             break;
         case LATTICE_PROG_CORE_HOLDVAL:
-            cells[idx].charge = underbusCharge;
+            lattice->charges[idx] = underbus;
         case LATTICE_PROG_CORE_SUM:
         case LATTICE_PROG_CORE_MULT:
-            if ((cells[idx].config & LATTICE_PROG_CORE_MASK) == LATTICE_PROG_CORE_INT)
-                deregister_into_vector(idx, &_simu_integrators);
-            cells[idx].config = code;
+            if ((cores[idx] & LATTICE_PROG_CORE_MASK) == LATTICE_PROG_CORE_INT)
+                deregister_into_vector(idx, &lattice->integrators, &lattice->integratorIndex);
+            cores[idx] = code;
             break;
     }
     return LATTICE_STATE_OKAY;
 }
-int Lattice_Program_Connect(int X, int Y, int Z, int code) {
-    connect* connection = 0;
+/// <summary>
+/// programs a connection of a cell with the given underbus charge. Must be called with the program lock held.
+/// </summary>
+int program_connect(LatticeHandle lattice, int X, int Y, int Z, int code, CELL_TYPE underbus) {
+    port connection;
     int connectionID = code & LATTICE_PROG_CONNECT_MASK;
-    if (get_connection(X, Y, Z, connectionID, &connection))
+    // A line into another slab is evaluated there; here it is removed, in case it flowed this way before.
+    if (!(code & LATTICE_PROG_CONNECT_CONFIG_DEACTIVATE) && !get_line_owned(lattice, X, Y, Z, code))
+        code = connectionID | LATTICE_PROG_CONNECT_CONFIG_DEACTIVATE;
+
+    // Both ends of an active line are stored, so a line with an unallocated end is already inactive.
+    int nX = X, nY = Y, nZ = Z;
+    step_coords(connectionID, &nX, &nY, &nZ);
+    if (code & LATTICE_PROG_CONNECT_CONFIG_DEACTIVATE) {
+        if (get_in_bounds(lattice, X, Y, Z) && get_in_bounds(lattice, nX, nY, nZ)
+            && (get_mem_pos(lattice, X, Y, Z) < 0 || get_mem_pos(lattice, nX, nY, nZ) < 0))
+            return LATTICE_STATE_OKAY;
+    }
+    else {
+        allocate_cell(lattice, X, Y, Z);
+        allocate_cell(lattice, nX, nY, nZ);
+    }
+    if (get_connection(lattice, X, Y, Z, connectionID, &connection))
         return -1;
+    lattice->dirty = true;
+    lattice->programVersion = 0;
+    char* config = &lattice->links[connection.axis][connection.cell];
     if (code & LATTICE_PROG_CONNECT_CONFIG_DEACTIVATE) {
-        connection->config = 0;
+        *config = 0;
         return LATTICE_STATE_OKAY;
     }
-    connection->config = (code & ~LATTICE_PROG_CONNECT_MASK) & 0xff;
-    connection->config |= LATTICE_PROG_CONNECT_CONFIG_ACTIVE;
+    *config = (code & ~LATTICE_PROG_CONNECT_MASK) & 0xff;
+    *config |= LATTICE_PROG_CONNECT_CONFIG_ACTIVE;
 
     if ((code & LATTICE_PROG_CONNECT_CONFIG_MOD_MASK) != 0) {
-        connection->modifier = underbusCharge;
+        lattice->modifiers[connection.axis][connection.cell] = underbus;
     }
 
     return LATTICE_STATE_OKAY;
 }
+/// <summary>
+/// stages a programming call, along with the underbus charge it is made with, if a transaction is open
+/// </summary>
+/// <returns>false if no transaction is open, in which case the call must be applied at once.</returns>
+bool stage_edit(LatticeHandle lattice, int kind, int X, int Y, int Z, int code) {
+    std::lock_guard<std::mutex> lock(lattice->stageLock);
+    if (!lattice->staging) return false;
+    staged_edit edit;
+    edit.kind = kind;
+    edit.x = X;
+    edit.y = Y;
+    edit.z = Z;
+    edit.code = code;
+    edit.underbus = lattice->underbusCharge;
+    lattice->staged.push_back(edit);
+    return true;
+}
 
-int Lattice_Write(int Y, int Z, CELL_TYPE charge) {
-    int idx = get_mem_pos(0, Y, Z);
-    if (idx < 0 || idx >= MAX) return LATTICE_STATE_ERR_BAD_CELL_POS;
-    cells[idx].charge = charge;
+int Lattice_Program_Core(LatticeHandle lattice, int X, int Y, int Z, int code) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (X == 0) return -1; // input layer cant be programmed.
+    if (!get_in_bounds(lattice, X, Y, Z)) return LATTICE_STATE_ERR_BAD_CELL_POS;
+    if (stage_edit(lattice, STAGED_CORE, X, Y, Z, code)) return LATTICE_STATE_OKAY;
+
+    program_guard lock(lattice);
+    return program_core(lattice, X, Y, Z, code, lattice->underbusCharge);
+}
+int Lattice_Program_Connect(LatticeHandle lattice, int X, int Y, int Z, int code) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (stage_edit(lattice, STAGED_CONNECT, X, Y, Z, code)) return LATTICE_STATE_OKAY;
+
+    program_guard lock(lattice);
+    return program_connect(lattice, X, Y, Z, code, lattice->underbusCharge);
+}
+int Lattice_Program_Begin(LatticeHandle lattice) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    std::lock_guard<std::mutex> lock(lattice->stageLock);
+    if (lattice->staging) return LATTICE_STATE_ERR_BAD_CONFIG;
+    lattice->staging = true;
     return LATTICE_STATE_OKAY;
 }
-int Lattice_Write(int Y, int Z, CELL_TYPE value, CELL_TYPE range) {
+int Lattice_Program_Commit(LatticeHandle lattice) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    // Held throughout, so programming calls made while the transaction is applied land after it.
+    std::lock_guard<std::mutex> stage(lattice->stageLock);
+    if (!lattice->staging) return LATTICE_STATE_ERR_BAD_CONFIG;
+
+    int flags = 0;
+    {
+        program_guard lock(lattice);
+        for (int i = 0; i < lattice->staged.size(); i++) {
+            const staged_edit* edit = &lattice->staged[i];
+            int flag = edit->kind == STAGED_CORE
+                ? program_core(lattice, edit->x, edit->y, edit->z, edit->code, edit->underbus)
+                : program_connect(lattice, edit->x, edit->y, edit->z, edit->code, edit->underbus);
+            flags |= flag < 0 ? LATTICE_STATE_ERR_BAD_CONFIG : flag;
+        }
+        // Compiled before the lock is released, so the next tick runs the whole transaction or none of it.
+        compile_program(lattice);
+    }
+    std::vector<staged_edit>().swap(lattice->staged);
+    lattice->staging = false;
+    return flags;
+}
+
+int Lattice_Write(LatticeHandle lattice, int Y, int Z, CELL_TYPE charge) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (Y < 0 || Y >= lattice->yMax || Z < 0 || Z >= lattice->zMax) return LATTICE_STATE_ERR_BAD_CELL_POS;
+    lattice->inputs[Z * lattice->yMax + Y] = charge;
+    lattice->inputsDirty = true;
+    wake_lattice(lattice);
+    return LATTICE_STATE_OKAY;
+}
+int Lattice_Write(LatticeHandle lattice, int Y, int Z, CELL_TYPE value, CELL_TYPE range) {
     if (range < value) return LATTICE_STATE_ERR_OVERFLOW_CELL;
     if (range == 0) return LATTICE_STATE_ERR_DIV_ZERO;
-    value = value / range;
-    return Lattice_Write(Y, Z, value);
+    return Lattice_Write(lattice, Y, Z, cell_ratio(value, range));
 }
-int Lattice_Write(int Y, int Z, int value, int range) {
+int Lattice_Write(LatticeHandle lattice, int Y, int Z, int value, int range) {
     if (range < value) return LATTICE_STATE_ERR_OVERFLOW_CELL;
     if (range == 0) return LATTICE_STATE_ERR_DIV_ZERO;
-    CELL_TYPE val = (CELL_TYPE)value / (CELL_TYPE)range;
-    return Lattice_Write(Y, Z, val);
+    return Lattice_Write(lattice, Y, Z, cell_ratio(value, range));
 }
 
-int Lattice_Read(int Y, int Z, CELL_TYPE* output) {
-    int idx = get_mem_pos(xMax - 1, Y, Z);
-    if (idx < 0 || idx >= MAX) return LATTICE_STATE_ERR_BAD_CELL_POS;
-    *output = cells[idx].charge;
+int Lattice_Read(LatticeHandle lattice, int Y, int Z, CELL_TYPE* output) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (Y < 0 || Y >= lattice->yMax || Z < 0 || Z >= lattice->zMax) return LATTICE_STATE_ERR_BAD_CELL_POS;
+    long long tick;
+    do {
+        *output = begin_snapshot(lattice, &tick)[Z * lattice->yMax + Y];
+    } while (!end_snapshot(lattice, tick));
     return LATTICE_STATE_OKAY;
 }
-int Lattice_Read(int Y, int Z, CELL_TYPE range, CELL_TYPE* output) {
-    int flag = Lattice_Read(Y, Z, output);
+int Lattice_Read(LatticeHandle lattice, int Y, int Z, CELL_TYPE range, CELL_TYPE* output) {
+    int flag = Lattice_Read(lattice, Y, Z, output);
     if (flag != LATTICE_STATE_OKAY) return flag;
-    *output *= range;
+    *output = cell_scale(*output, range);
     return LATTICE_STATE_OKAY;
 }
-int Lattice_Read(int Y, int Z, int range, int* output) {
+int Lattice_Read(LatticeHandle lattice, int Y, int Z, int range, int* output) {
     CELL_TYPE out = 0;
-    int flag = Lattice_Read(Y, Z, &out);
+    int flag = Lattice_Read(lattice, Y, Z, &out);
     if (flag != LATTICE_STATE_OKAY) return flag;
 
-    *output = (int)(out * range);
+    *output = cell_scale(out, range);
     return LATTICE_STATE_OKAY;
 }
 
-int Lattice_Start_Integration() {
-    isIntegrating = 1;
+/// <summary>
+/// checks a region of the input or output plane and the stride of the caller's buffer
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="Y"></param>
+/// <param name="Z"></param>
+/// <param name="height"></param>
+/// <param name="depth"></param>
+/// <param name="stride"></param>
+/// <returns></returns>
+int get_region_state(LatticeHandle lattice, int Y, int Z, int height, int depth, int stride) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (height < 0 || depth < 0 || stride < height) return LATTICE_STATE_ERR_BAD_CONFIG;
+    if (Y < 0 || Z < 0 || Y + height > lattice->yMax || Z + depth > lattice->zMax) return LATTICE_STATE_ERR_BAD_CELL_POS;
     return LATTICE_STATE_OKAY;
 }
-int Lattice_Stop_Integration() {
-    isIntegrating = 0;
+
+int Lattice_Write_Region(LatticeHandle lattice, int Y, int Z, int height, int depth, const CELL_TYPE* charges, int stride) {
+    int flag = get_region_state(lattice, Y, Z, height, depth, stride);
+    if (flag != LATTICE_STATE_OKAY) return flag;
+    for (int j = 0; j < depth; j++)
+        memcpy(&lattice->inputs[(Z + j) * lattice->yMax + Y], &charges[j * stride], height * sizeof(CELL_TYPE));
+    lattice->inputsDirty = true;
+    wake_lattice(lattice);
+    return LATTICE_STATE_OKAY;
+}
+int Lattice_Write_Region(LatticeHandle lattice, int Y, int Z, int height, int depth, const int* values, int range, int stride) {
+    int flag = get_region_state(lattice, Y, Z, height, depth, stride);
+    if (flag != LATTICE_STATE_OKAY) return flag;
+    if (range == 0) return LATTICE_STATE_ERR_DIV_ZERO;
+
+    // Checked in full before anything is written, as a single Lattice_Write would be.
+    int over = 0;
+    for (int j = 0; j < depth; j++) {
+        const int* row = &values[j * stride];
+        for (int i = 0; i < height; i++)
+            over |= row[i] > range;
+    }
+    if (over) return LATTICE_STATE_ERR_OVERFLOW_CELL;
+
+    for (int j = 0; j < depth; j++) {
+        const int* row = &values[j * stride];
+        CELL_TYPE* plane = &lattice->inputs[(Z + j) * lattice->yMax + Y];
+        for (int i = 0; i < height; i++)
+            plane[i] = cell_ratio(row[i], range);
+    }
+    lattice->inputsDirty = true;
+    wake_lattice(lattice);
+    return LATTICE_STATE_OKAY;
+}
+/// <summary>
+/// copies a region of the output plane of one complete tick, returning the number of that tick
+/// </summary>
+int snapshot_region(LatticeHandle lattice, int Y, int Z, int height, int depth, CELL_TYPE* output, int stride, long long* tick) {
+    int flag = get_region_state(lattice, Y, Z, height, depth, stride);
+    if (flag != LATTICE_STATE_OKAY) return flag;
+    long long frame;
+    do {
+        const CELL_TYPE* plane = begin_snapshot(lattice, &frame);
+        for (int j = 0; j < depth; j++)
+            memcpy(&output[j * stride], &plane[(Z + j) * lattice->yMax + Y], height * sizeof(CELL_TYPE));
+        *tick = lattice->outputTicks[frame & 1];
+    } while (!end_snapshot(lattice, frame));
+    return LATTICE_STATE_OKAY;
+}
+/// <summary>
+/// copies a region of the output plane of one complete tick scaled to the given range, returning the number of that tick
+/// </summary>
+int snapshot_region(LatticeHandle lattice, int Y, int Z, int height, int depth, int range, int* output, int stride, long long* tick) {
+    int flag = get_region_state(lattice, Y, Z, height, depth, stride);
+    if (flag != LATTICE_STATE_OKAY) return flag;
+    long long frame;
+    do {
+        const CELL_TYPE* plane = begin_snapshot(lattice, &frame);
+        for (int j = 0; j < depth; j++) {
+            const CELL_TYPE* column = &plane[(Z + j) * lattice->yMax + Y];
+            int* row = &output[j * stride];
+            for (int i = 0; i < height; i++)
+                row[i] = cell_scale(column[i], range);
+        }
+        *tick = lattice->outputTicks[frame & 1];
+    } while (!end_snapshot(lattice, frame));
+    return LATTICE_STATE_OKAY;
+}
+
+int Lattice_Read_Region(LatticeHandle lattice, int Y, int Z, int height, int depth, CELL_TYPE* output, int stride) {
+    long long tick;
+    return snapshot_region(lattice, Y, Z, height, depth, output, stride, &tick);
+}
+int Lattice_Read_Region(LatticeHandle lattice, int Y, int Z, int height, int depth, int range, int* output, int stride) {
+    long long tick;
+    return snapshot_region(lattice, Y, Z, height, depth, range, output, stride, &tick);
+}
+
+int Lattice_Write_Plane(LatticeHandle lattice, const CELL_TYPE* charges) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    return Lattice_Write_Region(lattice, 0, 0, lattice->yMax, lattice->zMax, charges, lattice->yMax);
+}
+int Lattice_Write_Plane(LatticeHandle lattice, const int* values, int range) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    return Lattice_Write_Region(lattice, 0, 0, lattice->yMax, lattice->zMax, values, range, lattice->yMax);
+}
+int Lattice_Read_Plane(LatticeHandle lattice, CELL_TYPE* output) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    return Lattice_Read_Region(lattice, 0, 0, lattice->yMax, lattice->zMax, output, lattice->yMax);
+}
+int Lattice_Read_Plane(LatticeHandle lattice, int range, int* output) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    return Lattice_Read_Region(lattice, 0, 0, lattice->yMax, lattice->zMax, range, output, lattice->yMax);
+}
+
+int Lattice_Read_Snapshot(LatticeHandle lattice, CELL_TYPE* output, long long* tick) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    return snapshot_region(lattice, 0, 0, lattice->yMax, lattice->zMax, output, lattice->yMax, tick);
+}
+int Lattice_Read_Snapshot(LatticeHandle lattice, int range, int* output, long long* tick) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    return snapshot_region(lattice, 0, 0, lattice->yMax, lattice->zMax, range, output, lattice->yMax, tick);
+}
+int Lattice_Read_Tick(LatticeHandle lattice, long long* tick) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    long long frame;
+    do {
+        begin_snapshot(lattice, &frame);
+        *tick = lattice->outputTicks[frame & 1];
+    } while (!end_snapshot(lattice, frame));
+    return LATTICE_STATE_OKAY;
+}
+int Lattice_Wait(LatticeHandle lattice, int ticks) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (lattice->mode != LATTICE_RUN_THREADED || ticks < 0) return LATTICE_STATE_ERR_BAD_CONFIG;
+    long long start = lattice->tick.load();
+    while (lattice->tick.load() < start + ticks) {
+        // Asleep with nothing pending: the outputs already reflect every write made before the call.
+        if (lattice->idle && !lattice->inputsDirty && !lattice->dirty) break;
+        std::this_thread::yield();
+    }
+    return LATTICE_STATE_OKAY;
+}
+
+/// <summary>
+/// evaluates the program once for each of count input planes, QUERY_LANES queries at a time, writing an output plane for each.
+/// Every query starts from the charges of the lattice as they are. Must be called with the program lock held, on a compiled
+/// program that has no live integrators or noise.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="inputs">count input planes, one after the other.</param>
+/// <param name="count"></param>
+/// <param name="outputs">count output planes, one after the other.</param>
+/// <returns>The accumulated LATTICE_STATE flags of every query.</returns>
+int evaluate_queries(LatticeHandle lattice, const CELL_TYPE* inputs, int count, CELL_TYPE* outputs) {
+    int plane = lattice->yMax * lattice->zMax;
+    int slots = (int)lattice->batchCells.size();
+    const CELL_TYPE* charges = lattice->charges;
+    std::vector<CELL_TYPE> lanes((size_t)slots * QUERY_LANES);
+    int flags = 0;
+
+    for (int first = 0; first < count; first += QUERY_LANES) {
+        int n = std::min(QUERY_LANES, count - first);
+        for (int s = 0; s < slots; s++)
+            std::fill_n(&lanes[(size_t)s * QUERY_LANES], QUERY_LANES, charges[lattice->batchCells[s]]);
+        // Lanes past the last query repeat it, so they raise no flags of their own.
+        for (int p = 0; p < plane; p++) {
+            if (lattice->inputSlots[p] < 0) continue;
+            CELL_TYPE* row = &lanes[(size_t)lattice->inputSlots[p] * QUERY_LANES];
+            for (int b = 0; b < QUERY_LANES; b++)
+                row[b] = inputs[(size_t)(first + std::min(b, n - 1)) * plane + p];
+        }
+
+        for (int i = 0; i < lattice->batches.size(); i++) {
+            const batch* work = &lattice->batches[i];
+            lane_kernel kernel = lattice->laneKernels[work->core & LATTICE_PROG_CORE_MASK];
+            if (!kernel) continue;
+            const int* sources = lattice->sourceSlots.data() + (work->sources - lattice->batchSources.data());
+            flags |= kernel(lanes.data(), work, sources, (int)(work->cells - lattice->batchCells.data()));
+        }
+
+        for (int b = 0; b < n; b++) {
+            CELL_TYPE* output = &outputs[(size_t)(first + b) * plane];
+            for (int p = 0; p < plane; p++) {
+                int slot = lattice->outputSlots[p], idx = lattice->outputCells[p];
+                output[p] = slot >= 0 ? lanes[(size_t)slot * QUERY_LANES + b] : idx < 0 ? 0 : charges[idx];
+            }
+        }
+    }
+    return flags;
+}
+
+int Lattice_Evaluate_Batch(LatticeHandle lattice, const CELL_TYPE* inputs, int count, CELL_TYPE* outputs) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (count < 0 || (count && (!inputs || !outputs))) return LATTICE_STATE_ERR_BAD_CONFIG;
+    program_guard lock(lattice);
+    compile_program(lattice);
+    // Integration and noise make a query depend on time, which a batch of queries does not advance.
+    if ((lattice->isIntegrating && lattice->liveTasks) || lattice->noiseProfile) return LATTICE_STATE_ERR_BAD_CONFIG;
+    return evaluate_queries(lattice, inputs, count, outputs);
+}
+int Lattice_Evaluate_Batch(LatticeHandle lattice, const int* values, int range, int count, int* outputs) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (count < 0 || (count && (!values || !outputs))) return LATTICE_STATE_ERR_BAD_CONFIG;
+    if (range == 0) return LATTICE_STATE_ERR_DIV_ZERO;
+
+    size_t size = (size_t)count * lattice->yMax * lattice->zMax;
+    std::vector<CELL_TYPE> inputs(size), results(size);
+    for (size_t i = 0; i < size; i++) {
+        if (values[i] > range) return LATTICE_STATE_ERR_OVERFLOW_CELL;
+        inputs[i] = cell_ratio(values[i], range);
+    }
+    int flags = Lattice_Evaluate_Batch(lattice, inputs.data(), count, results.data());
+    if (flags & (LATTICE_STATE_ERR_NOT_INIT | LATTICE_STATE_ERR_BAD_CONFIG)) return flags;
+    for (size_t i = 0; i < size; i++)
+        outputs[i] = cell_scale(results[i], range);
+    return flags;
+}
+
+int Lattice_Start_Integration(LatticeHandle lattice) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    lattice->isIntegrating = 1;
+    wake_lattice(lattice);
+    return LATTICE_STATE_OKAY;
+}
+int Lattice_Stop_Integration(LatticeHandle lattice) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    lattice->isIntegrating = 0;
     return LATTICE_STATE_OKAY;
-}
\ No newline at end of file
+}
+
+// The default lattice: the original interface, acting on _simu_default.
+
+int SIMU_Lattice_Init(int X, int Y, int Z, int noise, double ts) {
+    return SIMU_Lattice_Init(X, Y, Z, noise, ts, LATTICE_STORAGE_DEFAULT);
+}
+int SIMU_Lattice_Init(int X, int Y, int Z, int noise, double ts, int storage) {
+    if (_simu_default) return LATTICE_STATE_ERR_BAD_CONFIG;
+    return SIMU_Lattice_Init(&_simu_default, X, Y, Z, noise, ts, storage);
+}
+int SIMU_Lattice_Init_Domain(int X, int Y, int Z, int noise, double ts, int axis, int rank, int count, const lattice_transport* transport) {
+    if (_simu_default) {
+        if (transport && transport->close) transport->close(transport->context);
+        return LATTICE_STATE_ERR_BAD_CONFIG;
+    }
+    return SIMU_Lattice_Init_Domain(&_simu_default, X, Y, Z, noise, ts, axis, rank, count, transport);
+}
+int SIMU_Lattice_Load(const char* path, int noise, double ts) {
+    if (_simu_default) return LATTICE_STATE_ERR_BAD_CONFIG;
+    return SIMU_Lattice_Load(&_simu_default, path, noise, ts);
+}
+int SIMU_Lattice_Save(const char* path) {
+    return SIMU_Lattice_Save(_simu_default, path);
+}
+int SIMU_Lattice_Checkpoint(CheckpointHandle* checkpoint) {
+    return SIMU_Lattice_Checkpoint(_simu_default, checkpoint);
+}
+int SIMU_Lattice_Restore(CheckpointHandle checkpoint) {
+    return SIMU_Lattice_Restore(_simu_default, checkpoint);
+}
+int SIMU_Lattice_Fork(CheckpointHandle checkpoint) {
+    if (_simu_default) return LATTICE_STATE_ERR_BAD_CONFIG;
+    return SIMU_Lattice_Fork(&_simu_default, checkpoint);
+}
+int SIMU_Thread_Speed(double ts) {
+    return SIMU_Thread_Speed(_simu_default, ts);
+}
+int SIMU_Lattice_Examine(int X, int Y, int Z, CELL_TYPE* cell) {
+    return SIMU_Lattice_Examine(_simu_default, X, Y, Z, cell);
+}
+int SIMU_Lattice_NoiseMode(int mode) {
+    return SIMU_Lattice_NoiseMode(_simu_default, mode);
+}
+int SIMU_Lattice_Destroy() {
+    int flag = SIMU_Lattice_Destroy(_simu_default);
+    _simu_default = 0;
+    return flag;
+}
+int SIMU_Poll_Rate() {
+    return SIMU_Poll_Rate(_simu_default);
+}
+int SIMU_Run_Mode(int mode) {
+    return SIMU_Run_Mode(_simu_default, mode);
+}
+int SIMU_Lattice_Step(int n) {
+    return SIMU_Lattice_Step(_simu_default, n);
+}
+int SIMU_Time_Factor(double factor) {
+    return SIMU_Time_Factor(_simu_default, factor);
+}
+int SIMU_Integration_Method(int method) {
+    return SIMU_Integration_Method(_simu_default, method);
+}
+int SIMU_Integration_Tolerance(double tolerance) {
+    return SIMU_Integration_Tolerance(_simu_default, tolerance);
+}
+int SIMU_Tick_Rate(double hz) {
+    return SIMU_Tick_Rate(_simu_default, hz);
+}
+int SIMU_Thread_Affinity(int cpu) {
+    return SIMU_Thread_Affinity(_simu_default, cpu);
+}
+int SIMU_Thread_Realtime(int realtime) {
+    return SIMU_Thread_Realtime(_simu_default, realtime);
+}
+int SIMU_Thread_Count(int threads) {
+    return SIMU_Thread_Count(_simu_default, threads);
+}
+int SIMU_Thread_Scaling(double* parallel, double* speedup) {
+    return SIMU_Thread_Scaling(_simu_default, parallel, speedup);
+}
+int SIMU_Lattice_SIMD(int level) {
+    return SIMU_Lattice_SIMD(_simu_default, level);
+}
+int SIMU_SIMD_Level() {
+    return SIMU_SIMD_Level(_simu_default);
+}
+int SIMU_Get_Stats(lattice_stats* stats) {
+    return SIMU_Get_Stats(_simu_default, stats);
+}
+int SIMU_Reset_Stats() {
+    return SIMU_Reset_Stats(_simu_default);
+}
+int SIMU_Stats_Region(int region, int X, int Y, int Z, int width, int height, int depth) {
+    return SIMU_Stats_Region(_simu_default, region, X, Y, Z, width, height, depth);
+}
+
+int Lattice_Program_SetUnderbus(CELL_TYPE charge) {
+    return Lattice_Program_SetUnderbus(_simu_default, charge);
+}
+int Lattice_Program_SetUnderbus(CELL_TYPE value, CELL_TYPE range) {
+    return Lattice_Program_SetUnderbus(_simu_default, value, range);
+}
+int Lattice_Program_SetUnderbus(int value, int range) {
+    return Lattice_Program_SetUnderbus(_simu_default, value, range);
+}
+int Lattice_Program_Core(int X, int Y, int Z, int code) {
+    return Lattice_Program_Core(_simu_default, X, Y, Z, code);
+}
+int Lattice_Program_Connect(int X, int Y, int Z, int code) {
+    return Lattice_Program_Connect(_simu_default, X, Y, Z, code);
+}
+int Lattice_Program_Begin() {
+    return Lattice_Program_Begin(_simu_default);
+}
+int Lattice_Program_Commit() {
+    return Lattice_Program_Commit(_simu_default);
+}
+int Lattice_Write(int Y, int Z, CELL_TYPE charge) {
+    return Lattice_Write(_simu_default, Y, Z, charge);
+}
+int Lattice_Write(int Y, int Z, CELL_TYPE value, CELL_TYPE range) {
+    return Lattice_Write(_simu_default, Y, Z, value, range);
+}
+int Lattice_Write(int Y, int Z, int value, int range) {
+    return Lattice_Write(_simu_default, Y, Z, value, range);
+}
+int Lattice_Read(int Y, int Z, CELL_TYPE* output) {
+    return Lattice_Read(_simu_default, Y, Z, output);
+}
+int Lattice_Read(int Y, int Z, CELL_TYPE range, CELL_TYPE* output) {
+    return Lattice_Read(_simu_default, Y, Z, range, output);
+}
+int Lattice_Read(int Y, int Z, int range, int* output) {
+    return Lattice_Read(_simu_default, Y, Z, range, output);
+}
+int Lattice_Write_Plane(const CELL_TYPE* charges) {
+    return Lattice_Write_Plane(_simu_default, charges);
+}
+int Lattice_Write_Plane(const int* values, int range) {
+    return Lattice_Write_Plane(_simu_default, values, range);
+}
+int Lattice_Read_Plane(CELL_TYPE* output) {
+    return Lattice_Read_Plane(_simu_default, output);
+}
+int Lattice_Read_Plane(int range, int* output) {
+    return Lattice_Read_Plane(_simu_default, range, output);
+}
+int Lattice_Write_Region(int Y, int Z, int height, int depth, const CELL_TYPE* charges, int stride) {
+    return Lattice_Write_Region(_simu_default, Y, Z, height, depth, charges, stride);
+}
+int Lattice_Write_Region(int Y, int Z, int height, int depth, const int* values, int range, int stride) {
+    return Lattice_Write_Region(_simu_default, Y, Z, height, depth, values, range, stride);
+}
+int Lattice_Read_Region(int Y, int Z, int height, int depth, CELL_TYPE* output, int stride) {
+    return Lattice_Read_Region(_simu_default, Y, Z, height, depth, output, stride);
+}
+int Lattice_Read_Region(int Y, int Z, int height, int depth, int range, int* output, int stride) {
+    return Lattice_Read_Region(_simu_default, Y, Z, height, depth, range, output, stride);
+}
+int Lattice_Read_Snapshot(CELL_TYPE* output, long long* tick) {
+    return Lattice_Read_Snapshot(_simu_default, output, tick);
+}
+int Lattice_Read_Snapshot(int range, int* output, long long* tick) {
+    return Lattice_Read_Snapshot(_simu_default, range, output, tick);
+}
+int Lattice_Read_Tick(long long* tick) {
+    return Lattice_Read_Tick(_simu_default, tick);
+}
+int Lattice_Wait(int ticks) {
+    return Lattice_Wait(_simu_default, ticks);
+}
+int Lattice_Subscribe(int Y, int Z, int height, int depth, int trigger, CELL_TYPE level, int ticks, lattice_callback callback, void* context, int* subscription) {
+    return Lattice_Subscribe(_simu_default, Y, Z, height, depth, trigger, level, ticks, callback, context, subscription);
+}
+int Lattice_Unsubscribe(int subscription) {
+    return Lattice_Unsubscribe(_simu_default, subscription);
+}
+int Lattice_Wait_Events(lattice_event* events, int capacity, int timeout, int* count) {
+    return Lattice_Wait_Events(_simu_default, events, capacity, timeout, count);
+}
+int Lattice_Evaluate_Batch(const CELL_TYPE* inputs, int count, CELL_TYPE* outputs) {
+    return Lattice_Evaluate_Batch(_simu_default, inputs, count, outputs);
+}
+int Lattice_Evaluate_Batch(const int* values, int range, int count, int* outputs) {
+    return Lattice_Evaluate_Batch(_simu_default, values, range, count, outputs);
+}
+int Lattice_Start_Integration() {
+    return Lattice_Start_Integration(_simu_default);
+}
+int Lattice_Stop_Integration() {
+    return Lattice_Stop_Integration(_simu_default);
+}
@@ -0,0 +1,82 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    Cell arithmetic shared by the kernels. Each kernel source includes it, so it is compiled for that source's instruction set.
+*/
+#pragma once
+
+#include "lattice.h"
+#include <algorithm>
+#include <cmath>
+
+#ifdef CELL_TYPE_USE_FIXED_POINT
+// Fixed point charges. Every operation saturates, and each rounds the same way in every kernel, so results are bit-exact
+// across kernels and machines.
+
+/// <summary>
+/// multiplies two charges, rounding toward negative infinity
+/// </summary>
+static inline CELL_TYPE cell_mult(CELL_TYPE a, CELL_TYPE b) {
+    return cell_saturate(((int)a * b) >> CELL_FIXED_BITS);
+}
+static inline CELL_TYPE cell_add(CELL_TYPE a, CELL_TYPE b) {
+    return cell_saturate((int)a + b);
+}
+static inline CELL_TYPE cell_abs(CELL_TYPE a) {
+    return cell_saturate(a < 0 ? -a : a);
+}
+static inline CELL_TYPE cell_negate(CELL_TYPE a) {
+    return cell_saturate(-a);
+}
+/// <summary>
+/// divides two charges, returning false if the quotient overflows
+/// </summary>
+static inline bool cell_divide(CELL_TYPE a, CELL_TYPE b, CELL_TYPE* quotient) {
+    int q = a * CELL_ONE / b;
+    *quotient = (CELL_TYPE)q;
+    return (q < 0 ? -q : q) <= CELL_ONE;
+}
+/// <summary>
+/// adds value * dt to a charge, scaled in double precision, clamped to the range of a charge and rounded to nearest. The part of a
+/// step too small to move the charge is carried in residual, in 2^-CELL_RESIDUAL_BITS of a step, so a tick of a few microseconds
+/// still moves an integrator over the ticks that follow.
+/// </summary>
+static inline CELL_TYPE cell_integrate(CELL_TYPE charge, CELL_TYPE value, double dt, int* residual) {
+    const double scale = 1 << CELL_RESIDUAL_BITS;
+    double step = std::max(std::min(value * (dt * scale), CELL_MAX * scale), CELL_MIN * scale);
+    int total = (int)std::nearbyint(step) + *residual;
+    int whole = (total + (1 << (CELL_RESIDUAL_BITS - 1))) >> CELL_RESIDUAL_BITS;
+    *residual = total - whole * (1 << CELL_RESIDUAL_BITS);
+    return cell_saturate(charge + cell_saturate(whole));
+}
+/// <summary>
+/// rounds a charge worked out in double precision to the nearest charge, clamped to the range of a charge
+/// </summary>
+static inline CELL_TYPE cell_round(double charge) {
+    return cell_saturate((long long)std::nearbyint(std::max(std::min(charge, (double)CELL_MAX), (double)CELL_MIN)));
+}
+#else
+static inline CELL_TYPE cell_mult(CELL_TYPE a, CELL_TYPE b) {
+    return a * b;
+}
+static inline CELL_TYPE cell_add(CELL_TYPE a, CELL_TYPE b) {
+    return a + b;
+}
+static inline CELL_TYPE cell_abs(CELL_TYPE a) {
+    return a < 0 ? -a : a;
+}
+static inline CELL_TYPE cell_negate(CELL_TYPE a) {
+    return -a;
+}
+static inline bool cell_divide(CELL_TYPE a, CELL_TYPE b, CELL_TYPE* quotient) {
+    *quotient = a / b;
+    return (*quotient < 0 ? -*quotient : *quotient) <= 1;
+}
+static inline CELL_TYPE cell_integrate(CELL_TYPE charge, CELL_TYPE value, double dt, int*) {
+    return charge + (CELL_TYPE)(value * dt);
+}
+static inline CELL_TYPE cell_round(double charge) {
+    return (CELL_TYPE)charge;
+}
+#endif
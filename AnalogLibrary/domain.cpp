@@ -0,0 +1,428 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    Domains: one lattice split into slabs along X or Z, each held by its own process. Every process programs its lattice with the
+    coordinates of the whole one and keeps what falls in its slab, using sparse storage so only the slab is stored. The cells just
+    beyond each face shared with a neighbour form the halo: they are never programmed with a core, so like the input layer they hold
+    whatever charge they are given, and at the start of every tick they are given the charges the neighbour's face was left with.
+    The charges travel through a lattice_transport; SIMU_Transport_Shared carries them between processes on one machine through
+    a ring buffer per direction in shared memory.
+*/
+#include "pch.h"
+#include "lattice.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <string>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define SHARED_READY 0x4e4d4441     // "ADMN", set by rank 0 once the shared memory is laid out
+#define SHARED_LINE 64              // Counters written by different processes are kept this many bytes apart.
+
+/// <summary>
+/// returns the position of a cell along the axis a domain is split along
+/// </summary>
+static int get_axis_coord(LatticeHandle lattice, int x, int y, int z) {
+    return lattice->domainAxis == LATTICE_DOMAIN_X ? x : z;
+}
+
+bool get_owned(LatticeHandle lattice, int x, int y, int z) {
+    if (!lattice->domainCount) return true;
+    int coord = get_axis_coord(lattice, x, y, z);
+    return coord >= lattice->domainBegin && coord < lattice->domainEnd;
+}
+
+bool get_on_face(LatticeHandle lattice, int x, int y, int z) {
+    int coord = get_axis_coord(lattice, x, y, z);
+    return (coord == lattice->domainBegin && lattice->domainRank > 0)
+        || (coord == lattice->domainEnd - 1 && lattice->domainRank < lattice->domainCount - 1);
+}
+
+bool get_line_owned(LatticeHandle lattice, int x, int y, int z, int code) {
+    if (!lattice->domainCount) return true;
+    int connection = code & LATTICE_PROG_CONNECT_MASK;
+    // As in get_is_connection_to_me: a line on a positive axis flows back to the cell it is programmed at if FLOW_NEG is set.
+    bool inward = (connection < 3) == ((code & LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG) != 0);
+    if (!inward) step_coords(connection, &x, &y, &z);
+    if (!get_in_bounds(lattice, x, y, z)) return true; // left to fail as it would in any lattice
+    return get_owned(lattice, x, y, z);
+}
+
+/// <summary>
+/// gets the coordinates of a cell of a face or halo from its position in it, {Y, Z} at [Z * yMax + Y] across X and {X, Y} at
+/// [Y * xMax + X] across Z
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="p"></param>
+/// <param name="coord">The position of the face or halo along the axis of the domain.</param>
+static void get_face_coords(LatticeHandle lattice, int p, int coord, int* x, int* y, int* z) {
+    if (lattice->domainAxis == LATTICE_DOMAIN_X) {
+        *x = coord;
+        *y = p % lattice->yMax;
+        *z = p / lattice->yMax;
+    }
+    else {
+        *x = p % lattice->xMax;
+        *y = p / lattice->xMax;
+        *z = coord;
+    }
+}
+
+void compile_halo(LatticeHandle lattice, const int* slots) {
+    int face = lattice->domainAxis == LATTICE_DOMAIN_X ? lattice->yMax * lattice->zMax : lattice->xMax * lattice->yMax;
+    for (int side = 0; side < 2; side++) {
+        lattice->faceCells[side].clear();
+        lattice->haloCells[side].clear();
+        lattice->haloSlots[side].clear();
+        int peer = lattice->domainRank + (side ? 1 : -1);
+        if (peer < 0 || peer >= lattice->domainCount) continue;
+
+        int coord = side ? lattice->domainEnd - 1 : lattice->domainBegin;
+        int halo = side ? lattice->domainEnd : lattice->domainBegin - 1;
+        lattice->faceCells[side].resize(face);
+        lattice->haloCells[side].resize(face);
+        lattice->haloSlots[side].resize(face);
+        for (int p = 0; p < face; p++) {
+            int x, y, z;
+            get_face_coords(lattice, p, coord, &x, &y, &z);
+            lattice->faceCells[side][p] = get_mem_pos(lattice, x, y, z);
+            get_face_coords(lattice, p, halo, &x, &y, &z);
+            int idx = get_mem_pos(lattice, x, y, z);
+            lattice->haloCells[side][p] = idx;
+            lattice->haloSlots[side][p] = idx < 0 ? -1 : slots[idx];
+        }
+    }
+    // The tick the faces were left by, then the charges of the face.
+    lattice->haloMessage.resize(sizeof(long long) + (size_t)face * sizeof(CELL_TYPE));
+}
+
+int exchange_halo(LatticeHandle lattice, bool* active) {
+    lattice_transport* transport = &lattice->transport;
+    long long tick = lattice->tick.load(std::memory_order_relaxed);
+    char* message = lattice->haloMessage.data();
+    int bytes = (int)lattice->haloMessage.size();
+    CELL_TYPE* values = (CELL_TYPE*)(message + sizeof(long long));
+    CELL_TYPE* charges = lattice->charges;
+    int flags = 0;
+
+    // Every slab sends before it receives, which the transport buffers, so neighbours never wait on each other in a cycle.
+    for (int side = 0; side < 2; side++) {
+        if (lattice->faceCells[side].empty()) continue;
+        const int* cells = lattice->faceCells[side].data();
+        for (int p = 0; p < lattice->faceCells[side].size(); p++)
+            values[p] = cells[p] < 0 ? 0 : charges[cells[p]];
+        memcpy(message, &tick, sizeof(tick));
+        if (transport->send(transport->context, lattice->domainRank + (side ? 1 : -1), message, bytes) != LATTICE_STATE_OKAY)
+            flags |= LATTICE_STATE_ERR_NO_PEER;
+    }
+    for (int side = 0; side < 2; side++) {
+        if (lattice->haloCells[side].empty()) continue;
+        if (transport->receive(transport->context, lattice->domainRank + (side ? 1 : -1), message, bytes) != LATTICE_STATE_OKAY) {
+            flags |= LATTICE_STATE_ERR_NO_PEER;
+            continue;
+        }
+        long long sent;
+        memcpy(&sent, message, sizeof(sent));
+        if (sent != tick) {
+            flags |= LATTICE_STATE_ERR_NO_PEER;
+            continue;
+        }
+        const int* cells = lattice->haloCells[side].data();
+        const int* slots = lattice->haloSlots[side].data();
+        for (int p = 0; p < lattice->haloCells[side].size(); p++) {
+            if (cells[p] < 0) continue; // nothing here reads the cell
+            CELL_TYPE* cell = &charges[cells[p]];
+            if (!memcmp(cell, &values[p], sizeof(CELL_TYPE))) continue;
+            *cell = values[p];
+            *active = true;
+            if (slots[p] >= 0) mark_consumers(lattice, slots[p]);
+        }
+    }
+    return flags;
+}
+
+int SIMU_Lattice_Init_Domain(LatticeHandle* handle, int X, int Y, int Z, int noise, double ts, int axis, int rank, int count,
+    const lattice_transport* transport) {
+    lattice_transport adopted = {};
+    if (transport) adopted = *transport;
+    int length = axis == LATTICE_DOMAIN_X ? X : Z;
+    long long face = axis == LATTICE_DOMAIN_X ? (long long)Y * Z : (long long)X * Y;
+    int flag = LATTICE_STATE_OKAY;
+    if (!handle || (axis != LATTICE_DOMAIN_X && axis != LATTICE_DOMAIN_Z) || count < 1 || rank < 0 || rank >= count || count > length)
+        flag = LATTICE_STATE_ERR_BAD_CONFIG;
+    if (count > 1 && (!adopted.connect || !adopted.send || !adopted.receive
+        || sizeof(long long) + face * sizeof(CELL_TYPE) > INT_MAX))
+        flag = LATTICE_STATE_ERR_BAD_CONFIG;
+
+    LatticeHandle lattice = 0;
+    if (flag == LATTICE_STATE_OKAY) flag = create_lattice(&lattice, X, Y, Z, noise, ts, LATTICE_STORAGE_SPARSE);
+    if (flag == LATTICE_STATE_OKAY) {
+        lattice->domainAxis = axis;
+        lattice->domainRank = rank;
+        lattice->domainCount = count;
+        lattice->domainBegin = (int)((long long)length * rank / count);
+        lattice->domainEnd = (int)((long long)length * (rank + 1) / count);
+        lattice->transport = adopted; // closed by SIMU_Lattice_Destroy from here on
+        adopted.close = 0;
+        if (count > 1 && adopted.connect(adopted.context, (int)(sizeof(long long) + face * sizeof(CELL_TYPE))) != LATTICE_STATE_OKAY)
+            flag = LATTICE_STATE_ERR_NO_PEER;
+    }
+    if (flag != LATTICE_STATE_OKAY) {
+        if (lattice) SIMU_Lattice_Destroy(lattice);
+        if (adopted.close) adopted.close(adopted.context);
+        return flag;
+    }
+    *handle = lattice;
+    return LATTICE_STATE_OKAY;
+}
+
+// The shared memory behind SIMU_Transport_Shared starts with a shared_header, then a closed flag per rank, then a channel for each
+// direction between neighbouring ranks: channel 2r carries rank r to r + 1, and 2r + 1 carries r + 1 to r. Each channel is a
+// shared_channel followed by a ring of capacity bytes, holding the bytes written but not yet read.
+typedef struct shared_header {
+    std::atomic<int> ready;
+    int count;
+    long long capacity;
+    long long owner;    // process id of the rank 0 that laid it out
+} shared_header;
+
+typedef struct shared_channel {
+    std::atomic<long long> written;
+    char writer[SHARED_LINE - sizeof(std::atomic<long long>)];
+    std::atomic<long long> read;
+    char reader[SHARED_LINE - sizeof(std::atomic<long long>)];
+} shared_channel;
+
+typedef struct shared_transport {
+    std::string name;
+    int rank, count;
+    long long capacity;
+    char* memory;
+    size_t size;
+    std::atomic<int>* closed;
+#ifdef _WIN32
+    HANDLE mapping;
+#else
+    ino_t inode;        // of the shared memory mapped, to tell it from any that has since replaced it under the same name
+#endif
+} shared_transport;
+
+/// <summary>
+/// returns the channel carrying one rank to another, or NULL if they are not neighbours
+/// </summary>
+static shared_channel* get_channel(shared_transport* shared, int from, int to) {
+    if (from < 0 || to < 0 || from >= shared->count || to >= shared->count || (from - to != 1 && to - from != 1)) return NULL;
+    int index = 2 * std::min(from, to) + (from > to ? 1 : 0);
+    size_t offset = SHARED_LINE + ((shared->count * sizeof(std::atomic<int>) + SHARED_LINE - 1) / SHARED_LINE) * SHARED_LINE;
+    return (shared_channel*)(shared->memory + offset + (size_t)index * (sizeof(shared_channel) + shared->capacity));
+}
+
+/// <summary>
+/// waits until ready returns true, spinning at first and then sleeping between checks, as a neighbour usually answers within
+/// microseconds but may be paused for much longer
+/// </summary>
+/// <param name="ready"></param>
+/// <param name="closed">The closed flag of the rank waited on.</param>
+/// <returns>false if the rank closed the transport first.</returns>
+template <typename F>
+static bool wait_for_rank(F ready, const std::atomic<int>* closed) {
+    auto start = std::chrono::steady_clock::now();
+    bool spinning = true;
+    while (!ready()) {
+        if (closed->load(std::memory_order_acquire)) return ready();
+        if (spinning) {
+            std::this_thread::yield();
+            spinning = std::chrono::steady_clock::now() - start < std::chrono::nanoseconds(DOMAIN_SPIN_NANOS);
+        }
+        else std::this_thread::sleep_for(std::chrono::nanoseconds(DOMAIN_SLEEP_NANOS));
+    }
+    return true;
+}
+
+/// <summary>
+/// creates the shared memory of a transport on rank 0, or maps it once rank 0 has on the others
+/// </summary>
+/// <param name="deadline">when the other ranks give up waiting for it to appear.</param>
+/// <returns>false if it could not be created or did not appear in time.</returns>
+static bool map_shared(shared_transport* shared, std::chrono::steady_clock::time_point deadline) {
+#ifdef _WIN32
+    shared->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)shared->size >> 32),
+        (DWORD)shared->size, shared->name.c_str());
+    if (!shared->mapping) return false;
+    shared->memory = (char*)MapViewOfFile(shared->mapping, FILE_MAP_ALL_ACCESS, 0, 0, shared->size);
+    if (!shared->memory) {
+        CloseHandle(shared->mapping);
+        return false;
+    }
+#else
+    int fd = -1;
+    if (shared->rank == 0) {
+        shm_unlink(shared->name.c_str()); // left behind by a domain that did not close
+        fd = shm_open(shared->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 || ftruncate(fd, (off_t)shared->size) != 0) {
+            if (fd >= 0) close(fd);
+            return false;
+        }
+    }
+    else {
+        // Opened once rank 0 has sized it, so the mapping never runs past the end of the memory.
+        struct stat status;
+        while ((fd = shm_open(shared->name.c_str(), O_RDWR, 0600)) < 0 || fstat(fd, &status) != 0 || (size_t)status.st_size < shared->size) {
+            if (fd >= 0) close(fd);
+            if (std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        shared->inode = status.st_ino;
+    }
+    void* memory = mmap(NULL, shared->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) return false;
+    shared->memory = (char*)memory;
+#endif
+    return true;
+}
+
+/// <summary>
+/// unmaps the shared memory of a transport
+/// </summary>
+/// <param name="remove">whether to remove its name as well, which is left alone when it may already name newer memory.</param>
+static void unmap_shared(shared_transport* shared, bool remove = true) {
+    if (!shared->memory) return;
+#ifdef _WIN32
+    UnmapViewOfFile(shared->memory);
+    CloseHandle(shared->mapping);
+#else
+    munmap(shared->memory, shared->size);
+    if (remove) shm_unlink(shared->name.c_str());
+#endif
+    shared->memory = NULL;
+}
+
+/// <summary>
+/// checks that the shared memory a rank other than 0 mapped is the one the rank 0 of this run lays out
+/// </summary>
+/// <returns>false if it was left behind by a domain that did not close: its rank 0 has exited, or has been replaced under the same
+/// name by a rank 0 that started since. Neither happens on Windows, where named shared memory goes with the last handle to it.</returns>
+static bool is_shared_current(shared_transport* shared, shared_header* header) {
+#ifdef _WIN32
+    (void)shared;
+    (void)header;
+    return true;
+#else
+    if (header->ready.load(std::memory_order_acquire) == SHARED_READY && kill((pid_t)header->owner, 0) != 0 && errno != EPERM) return false;
+    struct stat status;
+    int fd = shm_open(shared->name.c_str(), O_RDONLY, 0600);
+    bool current = fd >= 0 && fstat(fd, &status) == 0 && status.st_ino == shared->inode;
+    if (fd >= 0) close(fd);
+    return current;
+#endif
+}
+
+static int shared_connect(void* context, int bytes) {
+    shared_transport* shared = (shared_transport*)context;
+    if (shared->memory || bytes < 1) return LATTICE_STATE_ERR_BAD_CONFIG;
+    shared->capacity = ((long long)bytes * DOMAIN_CHANNEL_MESSAGES + SHARED_LINE - 1) / SHARED_LINE * SHARED_LINE;
+    size_t channels = 2 * (size_t)(shared->count - 1);
+    size_t flags = (shared->count * sizeof(std::atomic<int>) + SHARED_LINE - 1) / SHARED_LINE * SHARED_LINE;
+    shared->size = SHARED_LINE + flags + channels * (sizeof(shared_channel) + shared->capacity);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DOMAIN_CONNECT_MILLIS);
+    if (!map_shared(shared, deadline)) return LATTICE_STATE_ERR_NO_PEER;
+
+    // New shared memory is zeroed, which leaves every channel empty and every rank open.
+    shared_header* header = (shared_header*)shared->memory;
+    shared->closed = (std::atomic<int>*)(shared->memory + SHARED_LINE);
+    if (shared->rank == 0) {
+        header->count = shared->count;
+        header->capacity = shared->capacity;
+#ifndef _WIN32
+        header->owner = (long long)getpid();
+#endif
+        header->ready.store(SHARED_READY, std::memory_order_release);
+        return LATTICE_STATE_OKAY;
+    }
+    // Memory left behind by a domain that did not close may already be ready, so it is mapped again until this run's rank 0 has laid it out.
+    bool current;
+    while (!(current = is_shared_current(shared, header)) || header->ready.load(std::memory_order_acquire) != SHARED_READY) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            unmap_shared(shared, false);
+            return LATTICE_STATE_ERR_NO_PEER;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (current) continue;
+        unmap_shared(shared, false);
+        if (!map_shared(shared, deadline)) return LATTICE_STATE_ERR_NO_PEER;
+        header = (shared_header*)shared->memory;
+        shared->closed = (std::atomic<int>*)(shared->memory + SHARED_LINE);
+    }
+    if (header->count != shared->count || header->capacity != shared->capacity) {
+        unmap_shared(shared, false);
+        return LATTICE_STATE_ERR_BAD_CONFIG;
+    }
+    return LATTICE_STATE_OKAY;
+}
+
+static int shared_send(void* context, int rank, const void* data, int bytes) {
+    shared_transport* shared = (shared_transport*)context;
+    shared_channel* channel = shared->memory ? get_channel(shared, shared->rank, rank) : NULL;
+    if (!channel || bytes < 0 || bytes > shared->capacity) return LATTICE_STATE_ERR_BAD_CONFIG;
+    char* ring = (char*)(channel + 1);
+    long long written = channel->written.load(std::memory_order_relaxed);
+    long long capacity = shared->capacity;
+    if (!wait_for_rank([&] { return capacity - (written - channel->read.load(std::memory_order_acquire)) >= bytes; }, &shared->closed[rank]))
+        return LATTICE_STATE_ERR_NO_PEER;
+
+    size_t offset = (size_t)(written % capacity);
+    size_t first = std::min((size_t)bytes, (size_t)(capacity - offset));
+    memcpy(ring + offset, data, first);
+    memcpy(ring, (const char*)data + first, bytes - first);
+    channel->written.store(written + bytes, std::memory_order_release);
+    return LATTICE_STATE_OKAY;
+}
+
+static int shared_receive(void* context, int rank, void* data, int bytes) {
+    shared_transport* shared = (shared_transport*)context;
+    shared_channel* channel = shared->memory ? get_channel(shared, rank, shared->rank) : NULL;
+    if (!channel || bytes < 0 || bytes > shared->capacity) return LATTICE_STATE_ERR_BAD_CONFIG;
+    const char* ring = (const char*)(channel + 1);
+    long long read = channel->read.load(std::memory_order_relaxed);
+    long long capacity = shared->capacity;
+    if (!wait_for_rank([&] { return channel->written.load(std::memory_order_acquire) - read >= bytes; }, &shared->closed[rank]))
+        return LATTICE_STATE_ERR_NO_PEER;
+
+    size_t offset = (size_t)(read % capacity);
+    size_t first = std::min((size_t)bytes, (size_t)(capacity - offset));
+    memcpy(data, ring + offset, first);
+    memcpy((char*)data + first, ring, bytes - first);
+    channel->read.store(read + bytes, std::memory_order_release);
+    return LATTICE_STATE_OKAY;
+}
+
+static void shared_close(void* context) {
+    shared_transport* shared = (shared_transport*)context;
+    // Neighbours waiting on this rank give up rather than wait forever.
+    if (shared->memory) shared->closed[shared->rank].store(1, std::memory_order_release);
+    unmap_shared(shared);
+    delete shared;
+}
+
+int SIMU_Transport_Shared(const char* name, int rank, int count, lattice_transport* transport) {
+    if (!name || !*name || !transport || count < 1 || rank < 0 || rank >= count) return LATTICE_STATE_ERR_BAD_CONFIG;
+    shared_transport* shared = new shared_transport();
+    shared->name = name;
+    shared->rank = rank;
+    shared->count = count;
+    transport->context = shared;
+    transport->connect = shared_connect;
+    transport->send = shared_send;
+    transport->receive = shared_receive;
+    transport->close = shared_close;
+    return LATTICE_STATE_OKAY;
+}
@@ -0,0 +1,255 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    The LATTICE_INTEGRATE methods other than Euler, as explicit Runge-Kutta methods over the integrators of the schedule. Each stage
+    sets the integrators to a trial state and brings the rest of the lattice up to date with operate_tasks, which leaves integrators
+    alone under these methods, then reads the lines into each integrator as its rate of change. operate_tasks only evaluates the
+    tasks that read a changed cell, so a stage costs what depends on the integrators rather than the whole lattice.
+*/
+#include "pch.h"
+#include "lattice.h"
+#include "cell.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// An explicit Runge-Kutta method. Stage s reads the rates at y + h * sum(stage[s][j] * k[j]), a step moves to
+// y + h * sum(step[j] * k[j]), and an embedded method gives the error of a step as h * sum(error[j] * k[j]).
+typedef struct integration_method {
+    int stages;
+    double stage[INTEGRATE_STAGES][INTEGRATE_STAGES];
+    double step[INTEGRATE_STAGES];
+    double error[INTEGRATE_STAGES];
+    int order;  // the power of the step its error estimate grows with
+} integration_method;
+
+static const integration_method methods[] = {
+    // LATTICE_INTEGRATE_EULER is run by the kernels as the lattice is evaluated, never here.
+    { 1, { { 0 } }, { 1 }, { 0 }, 1 },
+    // LATTICE_INTEGRATE_HEUN
+    { 2, { { 0 }, { 1 } }, { 0.5, 0.5 }, { 0 }, 2 },
+    // LATTICE_INTEGRATE_RK4
+    { 4, { { 0 }, { 0.5 }, { 0, 0.5 }, { 0, 0, 1 } }, { 1.0 / 6, 1.0 / 3, 1.0 / 3, 1.0 / 6 }, { 0 }, 4 },
+    // LATTICE_INTEGRATE_ADAPTIVE: Bogacki-Shampine. Its last stage is read at the end of the step, so it is the first of the next.
+    { 4, { { 0 }, { 0.5 }, { 0, 0.75 }, { 2.0 / 9, 1.0 / 3, 4.0 / 9 } }, { 2.0 / 9, 1.0 / 3, 4.0 / 9, 0 },
+        { -5.0 / 72, 1.0 / 12, 1.0 / 9, -1.0 / 8 }, 3 },
+};
+
+/// <summary>
+/// returns the number of integrators in the schedule
+/// </summary>
+/// <param name="lattice"></param>
+/// <returns></returns>
+static int count_integrators(LatticeHandle lattice) {
+    int count = 0;
+    for (int b = 0; b < lattice->batches.size(); b++) {
+        if ((lattice->batches[b].core & LATTICE_PROG_CORE_MASK) == LATTICE_PROG_CORE_INT) count += lattice->batches[b].count;
+    }
+    return count;
+}
+
+/// <summary>
+/// reads the charge of each integrator, in the order of the batches
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="state"></param>
+static void read_state(LatticeHandle lattice, double* state) {
+    int n = 0;
+    for (int b = 0; b < lattice->batches.size(); b++) {
+        const batch* work = &lattice->batches[b];
+        if ((work->core & LATTICE_PROG_CORE_MASK) != LATTICE_PROG_CORE_INT) continue;
+        for (int i = 0; i < work->count; i++, n++) {
+            state[n] = lattice->charges[work->cells[i]];
+#ifdef CELL_TYPE_USE_FIXED_POINT
+            state[n] += (double)lattice->residuals[n] / (1 << CELL_RESIDUAL_BITS);
+#endif
+        }
+    }
+}
+
+#ifdef CELL_TYPE_USE_FIXED_POINT
+/// <summary>
+/// keeps what rounding the state to the charges of the integrators left out, for read_state to add back next tick
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="state"></param>
+static void store_residuals(LatticeHandle lattice, const double* state) {
+    const double scale = 1 << CELL_RESIDUAL_BITS, most = 1 << (CELL_RESIDUAL_BITS - 1);
+    int n = 0;
+    for (int b = 0; b < lattice->batches.size(); b++) {
+        const batch* work = &lattice->batches[b];
+        if ((work->core & LATTICE_PROG_CORE_MASK) != LATTICE_PROG_CORE_INT) continue;
+        for (int i = 0; i < work->count; i++, n++) {
+            // A saturated charge keeps no more than half a step beyond it.
+            double residual = (state[n] - lattice->charges[work->cells[i]]) * scale;
+            lattice->residuals[n] = (int)std::nearbyint(std::max(std::min(residual, most), -most));
+        }
+    }
+}
+#endif
+
+/// <summary>
+/// reads the rate of change of each integrator, the sum of its lines as the kernels would read them, in charge per second
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="rates"></param>
+/// <param name="lines">Added to by the lines read.</param>
+/// <returns>The LATTICE_STATE flags raised by the lines.</returns>
+static int read_rates(LatticeHandle lattice, double* rates, long long* lines) {
+    const CELL_TYPE* charges = lattice->charges;
+    int flags = 0, n = 0;
+    for (int b = 0; b < lattice->batches.size(); b++) {
+        const batch* work = &lattice->batches[b];
+        if ((work->core & LATTICE_PROG_CORE_MASK) != LATTICE_PROG_CORE_INT) continue;
+        for (int i = 0; i < work->count; i++) {
+            double rate = 0;
+            for (int k = 0; k < work->inputs; k++) {
+                int line = k * work->count + i;
+                CELL_TYPE value = charges[work->sources[line]];
+                if (work->features & KERNEL_NOISE) value = cell_add(value, work->noise[line]);
+                flags |= apply_line(value, work->modifiers[line], work->pattern[k], &value);
+                rate += value;
+            }
+            rates[n++] = rate;
+        }
+        *lines += (long long)work->count * work->inputs;
+    }
+    return flags;
+}
+
+/// <summary>
+/// sets each integrator to a trial state, marking the tasks that read those that change, and evaluates the rest of the lattice
+/// from them
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="state"></param>
+/// <param name="active"></param>
+/// <param name="cells"></param>
+/// <param name="lines"></param>
+/// <returns>The LATTICE_STATE flags raised.</returns>
+static int evaluate_state(LatticeHandle lattice, const double* state, bool* active, long long* cells, long long* lines) {
+    CELL_TYPE* charges = lattice->charges;
+    int n = 0;
+    for (int b = 0; b < lattice->batches.size(); b++) {
+        const batch* work = &lattice->batches[b];
+        if ((work->core & LATTICE_PROG_CORE_MASK) != LATTICE_PROG_CORE_INT) continue;
+        int slot = (int)(work->cells - lattice->batchCells.data());
+        for (int i = 0; i < work->count; i++) {
+            CELL_TYPE charge = cell_round(state[n++]);
+            if (!memcmp(&charge, &charges[work->cells[i]], sizeof(CELL_TYPE))) continue;
+            charges[work->cells[i]] = charge;
+            mark_consumers(lattice, slot + i);
+        }
+    }
+    long long stageCells, stageLines;
+    int flags = operate_tasks(lattice, 0, false, active, &stageCells, &stageLines);
+    *cells += stageCells;
+    *lines += stageLines;
+    return flags;
+}
+
+/// <summary>
+/// works out a step of h from start, given the rates at start in rates[0], reading the rates of every later stage into rates.
+/// The lattice is left evaluated from the last stage, and next receives the end of the step.
+/// </summary>
+/// <returns>The LATTICE_STATE flags raised.</returns>
+static int take_step(LatticeHandle lattice, const integration_method* method, int count, double h, const double* start, double* next,
+    double** rates, bool* active, long long* cells, long long* lines) {
+    int flags = 0;
+    for (int s = 1; s < method->stages; s++) {
+        for (int n = 0; n < count; n++) {
+            double delta = 0;
+            for (int j = 0; j < s; j++)
+                delta += method->stage[s][j] * rates[j][n];
+            next[n] = start[n] + h * delta;
+        }
+        flags |= evaluate_state(lattice, next, active, cells, lines);
+        flags |= read_rates(lattice, rates[s], lines);
+        *cells += count;
+    }
+    for (int n = 0; n < count; n++) {
+        double delta = 0;
+        for (int j = 0; j < method->stages; j++)
+            delta += method->step[j] * rates[j][n];
+        next[n] = start[n] + h * delta;
+    }
+    return flags;
+}
+
+int integrate(LatticeHandle lattice, double dt, bool* active, long long* cells, long long* lines) {
+    int count = count_integrators(lattice);
+    if (!count) return 0;
+    *active = true;
+    const integration_method* method = &methods[lattice->integrationMethod];
+    std::vector<double>& state = lattice->integrationState;
+    state.resize((size_t)count * (2 + INTEGRATE_STAGES));
+    double* start = state.data();
+    double* next = start + count;
+    double* rates[INTEGRATE_STAGES];
+    for (int s = 0; s < INTEGRATE_STAGES; s++)
+        rates[s] = next + (size_t)(s + 1) * count;
+
+    // Noise is drawn once per tick, so every stage reads the same noise on the lines into the integrators.
+    for (int t = 0; t < lattice->tasks.size(); t++) {
+        const batch* work = &lattice->batches[lattice->tasks[t].batch];
+        if ((work->core & LATTICE_PROG_CORE_MASK) == LATTICE_PROG_CORE_INT && (work->features & KERNEL_NOISE)) apply_noise(lattice, t);
+    }
+    read_state(lattice, start);
+    int flags = read_rates(lattice, rates[0], lines);
+    *cells += count;
+
+    if (lattice->integrationMethod != LATTICE_INTEGRATE_ADAPTIVE) {
+        flags |= take_step(lattice, method, count, dt, start, next, rates, active, cells, lines);
+        flags |= evaluate_state(lattice, next, active, cells, lines);
+        record_integration(lattice, 1, 0);
+    }
+    else {
+        // Steps are taken until they cover the tick, each as long as the last one suggests will keep within the tolerance.
+        double tolerance = lattice->integrationTolerance * CELL_ONE;
+        double least = dt / INTEGRATE_MAX_STEPS;
+        double h = lattice->integrationStep > 0 ? lattice->integrationStep : dt;
+        double taken = 0;
+        long long steps = 0, rejected = 0;
+        std::copy(start, start + count, next);
+        while (taken < dt) {
+            double step = std::min(h, dt - taken);
+            // The last step of a tick may be cut short; one within a rounding error of the end is taken to it.
+            if (dt - taken - step <= dt * 1e-9) step = dt - taken;
+            flags |= take_step(lattice, method, count, step, start, next, rates, active, cells, lines);
+
+            double error = 0;
+            for (int n = 0; n < count; n++) {
+                double delta = 0;
+                for (int j = 0; j < method->stages; j++)
+                    delta += method->error[j] * rates[j][n];
+                error = std::max(error, std::abs(step * delta));
+            }
+            double scale = error > 0 ? INTEGRATE_SAFETY * std::pow(tolerance / error, 1.0 / method->order) : INTEGRATE_MAX_SCALE;
+            scale = std::max(std::min(scale, INTEGRATE_MAX_SCALE), INTEGRATE_MIN_SCALE);
+
+            if (error <= tolerance || step <= least) {
+                // The last stage was read at the end of the step, so the lattice is already evaluated from it.
+                taken += step;
+                steps++;
+                std::copy(next, next + count, start);
+                std::swap(rates[0], rates[method->stages - 1]);
+                h = step < h ? std::max(h, step * scale) : step * scale;
+            }
+            else {
+                rejected++;
+                h = std::max(step * scale, least);
+            }
+        }
+        lattice->integrationStep = h;
+        record_integration(lattice, steps, rejected);
+    }
+
+#ifdef CELL_TYPE_USE_FIXED_POINT
+    store_residuals(lattice, next);
+#endif
+    for (int n = 0; n < count; n++) {
+        if (std::abs(next[n]) > CELL_ONE) flags |= LATTICE_STATE_ERR_OVERFLOW_CELL;
+    }
+    return flags;
+}
@@ -0,0 +1,184 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    Conversions of charges, the scalar batch kernels and selection of the SIMD kernels.
+*/
+#include "pch.h"
+#include "lattice.h"
+#include "cell.h"
+#include "lanes.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#ifdef CELL_TYPE_USE_FIXED_POINT
+CELL_TYPE cell_ratio(double value, double range) {
+    double charge = std::nearbyint(value / range * CELL_ONE);
+    return charge != charge ? 0 : cell_saturate((long long)std::max(std::min(charge, (double)CELL_MAX), (double)CELL_MIN));
+}
+CELL_TYPE cell_scale(CELL_TYPE charge, CELL_TYPE range) {
+    return cell_saturate((long long)charge * range / CELL_ONE);
+}
+int cell_scale(CELL_TYPE charge, int range) {
+    return (int)((long long)charge * range / CELL_ONE);
+}
+#else
+CELL_TYPE cell_ratio(double value, double range) {
+    return (CELL_TYPE)(value / range);
+}
+CELL_TYPE cell_scale(CELL_TYPE charge, CELL_TYPE range) {
+    return charge * range;
+}
+int cell_scale(CELL_TYPE charge, int range) {
+    return (int)(charge * range);
+}
+#endif
+
+int apply_line(CELL_TYPE val, CELL_TYPE modifier, char config, CELL_TYPE* output) {
+    int flags = 0;
+
+    switch (config & LATTICE_PROG_CONNECT_CONFIG_MOD_MASK) {
+    case LATTICE_PROG_CONNECT_CONFIG_MOD_COEFF:
+        val = cell_mult(val, modifier);
+        break;
+    case LATTICE_PROG_CONNECT_CONFIG_MOD_DIVIS:
+        if (modifier == 0) {
+            val = LATTICE_DEFAULT_DIV_ZERO;
+            flags |= LATTICE_STATE_ERR_DIV_ZERO;
+        }
+        else if (!cell_divide(val, modifier, &val)) {
+            val = 0;
+            flags |= LATTICE_STATE_ERR_OVERFLOW_CELL;
+        }
+        break;
+    case LATTICE_PROG_CONNECT_CONFIG_MOD_COMP:
+        if (val == modifier) val = 0;
+        else if (val < modifier) val = -CELL_ONE;
+        else val = CELL_ONE;
+
+        break;
+    }
+
+    if (config & LATTICE_PROG_CONNECT_CONFIG_ABSOLUTE)
+        val = cell_abs(val);
+
+    if (config & LATTICE_PROG_CONNECT_CONFIG_INVERT)
+        val = cell_negate(val);
+
+    *output = val;
+
+    return flags;
+}
+
+/// <summary>
+/// the scalar kernel, instantiated for each core program and set of KERNEL features
+/// </summary>
+template <int CORE, int FEATURES>
+static int operate_batch_scalar(CELL_TYPE* charges, const batch* work, int begin, int end, double dt) {
+    int flags = 0;
+    int count = work->count;
+
+    for (int i = begin; i < end; i++) {
+        int idx = work->cells[i];
+        CELL_TYPE charge = 0;
+        if (CORE == LATTICE_PROG_CORE_MULT) charge = CELL_ONE;
+        if (CORE == LATTICE_PROG_CORE_HOLDVAL || CORE == LATTICE_PROG_CORE_INT) charge = charges[idx];
+        int residual = CORE == LATTICE_PROG_CORE_INT && work->residuals ? work->residuals[i] : 0;
+
+        for (int k = 0; k < work->inputs; k++) {
+            int line = k * count + i;
+            CELL_TYPE value = charges[work->sources[line]];
+            if (FEATURES & KERNEL_NOISE) value = cell_add(value, work->noise[line]);
+            if (FEATURES & (KERNEL_DIVIS | KERNEL_COMP)) {
+                flags |= apply_line(value, work->modifiers[line], work->pattern[k], &value);
+            }
+            else {
+                // Every line multiplies, plain ones by CELL_ONE (see compile_batches).
+                if (FEATURES & KERNEL_COEFF) value = cell_mult(value, work->modifiers[line]);
+                if (FEATURES & KERNEL_SIGN) {
+                    if (work->pattern[k] & LATTICE_PROG_CONNECT_CONFIG_ABSOLUTE) value = cell_abs(value);
+                    if (work->pattern[k] & LATTICE_PROG_CONNECT_CONFIG_INVERT) value = cell_negate(value);
+                }
+            }
+            if (CORE == LATTICE_PROG_CORE_SUM) charge = cell_add(charge, value);
+            if (CORE == LATTICE_PROG_CORE_MULT) charge = cell_mult(charge, value);
+            if (CORE == LATTICE_PROG_CORE_INT) charge = cell_integrate(charge, value, dt, &residual);
+        }
+
+        if (CORE != LATTICE_PROG_CORE_HOLDVAL) charges[idx] = charge;
+        if (CORE == LATTICE_PROG_CORE_INT && work->residuals) work->residuals[i] = residual;
+        if ((charge < 0 ? -charge : charge) > CELL_ONE) flags |= LATTICE_STATE_ERR_OVERFLOW_CELL;
+    }
+    return flags;
+}
+
+static const batch_kernel scalarKernels[4][KERNEL_FEATURES] = KERNEL_TABLE(operate_batch_scalar);
+
+batch_kernel select_scalar(int core, int features) {
+    return scalarKernels[core & LATTICE_PROG_CORE_MASK][features];
+}
+int operate_batch_scalar(CELL_TYPE* charges, const batch* work, int begin, int end, double dt) {
+    return select_scalar(work->core, KERNEL_FEATURES - 1)(charges, work, begin, end, dt);
+}
+
+static const lane_kernel scalarLanes[4] = LANE_KERNELS;
+
+int detect_simd_level() {
+    bool avx2 = false, avx512 = false;
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 0);
+    int leaves = info[0];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (osxsave && leaves >= 7) {
+        unsigned long long xcr0 = _xgetbv(0);
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6;
+        avx512 = (info[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6;
+    }
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    avx2 = __builtin_cpu_supports("avx2");
+    avx512 = __builtin_cpu_supports("avx512f");
+#endif
+    if (avx512 && kernels_avx512()) return LATTICE_SIMD_AVX512;
+    if (avx2 && kernels_avx2()) return LATTICE_SIMD_AVX2;
+    return LATTICE_SIMD_NONE;
+}
+
+kernel_select get_kernels(int level) {
+    if (level < LATTICE_SIMD_NONE || level > detect_simd_level()) return 0;
+    switch (level) {
+    case LATTICE_SIMD_AVX512: return kernels_avx512();
+    case LATTICE_SIMD_AVX2: return kernels_avx2();
+    }
+    return select_scalar;
+}
+
+const lane_kernel* get_lane_kernels(int level) {
+    if (level < LATTICE_SIMD_NONE || level > detect_simd_level()) return 0;
+    switch (level) {
+    case LATTICE_SIMD_AVX512: return lanes_avx512();
+    case LATTICE_SIMD_AVX2: return lanes_avx2();
+    }
+    return scalarLanes;
+}
+
+int get_kernel_features(const batch* work) {
+    int features = 0;
+    for (int k = 0; k < work->inputs; k++) {
+        switch (work->pattern[k] & LATTICE_PROG_CONNECT_CONFIG_MOD_MASK) {
+        case LATTICE_PROG_CONNECT_CONFIG_MOD_COEFF: features |= KERNEL_COEFF; break;
+        case LATTICE_PROG_CONNECT_CONFIG_MOD_DIVIS: features |= KERNEL_DIVIS; break;
+        case LATTICE_PROG_CONNECT_CONFIG_MOD_COMP: features |= KERNEL_COMP; break;
+        }
+        if (work->pattern[k] & (LATTICE_PROG_CONNECT_CONFIG_ABSOLUTE | LATTICE_PROG_CONNECT_CONFIG_INVERT)) features |= KERNEL_SIGN;
+    }
+    return features;
+}
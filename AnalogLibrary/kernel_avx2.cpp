@@ -0,0 +1,292 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    AVX2 batch kernels, lane kernels and noise generator. Built with AVX2 code generation enabled and only called once
+    detect_simd_level has confirmed the CPU supports it. With CELL_TYPE_USE_FIXED_POINT, charges are evaluated in 16 bit lanes, 16 cells at a time.
+*/
+#include "lattice.h"
+#include "lanes.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+
+#ifdef CELL_TYPE_USE_FIXED_POINT
+#define AVX2_LANES 16
+
+/// <summary>
+/// gathers 16 charges. AVX2 only gathers 32 bit values, so each charge is read with the one after it (the storage has a spare
+/// cell at the end for this) and sign extended from the low half.
+/// </summary>
+static inline __m256i gather_charges(const CELL_TYPE* charges, const int* cells) {
+    __m256i low = _mm256_i32gather_epi32((const int*)charges, _mm256_loadu_si256((const __m256i*)cells), sizeof(CELL_TYPE));
+    __m256i high = _mm256_i32gather_epi32((const int*)charges, _mm256_loadu_si256((const __m256i*)(cells + 8)), sizeof(CELL_TYPE));
+    low = _mm256_srai_epi32(_mm256_slli_epi32(low, 16), 16);
+    high = _mm256_srai_epi32(_mm256_slli_epi32(high, 16), 16);
+    // packs works within 128 bit halves, so the quarters come out as low0 high0 low1 high1.
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xd8);
+}
+/// <summary>
+/// multiplies 16 charges as cell_mult does, through 32 bit products
+/// </summary>
+static inline __m256i mult_charges(__m256i a, __m256i b) {
+    __m256i low = _mm256_mullo_epi16(a, b), high = _mm256_mulhi_epi16(a, b);
+    __m256i first = _mm256_srai_epi32(_mm256_unpacklo_epi16(low, high), CELL_FIXED_BITS);
+    __m256i second = _mm256_srai_epi32(_mm256_unpackhi_epi16(low, high), CELL_FIXED_BITS);
+    return _mm256_packs_epi32(first, second);
+}
+/// <summary>
+/// returns |a| for 16 charges, saturating
+/// </summary>
+static inline __m256i abs_charges(__m256i a) {
+    return _mm256_min_epu16(_mm256_abs_epi16(a), _mm256_set1_epi16(CELL_MAX));
+}
+/// <summary>
+/// integrates 8 charges as cell_integrate does, in double precision, clamped to the range of a charge and rounded to nearest, and
+/// carrying the parts of a step in residual
+/// </summary>
+/// <returns>The whole steps to move each charge, in 32 bit lanes.</returns>
+static inline __m256i integrate_charges(__m128i a, __m256d step, __m256i* residual) {
+    const double scale = 1 << CELL_RESIDUAL_BITS;
+    const __m256d low = _mm256_set1_pd(CELL_MIN * scale), high = _mm256_set1_pd(CELL_MAX * scale);
+    __m256i wide = _mm256_cvtepi16_epi32(a);
+    __m256d first = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(wide)), step);
+    __m256d second = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(wide, 1)), step);
+    first = _mm256_max_pd(_mm256_min_pd(first, high), low);
+    second = _mm256_max_pd(_mm256_min_pd(second, high), low);
+    __m256i total = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm256_cvtpd_epi32(first)), _mm256_cvtpd_epi32(second), 1);
+    total = _mm256_add_epi32(total, *residual);
+    __m256i whole = _mm256_srai_epi32(_mm256_add_epi32(total, _mm256_set1_epi32(1 << (CELL_RESIDUAL_BITS - 1))), CELL_RESIDUAL_BITS);
+    *residual = _mm256_sub_epi32(total, _mm256_slli_epi32(whole, CELL_RESIDUAL_BITS));
+    return whole;
+}
+
+template <int CORE, int FEATURES>
+static int operate_batch_avx2(CELL_TYPE* charges, const batch* work, int begin, int end, double dt) {
+    // Division has no integer SIMD instruction; such batches are left to the scalar kernel.
+    if (FEATURES & KERNEL_DIVIS) return select_scalar(CORE, FEATURES)(charges, work, begin, end, dt);
+
+    int count = work->count;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(CELL_ONE);
+    const __m256i minusOne = _mm256_set1_epi16(-CELL_ONE);
+    const __m256d step = _mm256_set1_pd(dt * (1 << CELL_RESIDUAL_BITS));
+
+    int flags = 0;
+    __m256i overflow = zero;
+    int i = begin;
+    for (; i + AVX2_LANES <= end; i += AVX2_LANES) {
+        __m256i charge = CORE == LATTICE_PROG_CORE_SUM ? zero : one;
+        if (CORE == LATTICE_PROG_CORE_HOLDVAL || CORE == LATTICE_PROG_CORE_INT) charge = gather_charges(charges, work->cells + i);
+        // link_batches gives every integrator a residual in fixed point builds.
+        __m256i residualLow = zero, residualHigh = zero;
+        if (CORE == LATTICE_PROG_CORE_INT) {
+            residualLow = _mm256_loadu_si256((const __m256i*)(work->residuals + i));
+            residualHigh = _mm256_loadu_si256((const __m256i*)(work->residuals + i + 8));
+        }
+
+        for (int k = 0; k < work->inputs; k++) {
+            int line = k * count + i;
+            __m256i val = gather_charges(charges, work->sources + line);
+            if (FEATURES & KERNEL_NOISE) val = _mm256_adds_epi16(val, _mm256_loadu_si256((const __m256i*)(work->noise + line)));
+
+            if (FEATURES & (KERNEL_COEFF | KERNEL_COMP)) {
+                __m256i modifier = _mm256_loadu_si256((const __m256i*)(work->modifiers + line));
+                if (!(FEATURES & KERNEL_COMP)) {
+                    // Every line multiplies, plain ones by CELL_ONE.
+                    val = mult_charges(val, modifier);
+                }
+                else switch (work->pattern[k] & LATTICE_PROG_CONNECT_CONFIG_MOD_MASK) {
+                case LATTICE_PROG_CONNECT_CONFIG_MOD_COEFF:
+                    val = mult_charges(val, modifier);
+                    break;
+                case LATTICE_PROG_CONNECT_CONFIG_MOD_COMP: {
+                    __m256i result = _mm256_blendv_epi8(one, minusOne, _mm256_cmpgt_epi16(modifier, val));
+                    val = _mm256_andnot_si256(_mm256_cmpeq_epi16(val, modifier), result);
+                    break;
+                }
+                }
+            }
+
+            if (FEATURES & KERNEL_SIGN) {
+                if (work->pattern[k] & LATTICE_PROG_CONNECT_CONFIG_ABSOLUTE) val = abs_charges(val);
+                if (work->pattern[k] & LATTICE_PROG_CONNECT_CONFIG_INVERT) val = _mm256_subs_epi16(zero, val);
+            }
+
+            if (CORE == LATTICE_PROG_CORE_SUM) charge = _mm256_adds_epi16(charge, val);
+            if (CORE == LATTICE_PROG_CORE_MULT) charge = mult_charges(charge, val);
+            if (CORE == LATTICE_PROG_CORE_INT) {
+                __m256i low = integrate_charges(_mm256_castsi256_si128(val), step, &residualLow);
+                __m256i high = integrate_charges(_mm256_extracti128_si256(val, 1), step, &residualHigh);
+                // Saturated to a charge as cell_integrate does; packs works within 128 bit halves, as in gather_charges.
+                charge = _mm256_adds_epi16(charge, _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xd8));
+            }
+        }
+        if (CORE == LATTICE_PROG_CORE_INT) {
+            _mm256_storeu_si256((__m256i*)(work->residuals + i), residualLow);
+            _mm256_storeu_si256((__m256i*)(work->residuals + i + 8), residualHigh);
+        }
+
+        if (CORE != LATTICE_PROG_CORE_HOLDVAL) {
+            CELL_TYPE out[AVX2_LANES];
+            _mm256_storeu_si256((__m256i*)out, charge);
+            for (int l = 0; l < AVX2_LANES; l++)
+                charges[work->cells[i + l]] = out[l];
+        }
+        overflow = _mm256_or_si256(overflow, _mm256_cmpgt_epi16(abs_charges(charge), one));
+    }
+
+    if (_mm256_movemask_epi8(overflow)) flags |= LATTICE_STATE_ERR_OVERFLOW_CELL;
+
+    if (i < end) flags |= select_scalar(CORE, FEATURES)(charges, work, i, end, dt);
+    return flags;
+}
+#else
+#define AVX2_LANES 8
+
+template <int CORE, int FEATURES>
+static int operate_batch_avx2(CELL_TYPE* charges, const batch* work, int begin, int end, double dt) {
+    int flags = 0;
+    int count = work->count;
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 divDefault = _mm256_set1_ps(LATTICE_DEFAULT_DIV_ZERO);
+    const __m256d step = _mm256_set1_pd(dt);
+
+    // Per-line masks, so ABSOLUTE and INVERT are applied without branching on the line config.
+    __m256 absolute[ALL_CONNECTIONS], invert[ALL_CONNECTIONS];
+    if (FEATURES & KERNEL_SIGN) {
+        for (int k = 0; k < work->inputs; k++) {
+            absolute[k] = (work->pattern[k] & LATTICE_PROG_CONNECT_CONFIG_ABSOLUTE) ? _mm256_castsi256_ps(_mm256_set1_epi32(-1)) : zero;
+            invert[k] = (work->pattern[k] & LATTICE_PROG_CONNECT_CONFIG_INVERT) ? sign : zero;
+        }
+    }
+
+    __m256 overflow = zero, divZero = zero;
+    int i = begin;
+    for (; i + AVX2_LANES <= end; i += AVX2_LANES) {
+        __m256i idx = _mm256_loadu_si256((const __m256i*)(work->cells + i));
+        __m256 charge = CORE == LATTICE_PROG_CORE_SUM ? zero : one;
+        if (CORE == LATTICE_PROG_CORE_HOLDVAL || CORE == LATTICE_PROG_CORE_INT) charge = _mm256_i32gather_ps(charges, idx, sizeof(CELL_TYPE));
+
+        for (int k = 0; k < work->inputs; k++) {
+            int line = k * count + i;
+            __m256 val = _mm256_i32gather_ps(charges, _mm256_loadu_si256((const __m256i*)(work->sources + line)), sizeof(CELL_TYPE));
+            if (FEATURES & KERNEL_NOISE) val = _mm256_add_ps(val, _mm256_loadu_ps(work->noise + line));
+
+            if (FEATURES & (KERNEL_COEFF | KERNEL_DIVIS | KERNEL_COMP)) {
+                __m256 modifier = _mm256_loadu_ps(work->modifiers + line);
+                if (!(FEATURES & (KERNEL_DIVIS | KERNEL_COMP))) {
+                    // Every line multiplies, plain ones by CELL_ONE.
+                    val = _mm256_mul_ps(val, modifier);
+                }
+                else switch (work->pattern[k] & LATTICE_PROG_CONNECT_CONFIG_MOD_MASK) {
+                case LATTICE_PROG_CONNECT_CONFIG_MOD_COEFF:
+                    val = _mm256_mul_ps(val, modifier);
+                    break;
+                case LATTICE_PROG_CONNECT_CONFIG_MOD_DIVIS: {
+                    __m256 isZero = _mm256_cmp_ps(modifier, zero, _CMP_EQ_OQ);
+                    __m256 quotient = _mm256_div_ps(val, modifier);
+                    __m256 over = _mm256_andnot_ps(isZero, _mm256_cmp_ps(_mm256_andnot_ps(sign, quotient), one, _CMP_GT_OQ));
+                    overflow = _mm256_or_ps(overflow, over);
+                    divZero = _mm256_or_ps(divZero, isZero);
+                    val = _mm256_blendv_ps(_mm256_blendv_ps(quotient, zero, over), divDefault, isZero);
+                    break;
+                }
+                case LATTICE_PROG_CONNECT_CONFIG_MOD_COMP: {
+                    __m256 result = _mm256_blendv_ps(one, _mm256_xor_ps(one, sign), _mm256_cmp_ps(val, modifier, _CMP_LT_OQ));
+                    val = _mm256_blendv_ps(result, zero, _mm256_cmp_ps(val, modifier, _CMP_EQ_OQ));
+                    break;
+                }
+                }
+            }
+
+            if (FEATURES & KERNEL_SIGN) {
+                __m256 negative = _mm256_and_ps(_mm256_cmp_ps(val, zero, _CMP_LT_OQ), absolute[k]);
+                val = _mm256_blendv_ps(val, _mm256_xor_ps(val, sign), negative);
+                val = _mm256_xor_ps(val, invert[k]);
+            }
+
+            if (CORE == LATTICE_PROG_CORE_SUM) charge = _mm256_add_ps(charge, val);
+            if (CORE == LATTICE_PROG_CORE_MULT) charge = _mm256_mul_ps(charge, val);
+            if (CORE == LATTICE_PROG_CORE_INT) {
+                // Scaled in double precision to match the scalar kernel exactly.
+                __m128 low = _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(val)), step));
+                __m128 high = _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(val, 1)), step));
+                charge = _mm256_add_ps(charge, _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1));
+            }
+        }
+
+        if (CORE != LATTICE_PROG_CORE_HOLDVAL) {
+            // AVX2 has no scatter.
+            CELL_TYPE out[AVX2_LANES];
+            _mm256_storeu_ps(out, charge);
+            for (int l = 0; l < AVX2_LANES; l++)
+                charges[work->cells[i + l]] = out[l];
+        }
+        overflow = _mm256_or_ps(overflow, _mm256_cmp_ps(_mm256_andnot_ps(sign, charge), one, _CMP_GT_OQ));
+    }
+
+    if (_mm256_movemask_ps(overflow)) flags |= LATTICE_STATE_ERR_OVERFLOW_CELL;
+    if (_mm256_movemask_ps(divZero)) flags |= LATTICE_STATE_ERR_DIV_ZERO;
+
+    if (i < end) flags |= select_scalar(CORE, FEATURES)(charges, work, i, end, dt);
+    return flags;
+}
+#endif
+
+static const batch_kernel avx2Kernels[4][KERNEL_FEATURES] = KERNEL_TABLE(operate_batch_avx2);
+static const lane_kernel avx2Lanes[4] = LANE_KERNELS;
+
+/// <summary>
+/// generate_noise_scalar, 8 counters at a time
+/// </summary>
+static void generate_noise_avx2(float* values, unsigned first, int n, unsigned tick) {
+    const __m256i multiplier = _mm256_set1_epi32((int)PHILOX_MULTIPLIER);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i c0 = _mm256_add_epi32(_mm256_set1_epi32((int)(first + i)), lanes);
+        __m256i c1 = _mm256_set1_epi32((int)tick);
+        unsigned key = NOISE_SEED;
+        for (int r = 0; r < PHILOX_ROUNDS; r++) {
+            // The high words of the even and odd lanes' 64 bit products.
+            __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(c0, multiplier), 32);
+            __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(c0, 32), multiplier);
+            __m256i high = _mm256_blend_epi32(even, odd, 0xaa);
+            __m256i low = _mm256_mullo_epi32(c0, multiplier);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(high, _mm256_set1_epi32((int)key)), c1);
+            c1 = low;
+            key += PHILOX_WEYL;
+        }
+        _mm256_storeu_ps(values + i, _mm256_mul_ps(_mm256_cvtepi32_ps(c0), _mm256_set1_ps(PHILOX_SCALE)));
+    }
+    if (i < n) generate_noise_scalar(values + i, first + i, n - i, tick);
+}
+
+static batch_kernel select_avx2(int core, int features) {
+    return avx2Kernels[core & LATTICE_PROG_CORE_MASK][features];
+}
+
+kernel_select kernels_avx2() {
+    return select_avx2;
+}
+noise_generator noise_avx2() {
+    return generate_noise_avx2;
+}
+const lane_kernel* lanes_avx2() {
+    return avx2Lanes;
+}
+#else
+kernel_select kernels_avx2() {
+    return 0;
+}
+noise_generator noise_avx2() {
+    return 0;
+}
+const lane_kernel* lanes_avx2() {
+    return 0;
+}
+#endif
@@ -0,0 +1,156 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    AVX-512 batch kernels, lane kernels and noise generator. Built with AVX-512F code generation enabled and only called once detect_simd_level
+    has confirmed the CPU supports it. The tail of a batch is handled with lane masks rather than a scalar loop.
+    There is no fixed point variant; with CELL_TYPE_USE_FIXED_POINT the AVX2 kernel is the widest available.
+*/
+#include "lattice.h"
+#include "lanes.h"
+
+#if defined(__AVX512F__) && !defined(CELL_TYPE_USE_FIXED_POINT)
+#include <immintrin.h>
+
+#define AVX512_LANES 16
+
+template <int CORE, int FEATURES>
+static int operate_batch_avx512(CELL_TYPE* charges, const batch* work, int begin, int end, double dt) {
+    int count = work->count;
+
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 one = _mm512_set1_ps(1);
+    const __m512 minusOne = _mm512_set1_ps(-1);
+    const __m512i sign = _mm512_set1_epi32(0x80000000);
+    const __m512 divDefault = _mm512_set1_ps(LATTICE_DEFAULT_DIV_ZERO);
+    const __m512d step = _mm512_set1_pd(dt);
+
+    // Per-line masks, so ABSOLUTE and INVERT are applied without branching on the line config.
+    __mmask16 absolute[ALL_CONNECTIONS];
+    __m512i invert[ALL_CONNECTIONS];
+    if (FEATURES & KERNEL_SIGN) for (int k = 0; k < work->inputs; k++) {
+        absolute[k] = (work->pattern[k] & LATTICE_PROG_CONNECT_CONFIG_ABSOLUTE) ? 0xffff : 0;
+        invert[k] = (work->pattern[k] & LATTICE_PROG_CONNECT_CONFIG_INVERT) ? sign : _mm512_setzero_si512();
+    }
+
+    __mmask16 overflow = 0, divZero = 0;
+    for (int i = begin; i < end; i += AVX512_LANES) {
+        __mmask16 lanes = end - i >= AVX512_LANES ? (__mmask16)0xffff : (__mmask16)((1 << (end - i)) - 1);
+        __m512i idx = _mm512_maskz_loadu_epi32(lanes, work->cells + i);
+        __m512 charge = CORE == LATTICE_PROG_CORE_SUM ? zero : one;
+        if (CORE == LATTICE_PROG_CORE_HOLDVAL || CORE == LATTICE_PROG_CORE_INT) charge = _mm512_mask_i32gather_ps(zero, lanes, idx, charges, sizeof(CELL_TYPE));
+
+        for (int k = 0; k < work->inputs; k++) {
+            int line = k * count + i;
+            __m512i src = _mm512_maskz_loadu_epi32(lanes, work->sources + line);
+            __m512 val = _mm512_mask_i32gather_ps(zero, lanes, src, charges, sizeof(CELL_TYPE));
+            if (FEATURES & KERNEL_NOISE) val = _mm512_add_ps(val, _mm512_maskz_loadu_ps(lanes, work->noise + line));
+
+            if (FEATURES & (KERNEL_COEFF | KERNEL_DIVIS | KERNEL_COMP)) {
+                __m512 modifier = _mm512_maskz_loadu_ps(lanes, work->modifiers + line);
+                if (!(FEATURES & (KERNEL_DIVIS | KERNEL_COMP))) {
+                    // Every line multiplies, plain ones by CELL_ONE.
+                    val = _mm512_mul_ps(val, modifier);
+                }
+                else switch (work->pattern[k] & LATTICE_PROG_CONNECT_CONFIG_MOD_MASK) {
+                case LATTICE_PROG_CONNECT_CONFIG_MOD_COEFF:
+                    val = _mm512_mul_ps(val, modifier);
+                    break;
+                case LATTICE_PROG_CONNECT_CONFIG_MOD_DIVIS: {
+                    __mmask16 isZero = _mm512_mask_cmp_ps_mask(lanes, modifier, zero, _CMP_EQ_OQ);
+                    __m512 quotient = _mm512_div_ps(val, modifier);
+                    __mmask16 over = _mm512_mask_cmp_ps_mask(lanes & ~isZero, _mm512_abs_ps(quotient), one, _CMP_GT_OQ);
+                    overflow |= over;
+                    divZero |= isZero;
+                    val = _mm512_mask_blend_ps(isZero, _mm512_mask_blend_ps(over, quotient, zero), divDefault);
+                    break;
+                }
+                case LATTICE_PROG_CONNECT_CONFIG_MOD_COMP: {
+                    __m512 result = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(val, modifier, _CMP_LT_OQ), one, minusOne);
+                    val = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(val, modifier, _CMP_EQ_OQ), result, zero);
+                    break;
+                }
+                }
+            }
+
+            if (FEATURES & KERNEL_SIGN) {
+                __mmask16 negative = _mm512_mask_cmp_ps_mask(absolute[k], val, zero, _CMP_LT_OQ);
+                val = _mm512_castsi512_ps(_mm512_mask_xor_epi32(_mm512_castps_si512(val), negative, _mm512_castps_si512(val), sign));
+                val = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(val), invert[k]));
+            }
+
+            if (CORE == LATTICE_PROG_CORE_SUM) charge = _mm512_add_ps(charge, val);
+            if (CORE == LATTICE_PROG_CORE_MULT) charge = _mm512_mul_ps(charge, val);
+            if (CORE == LATTICE_PROG_CORE_INT) {
+                // Scaled in double precision to match the scalar kernel exactly.
+                __m512d wide = _mm512_castps_pd(val);
+                __m256 low = _mm512_cvtpd_ps(_mm512_mul_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(val)), step));
+                __m256 high = _mm512_cvtpd_ps(_mm512_mul_pd(_mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(wide, 1))), step));
+                __m512d scaled = _mm512_insertf64x4(_mm512_castpd256_pd512(_mm256_castps_pd(low)), _mm256_castps_pd(high), 1);
+                charge = _mm512_add_ps(charge, _mm512_castpd_ps(scaled));
+            }
+        }
+
+        if (CORE != LATTICE_PROG_CORE_HOLDVAL)
+            _mm512_mask_i32scatter_ps(charges, lanes, idx, charge, sizeof(CELL_TYPE));
+        overflow |= _mm512_mask_cmp_ps_mask(lanes, _mm512_abs_ps(charge), one, _CMP_GT_OQ);
+    }
+
+    int flags = 0;
+    if (overflow) flags |= LATTICE_STATE_ERR_OVERFLOW_CELL;
+    if (divZero) flags |= LATTICE_STATE_ERR_DIV_ZERO;
+    return flags;
+}
+
+static const batch_kernel avx512Kernels[4][KERNEL_FEATURES] = KERNEL_TABLE(operate_batch_avx512);
+static const lane_kernel avx512Lanes[4] = LANE_KERNELS;
+
+/// <summary>
+/// generate_noise_scalar, 16 counters at a time with the tail masked
+/// </summary>
+static void generate_noise_avx512(float* values, unsigned first, int n, unsigned tick) {
+    const __m512i multiplier = _mm512_set1_epi32((int)PHILOX_MULTIPLIER);
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    for (int i = 0; i < n; i += AVX512_LANES) {
+        __mmask16 mask = n - i >= AVX512_LANES ? (__mmask16)0xffff : (__mmask16)((1 << (n - i)) - 1);
+        __m512i c0 = _mm512_add_epi32(_mm512_set1_epi32((int)(first + i)), lanes);
+        __m512i c1 = _mm512_set1_epi32((int)tick);
+        unsigned key = NOISE_SEED;
+        for (int r = 0; r < PHILOX_ROUNDS; r++) {
+            // The high words of the even and odd lanes' 64 bit products.
+            __m512i even = _mm512_srli_epi64(_mm512_mul_epu32(c0, multiplier), 32);
+            __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(c0, 32), multiplier);
+            __m512i high = _mm512_mask_blend_epi32(0xaaaa, even, odd);
+            __m512i low = _mm512_mullo_epi32(c0, multiplier);
+            c0 = _mm512_xor_si512(_mm512_xor_si512(high, _mm512_set1_epi32((int)key)), c1);
+            c1 = low;
+            key += PHILOX_WEYL;
+        }
+        _mm512_mask_storeu_ps(values + i, mask, _mm512_mul_ps(_mm512_cvtepi32_ps(c0), _mm512_set1_ps(PHILOX_SCALE)));
+    }
+}
+
+static batch_kernel select_avx512(int core, int features) {
+    return avx512Kernels[core & LATTICE_PROG_CORE_MASK][features];
+}
+
+kernel_select kernels_avx512() {
+    return select_avx512;
+}
+noise_generator noise_avx512() {
+    return generate_noise_avx512;
+}
+const lane_kernel* lanes_avx512() {
+    return avx512Lanes;
+}
+#else
+kernel_select kernels_avx512() {
+    return 0;
+}
+noise_generator noise_avx512() {
+    return 0;
+}
+const lane_kernel* lanes_avx512() {
+    return 0;
+}
+#endif
@@ -0,0 +1,95 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    The lane kernel behind Lattice_Evaluate_Batch: a batch evaluated for QUERY_LANES queries at once. The charges of each cell are
+    stored as a row of QUERY_LANES values, one per query, so every line reads a contiguous row and every operation is the same
+    across the row. Written as plain loops over the lanes; each kernel source includes it, so the compiler vectorizes it for that
+    source's instruction set.
+*/
+#pragma once
+
+#include "cell.h"
+
+/// <summary>
+/// evaluates every cell of a batch in each of the QUERY_LANES queries
+/// </summary>
+/// <param name="lanes">The rows of charges, one per slot of batchCells.</param>
+/// <param name="work"></param>
+/// <param name="sources">The slot of each line of the batch, laid out as work->sources.</param>
+/// <param name="slot">The slot of the first cell of the batch.</param>
+/// <returns>The LATTICE_STATE flags raised in any lane.</returns>
+template <int CORE>
+static int operate_lanes(CELL_TYPE* lanes, const batch* work, const int* sources, int slot) {
+    int count = work->count;
+    bool overflow = false, divZero = false;
+
+    for (int i = 0; i < count; i++) {
+        CELL_TYPE charge[QUERY_LANES];
+        for (int b = 0; b < QUERY_LANES; b++)
+            charge[b] = CORE == LATTICE_PROG_CORE_MULT ? CELL_ONE : 0;
+
+        for (int k = 0; k < work->inputs; k++) {
+            int line = k * count + i;
+            const CELL_TYPE* in = lanes + (size_t)sources[line] * QUERY_LANES;
+            CELL_TYPE modifier = work->modifiers[line];
+            char config = work->pattern[k];
+
+            // The config of a line is the same in every lane, so each case is one loop across the row.
+            CELL_TYPE value[QUERY_LANES];
+            switch (config & LATTICE_PROG_CONNECT_CONFIG_MOD_MASK) {
+            case LATTICE_PROG_CONNECT_CONFIG_MOD_COEFF:
+                for (int b = 0; b < QUERY_LANES; b++)
+                    value[b] = cell_mult(in[b], modifier);
+                break;
+            case LATTICE_PROG_CONNECT_CONFIG_MOD_DIVIS:
+                if (modifier == 0) {
+                    for (int b = 0; b < QUERY_LANES; b++)
+                        value[b] = LATTICE_DEFAULT_DIV_ZERO;
+                    divZero = true;
+                    break;
+                }
+                for (int b = 0; b < QUERY_LANES; b++) {
+                    CELL_TYPE quotient;
+                    bool fits = cell_divide(in[b], modifier, &quotient);
+                    value[b] = fits ? quotient : 0;
+                    overflow |= !fits;
+                }
+                break;
+            case LATTICE_PROG_CONNECT_CONFIG_MOD_COMP:
+                for (int b = 0; b < QUERY_LANES; b++)
+                    value[b] = in[b] == modifier ? 0 : in[b] < modifier ? -CELL_ONE : CELL_ONE;
+                break;
+            default:
+                for (int b = 0; b < QUERY_LANES; b++)
+                    value[b] = in[b];
+                break;
+            }
+            if (config & LATTICE_PROG_CONNECT_CONFIG_ABSOLUTE) {
+                for (int b = 0; b < QUERY_LANES; b++)
+                    value[b] = cell_abs(value[b]);
+            }
+            if (config & LATTICE_PROG_CONNECT_CONFIG_INVERT) {
+                for (int b = 0; b < QUERY_LANES; b++)
+                    value[b] = cell_negate(value[b]);
+            }
+
+            for (int b = 0; b < QUERY_LANES; b++)
+                charge[b] = CORE == LATTICE_PROG_CORE_SUM ? cell_add(charge[b], value[b]) : cell_mult(charge[b], value[b]);
+        }
+
+        CELL_TYPE* out = lanes + (size_t)(slot + i) * QUERY_LANES;
+        for (int b = 0; b < QUERY_LANES; b++) {
+            out[b] = charge[b];
+            overflow |= (charge[b] < 0 ? -charge[b] : charge[b]) > CELL_ONE;
+        }
+    }
+
+    int flags = 0;
+    if (overflow) flags |= LATTICE_STATE_ERR_OVERFLOW_CELL;
+    if (divZero) flags |= LATTICE_STATE_ERR_DIV_ZERO;
+    return flags;
+}
+
+// operate_lanes for each core program. Holding cells, and integrators while integration is off, keep their row as it is.
+#define LANE_KERNELS { 0, operate_lanes<LATTICE_PROG_CORE_SUM>, operate_lanes<LATTICE_PROG_CORE_MULT>, 0 }
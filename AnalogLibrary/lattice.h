@@ -0,0 +1,820 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    Internal definitions shared between the library sources. Not part of the public API.
+*/
+#pragma once
+
+#include "AnalogLibrary.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <deque>
+
+#define POS_X 0
+#define POS_Y 1
+#define POS_Z 2
+#define NEG_X 3
+#define NEG_Y 4
+#define NEG_Z 5
+
+#define OPTIM_CONNECTIONS
+#define ALL_CONNECTIONS 6
+#ifdef OPTIM_CONNECTIONS
+    #define CONNECTION_COUNT 3
+#else
+    #define CONNECTION_COUNT 6
+#endif
+
+// Sparse storage allocates cells in cubic bricks of BRICK_SIZE cells per side.
+#define BRICK_BITS 3
+#define BRICK_SIZE (1 << BRICK_BITS)
+#define BRICK_MASK (BRICK_SIZE - 1)
+#define BRICK_CELLS (BRICK_SIZE * BRICK_SIZE * BRICK_SIZE)
+
+#define LATTICE_PROG_CONNECT_CONFIG_ACTIVE 7		// Internal use only!
+#define LATTICE_PROG_CONNECT_CONFIG_PATTERN (LATTICE_PROG_CONNECT_CONFIG_MOD_MASK | LATTICE_PROG_CONNECT_CONFIG_INVERT | LATTICE_PROG_CONNECT_CONFIG_ABSOLUTE)
+
+// Identifies where a connection line is stored: the cell that owns it and the positive axis it occupies.
+typedef struct port {
+    int cell;
+    int axis;
+} port;
+
+typedef struct edge {
+    int source;
+    CELL_TYPE modifier;
+    char config;
+
+    edge() {
+        source = 0;
+        modifier = 0;
+        config = 0;
+    }
+    edge(int src, CELL_TYPE mod, char cfg) {
+        source = src;
+        modifier = mod;
+        config = cfg;
+    }
+} edge;
+
+typedef struct instruction {
+    int cell;
+    char config;
+} instruction;
+
+// A cell on the path of the depth first search of compile_schedule, and the next of its connections to follow.
+typedef struct search_frame {
+    int cell;
+    int connection;
+    int x, y, z;
+} search_frame;
+
+// The state of compile_schedule's search for feedback loops, with an entry per cell of the lattice in each vector.
+typedef struct loop_search {
+    std::vector<int> reached;           // order each cell was reached in, or -1
+    std::vector<int> lowest;            // earliest open cell it was found to read, by the order reached
+    std::vector<char> open;             // reached, but not yet scheduled
+    std::vector<char> inside;           // cells a search within a loop may enter (see compile_loop)
+    std::vector<int> component;         // the open cells, in the order reached
+    std::vector<search_frame> path;
+    int next;
+} loop_search;
+
+#define STAGED_CORE 0
+#define STAGED_CONNECT 1
+
+// A Lattice_Program_Core or Lattice_Program_Connect call staged by a transaction.
+typedef struct staged_edit {
+    int kind;           // STAGED_CORE or STAGED_CONNECT
+    int x, y, z;
+    int code;
+    CELL_TYPE underbus; // the underbus charge when the call was made
+} staged_edit;
+
+// Evaluates cells [begin, end) of a batch, returning the accumulated LATTICE_STATE flags.
+typedef int (*batch_kernel)(CELL_TYPE* charges, const struct batch* work, int begin, int end, double dt);
+
+// Features of the input lines of a batch. Kernels are instantiated for each core program and set of features, and each batch
+// is evaluated by the instantiation for exactly its own, so a batch of plain lines runs with no modifier code at all.
+#define KERNEL_COEFF 1      // Some line is multiplied by its modifier. Plain lines of such a batch are given a modifier of CELL_ONE,
+                            // so without KERNEL_DIVIS or KERNEL_COMP every line is multiplied without checking its config.
+#define KERNEL_DIVIS 2
+#define KERNEL_COMP 4
+#define KERNEL_SIGN 8       // Some line is ABSOLUTE or INVERT.
+#define KERNEL_NOISE 16     // The lattice has a noise mode, and every line carries the noise apply_noise wrote for it.
+#define KERNEL_FEATURES 32
+
+// A group of cells from one level of the schedule that share a core program and the configuration of every input line.
+// No cell in a batch feeds another cell of the same level, so the cells of a batch can be evaluated in any order.
+typedef struct batch {
+    int level;
+    char core;
+    int inputs;
+    char pattern[ALL_CONNECTIONS];  // config of each input line, masked by LATTICE_PROG_CONNECT_CONFIG_PATTERN
+    int count;
+    const int* cells;
+    const int* sources;             // inputs * count entries, line-major: line k of cell i is at [k * count + i]
+    const CELL_TYPE* modifiers;     // laid out as sources
+    const CELL_TYPE* noise;         // laid out as sources, written by apply_noise before each evaluation with KERNEL_NOISE
+    int* residuals;                 // laid out as cells, for integrators with CELL_TYPE_USE_FIXED_POINT (see cell_integrate), else 0
+    int features;                   // KERNEL features of the lines
+    batch_kernel kernel;
+} batch;
+
+// Returns the kernel instantiated for a core program and set of KERNEL features.
+typedef batch_kernel (*kernel_select)(int core, int features);
+
+// The instantiations of a kernel template<int CORE, int FEATURES> as a [core][features] table.
+#define KERNEL_VARIANTS(kernel, core) { \
+    kernel<core, 0>, kernel<core, 1>, kernel<core, 2>, kernel<core, 3>, kernel<core, 4>, kernel<core, 5>, kernel<core, 6>, kernel<core, 7>, \
+    kernel<core, 8>, kernel<core, 9>, kernel<core, 10>, kernel<core, 11>, kernel<core, 12>, kernel<core, 13>, kernel<core, 14>, kernel<core, 15>, \
+    kernel<core, 16>, kernel<core, 17>, kernel<core, 18>, kernel<core, 19>, kernel<core, 20>, kernel<core, 21>, kernel<core, 22>, kernel<core, 23>, \
+    kernel<core, 24>, kernel<core, 25>, kernel<core, 26>, kernel<core, 27>, kernel<core, 28>, kernel<core, 29>, kernel<core, 30>, kernel<core, 31> }
+#define KERNEL_TABLE(kernel) { \
+    KERNEL_VARIANTS(kernel, LATTICE_PROG_CORE_HOLDVAL), KERNEL_VARIANTS(kernel, LATTICE_PROG_CORE_SUM), \
+    KERNEL_VARIANTS(kernel, LATTICE_PROG_CORE_MULT), KERNEL_VARIANTS(kernel, LATTICE_PROG_CORE_INT) }
+
+// Evaluates every cell of a batch for QUERY_LANES queries at once (see lanes.h), returning the accumulated LATTICE_STATE flags.
+typedef int (*lane_kernel)(CELL_TYPE* lanes, const struct batch* work, const int* sources, int slot);
+
+#define QUERY_LANES 16      // Queries evaluated together by Lattice_Evaluate_Batch.
+
+#ifdef CELL_TYPE_USE_FIXED_POINT
+#define CELL_MIN (-32768)
+#define CELL_MAX 32767
+#define CELL_RESIDUAL_BITS 15       // Fixed point integrators carry the parts of a step they have yet to move in 2^-15 of a step.
+
+/// <summary>
+/// clamps a value to the range of a fixed point charge
+/// </summary>
+/// <param name="value"></param>
+/// <returns></returns>
+inline CELL_TYPE cell_saturate(long long value) {
+    return (CELL_TYPE)(value < CELL_MIN ? CELL_MIN : value > CELL_MAX ? CELL_MAX : value);
+}
+#endif
+
+/// <summary>
+/// returns the charge value / range, where a range of charge is a full charge
+/// </summary>
+/// <param name="value"></param>
+/// <param name="range"></param>
+/// <returns></returns>
+CELL_TYPE cell_ratio(double value, double range);
+/// <summary>
+/// returns a charge scaled to the given range, where a full charge is the whole range
+/// </summary>
+/// <param name="charge"></param>
+/// <param name="range"></param>
+/// <returns></returns>
+CELL_TYPE cell_scale(CELL_TYPE charge, CELL_TYPE range);
+int cell_scale(CELL_TYPE charge, int range);
+
+/// <summary>
+/// applies a line's modifier configuration to a value read through it
+/// </summary>
+/// <param name="val"></param>
+/// <param name="modifier"></param>
+/// <param name="config"></param>
+/// <param name="output"></param>
+/// <returns>The LATTICE_STATE flags raised by the line.</returns>
+int apply_line(CELL_TYPE val, CELL_TYPE modifier, char config, CELL_TYPE* output);
+
+/// <summary>
+/// evaluates a batch of any features with the scalar kernel
+/// </summary>
+int operate_batch_scalar(CELL_TYPE* charges, const batch* work, int begin, int end, double dt);
+
+/// <summary>
+/// returns the KERNEL features of a batch's lines
+/// </summary>
+int get_kernel_features(const batch* work);
+
+batch_kernel select_scalar(int core, int features);
+/// <summary>
+/// returns the AVX2 kernels, or 0 if the library was built without them
+/// </summary>
+kernel_select kernels_avx2();
+/// <summary>
+/// returns the AVX-512 kernels, or 0 if the library was built without them
+/// </summary>
+kernel_select kernels_avx512();
+
+/// <summary>
+/// returns the highest LATTICE_SIMD level supported by both the CPU and this build
+/// </summary>
+int detect_simd_level();
+/// <summary>
+/// returns the kernels of a LATTICE_SIMD level, or 0 if that level is unavailable
+/// </summary>
+kernel_select get_kernels(int level);
+
+/// <summary>
+/// returns the AVX2 lane kernels by core program, or 0 if the library was built without them
+/// </summary>
+const lane_kernel* lanes_avx2();
+/// <summary>
+/// returns the AVX-512 lane kernels by core program, or 0 if the library was built without them
+/// </summary>
+const lane_kernel* lanes_avx512();
+/// <summary>
+/// returns the lane kernels of a LATTICE_SIMD level by core program, or 0 if that level is unavailable
+/// </summary>
+const lane_kernel* get_lane_kernels(int level);
+
+#define LATTICE_NOISE_MODE_MASK 15  // Internal use only!
+
+// Strengths of the noise models, per tick and as fractions of a full charge (see noise.cpp).
+#define NOISE_RANDOM_LEVEL 0.001f       // peak of the random noise on a line
+#define NOISE_INDUCTANCE 0.01f          // charge induced on the lines into a cell per unit change of the charges around it
+#define NOISE_RESISTANCE 0.002f         // share of a line's charge lost to resistance
+#define NOISE_HEAT_RESISTANCE 1.0f      // increase in resistance per unit of heat
+#define NOISE_HEATING 0.5f              // heat gained per unit of power dissipated on a line
+#define NOISE_COOLING 0.01f             // share of a line's heat lost
+#define NOISE_SEED 0x2545f491u          // key of the random noise
+
+// The Philox-2x32 generator behind the random noise.
+#define PHILOX_ROUNDS 10
+#define PHILOX_MULTIPLIER 0xd256d193u
+#define PHILOX_WEYL 0x9e3779b9u
+#define PHILOX_SCALE (1.0f / 2147483648.0f) // maps a signed 32 bit word onto [-1, 1)
+
+#define POOL_TASK_CELLS 512         // Cells per task when a level is split across threads.
+#define POOL_MIN_PARALLEL_CELLS 4096 // Levels with fewer cells are evaluated by the sim thread alone.
+#define POOL_SPIN 4096              // Polls a worker makes for new work before sleeping.
+
+// A unit of parallel work: cells [begin, end) of a batch.
+typedef struct task {
+    int batch;
+    int begin;
+    int end;
+} task;
+
+// A participant's share of a level. Holds the range [head, tail) of task indices packed into one word; the owner takes from
+// the head and other participants steal from the tail. Padded to its own cache line.
+typedef struct task_queue {
+    std::atomic<unsigned long long> range;
+    char padding[64 - sizeof(std::atomic<unsigned long long>)];
+} task_queue;
+
+/// <summary>
+/// returns true if the given coordinates lie inside the lattice
+/// </summary>
+bool get_in_bounds(LatticeHandle lattice, int x, int y, int z);
+/// <summary>
+/// gets the position in memory of the given coordinates, or -1 if they lie outside the lattice or in a brick that has not been allocated
+/// </summary>
+int get_mem_pos(LatticeHandle lattice, int x, int y, int z);
+/// <summary>
+/// works out the coordinates of the cell stored at idx
+/// </summary>
+void get_coords(LatticeHandle lattice, int idx, int* x, int* y, int* z);
+/// <summary>
+/// moves the given coordinates one cell along a connection
+/// </summary>
+void step_coords(int connection, int* x, int* y, int* z);
+/// <summary>
+/// returns the index of the neighbour of idx along the given connection, or -1 if it lies outside the lattice or has not been allocated
+/// </summary>
+int get_neighbour(LatticeHandle lattice, int idx, int connection);
+
+// Writes the random values in [-1, 1) of n consecutive counters of a tick, starting at first (see noise.cpp).
+typedef void (*noise_generator)(float* values, unsigned first, int n, unsigned tick);
+
+void generate_noise_scalar(float* values, unsigned first, int n, unsigned tick);
+/// <summary>
+/// returns the AVX2 noise generator, or 0 if the library was built without it
+/// </summary>
+noise_generator noise_avx2();
+/// <summary>
+/// returns the AVX-512 noise generator, or 0 if the library was built without it
+/// </summary>
+noise_generator noise_avx512();
+/// <summary>
+/// returns the noise generator of a LATTICE_SIMD level, or 0 if that level is unavailable
+/// </summary>
+noise_generator get_noise_generator(int level);
+
+/// <summary>
+/// sizes the noise state for a newly compiled program, or releases it if there is no noise mode. Heat starts cold.
+/// </summary>
+/// <param name="lattice"></param>
+void compile_noise(LatticeHandle lattice);
+/// <summary>
+/// works out the charge induced on the lines into each scheduled cell by the change of the charges around it over the last tick.
+/// Called at the start of a tick with LATTICE_NOISE_MODE_INDUCTIVE.
+/// </summary>
+/// <param name="lattice"></param>
+void induce_noise(LatticeHandle lattice);
+/// <summary>
+/// writes the noise carried by each line of a task this tick, and heats the lines with LATTICE_NOISE_MODE_HEAT_RESISTIVE.
+/// Called just before the task is evaluated, so it sees the charges its kernel will read.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="index"></param>
+void apply_noise(LatticeHandle lattice, int index);
+
+/// <summary>
+/// evaluates one task of a lattice and marks the tasks that read any cell it changed
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="index"></param>
+/// <param name="dt"></param>
+/// <param name="noise">Set on the first evaluation of a tick, which draws the noise of the lines. Later ones reuse it.</param>
+/// <returns>The LATTICE_STATE flags of the task.</returns>
+int run_task(LatticeHandle lattice, int index, double dt, bool noise);
+/// <summary>
+/// marks every task that reads the cell at the given slot
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="slot"></param>
+void mark_consumers(LatticeHandle lattice, int slot);
+/// <summary>
+/// evaluates every task of the lattice that needs to run, level by level, and integrates if integration is on and the method is
+/// LATTICE_INTEGRATE_EULER
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="dt"></param>
+/// <param name="noise">Set on the first evaluation of a tick. It draws the noise of every line, so every noisy task runs; later
+/// evaluations within the tick run only the tasks that read a changed cell, reusing that noise.</param>
+/// <param name="active">Set if any task ran.</param>
+/// <param name="evaluated">Receives the cells evaluated.</param>
+/// <param name="lines">Receives the lines read by those cells.</param>
+/// <returns>The LATTICE_STATE flags of the tasks.</returns>
+int operate_tasks(LatticeHandle lattice, double dt, bool noise, bool* active, long long* evaluated, long long* lines);
+
+// The integration methods other than LATTICE_INTEGRATE_EULER (see integrate.cpp).
+#define INTEGRATE_STAGES 4                  // Most stages of any method.
+#define INTEGRATE_DEFAULT_TOLERANCE 1e-5    // Largest error per step LATTICE_INTEGRATE_ADAPTIVE allows, as a charge, until it is set.
+#define INTEGRATE_MAX_STEPS 256             // Most steps LATTICE_INTEGRATE_ADAPTIVE takes in a tick.
+#define INTEGRATE_SAFETY 0.9                // How far inside the tolerance the next step is aimed, as a fraction of it.
+#define INTEGRATE_MIN_SCALE 0.2             // Most a step may shrink by after the one before it.
+#define INTEGRATE_MAX_SCALE 5.0             // Most a step may grow by after the one before it.
+
+/// <summary>
+/// advances the integrators of the lattice by dt with its LATTICE_INTEGRATE method, leaving every cell evaluated from their new
+/// charges. Called after operate_tasks has brought the rest of the lattice up to date with the inputs.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="dt"></param>
+/// <param name="active">Set if there is anything to integrate.</param>
+/// <param name="cells">Added to by the cells evaluated.</param>
+/// <param name="lines">Added to by the lines read by those cells.</param>
+/// <returns>The LATTICE_STATE flags raised.</returns>
+int integrate(LatticeHandle lattice, double dt, bool* active, long long* cells, long long* lines);
+
+// Counters of a region set with SIMU_Stats_Region. Added to by whichever thread runs a task with cells in the region.
+typedef struct region_counters {
+    int x, y, z, width, height, depth;      // width is 0 while the region is unset
+    std::atomic<long long> cellsEvaluated;
+    std::atomic<long long> flaggedTicks;
+    std::atomic<long long> lastFlagged;     // the last tick counted in flaggedTicks, so a tick is counted once however many tasks flag
+    std::atomic<int> flags;
+} region_counters;
+
+// The counters behind SIMU_Get_Stats, laid out as lattice_stats. Only the thread running a tick adds to them, once per tick and with
+// relaxed atomics, so reading them never holds up the simulation.
+typedef struct stats_counters {
+    std::atomic<long long> ticks;
+    std::atomic<long long> activeTicks;
+    std::atomic<long long> cellsEvaluated;
+    std::atomic<long long> lastTickCells;
+    std::atomic<long long> connectionsTraversed;
+    std::atomic<long long> tickNanos;
+    std::atomic<long long> maxTickNanos;
+    std::atomic<long long> tickHistogram[LATTICE_STATS_BUCKETS];
+    std::atomic<long long> flagTicks[LATTICE_STATS_FLAGS];
+    std::atomic<int> flags;
+    std::atomic<long long> pacedTicks;
+    std::atomic<long long> missedTicks;
+    std::atomic<long long> jitterNanos;
+    std::atomic<long long> maxJitterNanos;
+    std::atomic<long long> jitterHistogram[LATTICE_STATS_BUCKETS];
+    std::atomic<long long> integrationSteps;
+    std::atomic<long long> rejectedSteps;
+    region_counters regions[LATTICE_STATS_REGIONS];
+} stats_counters;
+
+/// <summary>
+/// adds a tick to the counters of the lattice
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="nanos">The wall time of the tick.</param>
+/// <param name="flags">The LATTICE_STATE flags it raised.</param>
+/// <param name="cells">The cells it evaluated.</param>
+/// <param name="lines">The lines read by those cells.</param>
+void record_tick(LatticeHandle lattice, long long nanos, int flags, long long cells, long long lines);
+/// <summary>
+/// adds a paced tick to the counters of the lattice
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="late">How long after it was due the tick started.</param>
+/// <param name="missed">The ticks of the schedule skipped because the last tick overran them.</param>
+void record_pacing(LatticeHandle lattice, long long late, long long missed);
+/// <summary>
+/// adds the integration steps of a tick to the counters of the lattice
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="steps">The steps taken.</param>
+/// <param name="rejected">The steps taken again for missing the tolerance.</param>
+void record_integration(LatticeHandle lattice, long long steps, long long rejected);
+/// <summary>
+/// adds a task that has just run to the counters of the regions it has cells in. Only called for tasks with a region.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="index"></param>
+/// <param name="flags">The LATTICE_STATE flags the task raised.</param>
+void record_regions(LatticeHandle lattice, int index, int flags);
+/// <summary>
+/// works out the regions each task has cells in, and how many. Must be called with the program lock held.
+/// </summary>
+/// <param name="lattice"></param>
+void compile_regions(LatticeHandle lattice);
+
+// Subscriptions to the output plane (see notify.cpp).
+#define NOTIFY_MAX_QUEUED 65536         // Events kept for Lattice_Wait_Events before the oldest are dropped.
+
+// A box of the output plane watched for a LATTICE_TRIGGER. Each cell keeps the charge its trigger is measured from: its charge
+// last tick for LATTICE_TRIGGER_CROSS, when it was last notified for LATTICE_TRIGGER_CHANGE, and where it came to rest for
+// LATTICE_TRIGGER_SETTLE, along with the ticks it has kept within level of it.
+typedef struct subscription {
+    int id;
+    int y, z, height, depth;
+    int trigger;
+    double level;
+    int ticks;
+    lattice_callback callback;
+    void* context;
+    bool primed;                        // set once the first tick has filled reference
+    std::vector<CELL_TYPE> reference;   // per cell, {y + i, z + j} at [j * height + i]
+    std::vector<int> settled;
+} subscription;
+
+/// <summary>
+/// checks every subscription against the output plane just published, and queues the events raised. Called at the end of a tick
+/// with the program lock held.
+/// </summary>
+/// <param name="lattice"></param>
+void check_subscriptions(LatticeHandle lattice);
+/// <summary>
+/// calls the callbacks of the events queued by check_subscriptions, one call per subscription. Called after ticks, without the
+/// program lock, so callbacks may write to the lattice.
+/// </summary>
+/// <param name="lattice"></param>
+void deliver_events(LatticeHandle lattice);
+/// <summary>
+/// has every subscription take the next output plane as the charges it is measured from, raising nothing for it. Called with the
+/// program lock held once the outputs have jumped, as when a checkpoint is restored.
+/// </summary>
+/// <param name="lattice"></param>
+void prime_subscriptions(LatticeHandle lattice);
+
+// The portable thread layer (see thread.cpp): what the simulation thread needs from the platform, and the pacing of its ticks.
+#define PACE_MIN_SPIN_NANOS 5000        // Least time left to spin before a paced tick, on top of twice how late sleeps usually wake.
+#define PACE_START_OVERSLEEP_NANOS 20000 // How late sleeps are taken to wake before the first few show it.
+
+// The schedule of a paced simulation thread. Ticks are due every period from when the schedule started, so the rate does not
+// drift with the time each tick takes.
+typedef struct pace_state {
+    long long period;                                   // nanoseconds between ticks, 0 while running freely
+    std::chrono::steady_clock::time_point deadline;     // when the last tick was due
+    long long oversleep;                                // nanoseconds sleeps usually wake late, as a moving average
+    bool restart;                                       // start the schedule again at the next tick, as after sleeping for work
+} pace_state;
+
+/// <summary>
+/// returns the handle of the calling thread, for set_thread_affinity and set_thread_realtime
+/// </summary>
+std::thread::native_handle_type current_thread();
+/// <summary>
+/// restricts a thread to one CPU, or lets it run on any if cpu is -1
+/// </summary>
+/// <returns>false if the CPU does not exist or the platform refused.</returns>
+bool set_thread_affinity(std::thread::native_handle_type thread, int cpu);
+/// <summary>
+/// runs a thread under the realtime scheduler (SCHED_FIFO on Linux, time critical priority on Windows), or back under the normal one
+/// </summary>
+/// <returns>false if the platform refused, as Linux does without CAP_SYS_NICE.</returns>
+bool set_thread_realtime(std::thread::native_handle_type thread, bool realtime);
+/// <summary>
+/// readies the calling thread for precise sleeps. Called once by the simulation thread as it starts.
+/// </summary>
+void prepare_timing_thread();
+/// <summary>
+/// waits for the next tick of a paced lattice, recording how late it starts. Returns at once if the schedule is restarting.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="pace"></param>
+void pace_tick(LatticeHandle lattice, pace_state* pace);
+
+// Threads that help the sim thread evaluate the large levels of a tick. Participant 0 is the sim thread itself.
+typedef struct worker_pool {
+    std::vector<std::thread> workers;
+    task_queue* queues;
+    int participants;
+
+    // Work of the current level, fixed while it runs: the queues hold positions in tasks, which holds task indices.
+    LatticeHandle lattice;
+    const int* tasks;
+    double dt;
+    bool noise;
+
+    std::atomic<unsigned> epoch;
+    std::atomic<int> completed;
+    std::atomic<int> flags;
+    std::atomic<long long> busy;
+    std::atomic<bool> stopping;
+    std::atomic<int> sleeping;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+
+    worker_pool();
+    ~worker_pool();
+
+    /// <summary>
+    /// sets the number of participants, starting or stopping workers. Must not be called while a level runs.
+    /// </summary>
+    void resize(int threads);
+    /// <summary>
+    /// evaluates tasks [first, last) across all participants and returns their LATTICE_STATE flags once every task is done
+    /// </summary>
+    int run(int first, int last);
+    /// <summary>
+    /// takes the busy time accumulated by all participants since the last call, in nanoseconds
+    /// </summary>
+    long long take_busy();
+
+    void work(int participant);
+    void worker_main(int participant);
+} worker_pool;
+
+// A simulated lattice and everything needed to run it. Each instance owns its storage, program and simulation thread,
+// so any number of them can run side by side; a LatticeHandle points to one.
+typedef struct lattice {
+    // Cell storage, one entry per stored cell in each array. Lines are stored on the positive axes only (see OPTIM_CONNECTIONS),
+    // and coordinates are derived from the index with get_coords rather than stored.
+    CELL_TYPE* charges;
+    char* cores;
+    char* links[CONNECTION_COUNT];
+    CELL_TYPE* modifiers[CONNECTION_COUNT];
+
+    // The input and output layers as contiguous planes, {Y, Z} at [Z * yMax + Y]. Inputs are copied into the lattice at the
+    // start of each tick and outputs out of it at the end, so plane I/O is a straight copy.
+    CELL_TYPE* inputs;
+    // The outputs of tick n are published in outputs[n & 1] (see store_outputs), so readers have a whole tick to copy
+    // a plane before it is rewritten. publishing is raised before a plane is written, and tick once it is complete.
+    CELL_TYPE* outputs[2];
+    std::atomic<long long> tick;
+    std::atomic<long long> publishing;
+    // tick counts every tick run, so the planes stay in step however the lattice is restored. The tick counter reported is
+    // tick - tickOffset, which SIMU_Lattice_Restore moves to wind it back, and each plane keeps the count it was published at.
+    long long tickOffset;
+    long long outputTicks[2];
+
+    double timestep;    // simulated seconds per tick in LATTICE_RUN_STEPPED mode
+    double timeFactor;  // simulated seconds per wall second in LATTICE_RUN_THREADED mode
+    double tickTime;    // wall time of the last tick, or between the last two when paced, behind SIMU_Poll_Rate
+
+    // Pacing and placement of the simulation thread, read by it as it starts and, for the period, before each tick.
+    std::atomic<long long> tickPeriod;  // nanoseconds between ticks set by SIMU_Tick_Rate, 0 to run freely
+    int threadCpu;                      // CPU the thread is pinned to, or -1
+    bool threadRealtime;
+    int MAX, xMax, yMax, zMax, XYMax;  // MAX is the number of cells the storage arrays hold
+
+    // The LATTICE_STORAGE layout, used by get_mem_pos and get_coords. With LATTICE_STORAGE_PADDED, X and Y are rounded up to
+    // 1 << xShift and 1 << yShift. With LATTICE_STORAGE_TILED and LATTICE_STORAGE_SPARSE, cells are stored in bricks of
+    // BRICK_CELLS numbered like cells but in bricks, each occupying cells [slot * BRICK_CELLS, (slot + 1) * BRICK_CELLS).
+    // Tiled bricks are stored in order. Sparse bricks are allocated on first programming and stored at slot brickTable[b]
+    // (-1 if unallocated), with brickIds mapping slots back to bricks.
+    int storage;
+    int xShift, yShift;
+    int bricksX, bricksY;
+    std::vector<int> brickTable;
+    std::vector<int> brickIds;
+
+    int connectionDelta[ALL_CONNECTIONS];
+
+    int noiseProfile;   // LATTICE_NOISE_MODE flags
+
+    // Noise state (see noise.cpp). Heat is kept per line, laid out as batchSources. Inductive noise is worked out per slot of
+    // batchCells from the positions of its neighbours (ALL_CONNECTIONS per slot, -1 where there is none) and the sum of their
+    // charges at the start of the last tick.
+    std::vector<float> lineHeat;
+    std::vector<int> neighbourCells;
+    std::vector<float> flux;
+    std::vector<float> induction;
+
+    std::atomic<int> isIntegrating;
+
+    // Integration (see integrate.cpp). The state holds (2 + INTEGRATE_STAGES) values for each integrator of the schedule.
+    int integrationMethod;              // LATTICE_INTEGRATE method
+    double integrationTolerance;        // set by SIMU_Integration_Tolerance
+    double integrationStep;             // the step LATTICE_INTEGRATE_ADAPTIVE tries first next tick, or 0 to try the whole tick
+    std::vector<double> integrationState;
+
+    CELL_TYPE underbusCharge;
+
+    int mode;
+    std::atomic<int> running;
+    std::thread thread;
+    std::vector<int> integrators;
+    std::vector<int> integratorIndex;   // position of each cell in integrators, or -1, so one is removed in constant time
+    std::vector<int> endpoints;
+
+    // Programming calls made between Lattice_Program_Begin and Lattice_Program_Commit, applied together at commit.
+    std::mutex stageLock;
+    bool staging;
+    std::vector<staged_edit> staged;
+
+    // Compiled schedule: reachable cells in evaluation order, with the incoming edges of
+    // instruction i stored at edges[edgeOffsets[i] .. edgeOffsets[i + 1]).
+    std::vector<instruction> schedule;
+    std::vector<int> edgeOffsets;
+    std::vector<edge> edges;
+    std::atomic<bool> dirty;
+    // Identifies the program for SIMU_Lattice_Restore: given out by the first checkpoint of a program, and 0 again once it is changed.
+    long long programVersion;
+    std::mutex programLock;
+    std::atomic<int> programWaiting;
+
+    // The schedule grouped into batches by level, core and line pattern (see compile_batches), and the kernels of the selected SIMD level.
+    std::vector<batch> batches;
+    std::vector<int> batchCells;
+    std::vector<int> batchSources;
+    std::vector<CELL_TYPE> batchModifiers;
+    std::vector<CELL_TYPE> batchNoise;
+    std::vector<int> residuals;         // of each integrator, in the order of the batches, with CELL_TYPE_USE_FIXED_POINT
+    kernel_select kernels;
+    const lane_kernel* laneKernels;
+    noise_generator random;
+    int simdLevel;
+
+    // Levels of the schedule split into tasks for the worker pool: the tasks of level L are
+    // tasks[levelTasks[L] .. levelTasks[L + 1]).
+    worker_pool pool;
+    std::vector<task> tasks;
+    std::vector<int> levelTasks;
+    std::vector<int> levelCells;
+
+    // Incremental evaluation: a task runs when it is marked dirty, and every tick if it integrates while integration is on.
+    // When a cell changes, the tasks that read it are marked through consumers[consumerOffsets[slot] .. consumerOffsets[slot + 1]),
+    // where slot is the cell's position in batchCells.
+    std::atomic<unsigned char>* taskDirty;
+    std::vector<int> consumerOffsets;
+    std::vector<int> consumers;
+    std::vector<int> inputSlots;        // slot of each cell of the input plane, or -1 if nothing reads it
+    std::vector<int> inputCells;        // position in memory of each cell of the input plane, or -1 if it is not stored
+    std::vector<int> outputCells;       // as inputCells, for the output plane
+    std::vector<int> sourceSlots;       // slot of each entry of batchSources, for Lattice_Evaluate_Batch
+    std::vector<int> outputSlots;       // slot of each cell of the output plane, or -1 if it is not scheduled
+    std::vector<int> pending;           // tasks of the current level that need to run
+    int liveTasks;                      // tasks that integrate
+    std::atomic<bool> inputsDirty;
+
+    // Once a tick finds nothing to do, the simulation thread sleeps on idleWake until the lattice is written or reprogrammed.
+    std::atomic<bool> idle;
+    std::mutex idleLock;
+    std::condition_variable idleWake;
+
+    // Totals behind SIMU_Thread_Scaling since it was last called.
+    std::atomic<long long> cellsTotal;
+    std::atomic<long long> cellsParallel;
+    std::atomic<long long> parallelNanos;
+
+    // Subscriptions, checked at the end of each tick while watching is set. Events with a callback are held in notified until
+    // deliver_events, which runs under deliverLock so Lattice_Unsubscribe can wait out a delivery; the rest queue in events.
+    std::mutex notifyLock;
+    std::recursive_mutex deliverLock;
+    std::condition_variable eventWake;
+    std::vector<subscription> subscriptions;
+    std::vector<lattice_event> notified;
+    std::deque<lattice_event> events;
+    int nextSubscription;
+    std::atomic<bool> watching;
+
+    // Counters behind SIMU_Get_Stats. While any region is set, taskRegions holds a mask of the regions each task has cells in,
+    // and taskRegionCells how many, LATTICE_STATS_REGIONS per task; both are empty otherwise.
+    stats_counters stats;
+    std::vector<unsigned char> taskRegions;
+    std::vector<int> taskRegionCells;
+
+    // The slab of a domain this lattice holds (see domain.cpp), or domainCount 0 outside one. It owns the cells [domainBegin,
+    // domainEnd) along domainAxis, and stores as well the halo of cells just beyond each face it shares with a neighbour, which hold
+    // the charges sent by the neighbour. Per face, lower then upper, faceCells are the cells sent and haloCells those received, in
+    // the order of get_face_coords, -1 where unallocated.
+    int domainAxis;
+    int domainRank, domainCount;
+    int domainBegin, domainEnd;
+    lattice_transport transport;
+    std::vector<int> faceCells[2];
+    std::vector<int> haloCells[2];
+    std::vector<int> haloSlots[2];
+    std::vector<char> haloMessage;
+} lattice;
+
+/// <summary>
+/// wakes the simulation thread if it is sleeping for want of work. Called after anything it waits on has changed.
+/// </summary>
+/// <param name="lattice"></param>
+void wake_lattice(LatticeHandle lattice);
+
+// Taken by calls that change the program. The caller announces itself before locking so the sim thread steps aside between
+// ticks rather than immediately re-taking the lock.
+typedef struct program_guard {
+    LatticeHandle lattice;
+
+    program_guard(LatticeHandle l) {
+        lattice = l;
+        lattice->programWaiting++;
+        lattice->programLock.lock();
+        lattice->programWaiting--;
+    }
+    ~program_guard() {
+        lattice->programLock.unlock();
+        wake_lattice(lattice);
+    }
+} program_guard;
+
+/// <summary>
+/// creates a lattice as SIMU_Lattice_Init does, but in LATTICE_RUN_STEPPED mode, so nothing ticks it until it is ready
+/// </summary>
+/// <returns>An integer corresponding to the LATTICE_STATE values.</returns>
+int create_lattice(LatticeHandle* handle, int X, int Y, int Z, int noise, double ts, int storage);
+/// <summary>
+/// reallocates the cell storage to hold the given number of cells, keeping what is stored. Must be called with the program lock held.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="cells"></param>
+void resize_storage(LatticeHandle lattice, int cells);
+/// <summary>
+/// points each batch into batchCells, batchSources and batchModifiers, which hold the cells and lines of every batch in turn, and
+/// selects its kernel
+/// </summary>
+/// <param name="lattice"></param>
+void link_batches(LatticeHandle lattice);
+/// <summary>
+/// splits each level of the batches into tasks of at most POOL_TASK_CELLS cells for the worker pool
+/// </summary>
+/// <param name="lattice"></param>
+void compile_tasks(LatticeHandle lattice);
+/// <summary>
+/// works out the slots of the input and output layers and of every line, counts the tasks that integrate, and marks every task
+/// dirty so the new program is evaluated in full
+/// </summary>
+/// <param name="lattice"></param>
+void compile_slots(LatticeHandle lattice);
+/// <summary>
+/// recompiles the program if it has changed. Must be called with the program lock held.
+/// </summary>
+/// <param name="lattice"></param>
+/// <returns>true if it was recompiled.</returns>
+bool compile_program(LatticeHandle lattice);
+/// <summary>
+/// publishes the output layer of the lattice as the outputs of the next tick. Written as a seqlock over the two output planes:
+/// the plane being written was last published two ticks ago, and readers of it see publishing move past that tick.
+/// </summary>
+/// <param name="lattice"></param>
+void store_outputs(LatticeHandle lattice);
+
+// Domains (see domain.cpp): a lattice split into slabs across processes, which swap the charges at their faces every tick.
+#define DOMAIN_SPIN_NANOS 200000        // Time a transport spins waiting on a neighbour before it sleeps between checks.
+#define DOMAIN_SLEEP_NANOS 20000
+#define DOMAIN_CONNECT_MILLIS 30000     // Time SIMU_Transport_Shared waits for rank 0 to create the shared memory.
+#define DOMAIN_CHANNEL_MESSAGES 4       // Largest messages each channel of SIMU_Transport_Shared holds.
+
+/// <summary>
+/// returns true if the cell lies in the slab of the lattice, or the lattice is not part of a domain
+/// </summary>
+bool get_owned(LatticeHandle lattice, int x, int y, int z);
+/// <summary>
+/// returns true if the cell lies on a face the slab of the lattice shares with a neighbour
+/// </summary>
+bool get_on_face(LatticeHandle lattice, int x, int y, int z);
+/// <summary>
+/// returns true if the line programmed at a cell flows into a cell the lattice owns. Lines into other slabs are left to them.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="x"></param>
+/// <param name="y"></param>
+/// <param name="z"></param>
+/// <param name="code">The LATTICE_PROG_CONNECT code of the line.</param>
+bool get_line_owned(LatticeHandle lattice, int x, int y, int z, int code);
+/// <summary>
+/// works out the cells of each face and halo of the slab, and the slots of the halo. Called by compile_slots.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="slots">The slot of each stored cell, or -1.</param>
+void compile_halo(LatticeHandle lattice, const int* slots);
+/// <summary>
+/// sends the faces of the slab to its neighbours and copies theirs into the halo, marking the readers of any cell that changed. Called
+/// at the start of a tick with the program lock held, so the tick reads the halo as the neighbours' last tick left it.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="active">Set if any cell of the halo changed.</param>
+/// <returns>LATTICE_STATE_ERR_NO_PEER if a neighbour could not be reached or sent the faces of another tick.</returns>
+int exchange_halo(LatticeHandle lattice, bool* active);
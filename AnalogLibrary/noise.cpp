@@ -0,0 +1,169 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    The LATTICE_NOISE_MODE models. Before a task is evaluated, the noise each of its lines carries this tick is written to
+    batchNoise, and its kernel adds it to the charge read through the line. Random noise is drawn from a counter based generator
+    keyed on the tick and the line, so a lattice runs the same whatever the thread count or SIMD level.
+*/
+#include "pch.h"
+#include "lattice.h"
+#include <algorithm>
+#include <cmath>
+
+/// <summary>
+/// returns a random value in [-1, 1) for the given counter, using the Philox-2x32 generator. Each round is a multiply and xors
+/// of the counter alone, so the SIMD generators compute lanes of consecutive counters side by side.
+/// </summary>
+/// <param name="line"></param>
+/// <param name="tick"></param>
+/// <returns></returns>
+static inline float philox_uniform(unsigned line, unsigned tick) {
+    unsigned c0 = line, c1 = tick, key = NOISE_SEED;
+    for (int r = 0; r < PHILOX_ROUNDS; r++) {
+        unsigned long long product = (unsigned long long)PHILOX_MULTIPLIER * c0;
+        c0 = (unsigned)(product >> 32) ^ key ^ c1;
+        c1 = (unsigned)product;
+        key += PHILOX_WEYL;
+    }
+    return (float)(int)c0 * PHILOX_SCALE;
+}
+
+void generate_noise_scalar(float* values, unsigned first, int n, unsigned tick) {
+    for (int i = 0; i < n; i++)
+        values[i] = philox_uniform(first + i, tick);
+}
+
+noise_generator get_noise_generator(int level) {
+    if (level < LATTICE_SIMD_NONE || level > detect_simd_level()) return 0;
+    switch (level) {
+    case LATTICE_SIMD_AVX512: return noise_avx512();
+    case LATTICE_SIMD_AVX2: return noise_avx2();
+    }
+    return generate_noise_scalar;
+}
+
+/// <summary>
+/// converts a charge to a fraction of a full charge
+/// </summary>
+static inline float noise_value(CELL_TYPE charge) {
+    return (float)charge / CELL_ONE;
+}
+/// <summary>
+/// converts a fraction of a full charge to a charge
+/// </summary>
+static inline CELL_TYPE noise_charge(float value) {
+#ifdef CELL_TYPE_USE_FIXED_POINT
+    float scaled = std::max(std::min(value * CELL_ONE, (float)CELL_MAX), (float)CELL_MIN);
+    return (CELL_TYPE)std::lrint(scaled);
+#else
+    return value;
+#endif
+}
+
+void compile_noise(LatticeHandle lattice) {
+    int mode = lattice->noiseProfile;
+    int slots = (int)lattice->batchCells.size();
+    if (!mode) {
+        std::vector<CELL_TYPE>().swap(lattice->batchNoise);
+        std::vector<float>().swap(lattice->lineHeat);
+        std::vector<int>().swap(lattice->neighbourCells);
+        std::vector<float>().swap(lattice->flux);
+        std::vector<float>().swap(lattice->induction);
+        return;
+    }
+
+    lattice->batchNoise.assign(lattice->batchSources.size(), 0);
+    lattice->lineHeat.assign(mode & LATTICE_NOISE_MODE_HEAT_RESISTIVE ? lattice->batchSources.size() : 0, 0);
+    for (int b = 0; b < lattice->batches.size(); b++) {
+        batch* work = &lattice->batches[b];
+        work->noise = lattice->batchNoise.data() + (work->sources - lattice->batchSources.data());
+    }
+
+    if (!(mode & LATTICE_NOISE_MODE_INDUCTIVE)) {
+        lattice->neighbourCells.clear();
+        lattice->flux.clear();
+        lattice->induction.clear();
+        return;
+    }
+    lattice->neighbourCells.resize((size_t)slots * ALL_CONNECTIONS);
+    for (int s = 0; s < slots; s++) {
+        for (int i = 0; i < ALL_CONNECTIONS; i++)
+            lattice->neighbourCells[s * ALL_CONNECTIONS + i] = get_neighbour(lattice, lattice->batchCells[s], i);
+    }
+    lattice->flux.resize(slots);
+    lattice->induction.resize(slots);
+    induce_noise(lattice); // starts the flux from the charges as they are, inducing nothing on the first tick
+    std::fill(lattice->induction.begin(), lattice->induction.end(), 0.0f);
+}
+
+void induce_noise(LatticeHandle lattice) {
+    const CELL_TYPE* charges = lattice->charges;
+    const int* neighbours = lattice->neighbourCells.data();
+    float* flux = lattice->flux.data();
+    float* induction = lattice->induction.data();
+    int slots = (int)lattice->batchCells.size();
+
+    // A stencil over the six neighbours of each cell.
+    for (int s = 0; s < slots; s++) {
+        float sum = 0;
+        for (int i = 0; i < ALL_CONNECTIONS; i++) {
+            int n = neighbours[s * ALL_CONNECTIONS + i];
+            if (n >= 0) sum += noise_value(charges[n]);
+        }
+        induction[s] = NOISE_INDUCTANCE * (sum - flux[s]);
+        flux[s] = sum;
+    }
+}
+
+/// <summary>
+/// writes the noise of lines [begin, end) of each input of a batch, for one combination of LATTICE_NOISE_MODE flags
+/// </summary>
+template <int MODE>
+static void fill_noise(LatticeHandle lattice, const batch* work, int begin, int end) {
+    const CELL_TYPE* charges = lattice->charges;
+    int offset = (int)(work->sources - lattice->batchSources.data());
+    int slot = (int)(work->cells - lattice->batchCells.data());
+    CELL_TYPE* noise = lattice->batchNoise.data() + offset;
+    float* heat = (MODE & LATTICE_NOISE_MODE_HEAT_RESISTIVE) ? lattice->lineHeat.data() + offset : 0;
+    const float* induction = (MODE & LATTICE_NOISE_MODE_INDUCTIVE) ? lattice->induction.data() + slot : 0;
+    unsigned tick = (unsigned)(lattice->tick.load(std::memory_order_relaxed) - lattice->tickOffset);
+    float random[POOL_TASK_CELLS];
+
+    for (int k = 0; k < work->inputs; k++) {
+        int first = k * work->count + begin;
+        // The random noise of a line is keyed on its position in batchSources, so the lines of a task take consecutive counters.
+        if (MODE & LATTICE_NOISE_MODE_RANDOM) lattice->random(random, (unsigned)(offset + first), end - begin, tick);
+        for (int i = begin; i < end; i++) {
+            int line = k * work->count + i;
+            float value = 0;
+            if (MODE & LATTICE_NOISE_MODE_RANDOM)
+                value += NOISE_RANDOM_LEVEL * random[i - begin];
+            if (MODE & LATTICE_NOISE_MODE_INDUCTIVE)
+                value += induction[i];
+            if (MODE & LATTICE_NOISE_MODE_RESISTIVE) {
+                float charge = noise_value(charges[work->sources[line]]);
+                float resistance = NOISE_RESISTANCE;
+                // Heat raises the resistance of a line, and the power it then dissipates heats it further.
+                if (MODE & LATTICE_NOISE_MODE_HEAT_RESISTIVE) {
+                    resistance *= 1 + NOISE_HEAT_RESISTANCE * heat[line];
+                    heat[line] = heat[line] * (1 - NOISE_COOLING) + NOISE_HEATING * resistance * charge * charge;
+                }
+                value -= resistance * charge;
+            }
+            noise[line] = noise_charge(value);
+        }
+    }
+}
+
+typedef void (*noise_fill)(LatticeHandle lattice, const batch* work, int begin, int end);
+
+// fill_noise for each combination of modes. Modes 8 to 11 never occur, as heat is dropped without resistive noise (see get_noise_mode).
+static const noise_fill noiseFills[LATTICE_NOISE_MODE_MASK + 1] = {
+    fill_noise<0>, fill_noise<1>, fill_noise<2>, fill_noise<3>, fill_noise<4>, fill_noise<5>, fill_noise<6>, fill_noise<7>,
+    fill_noise<0>, fill_noise<1>, fill_noise<2>, fill_noise<3>, fill_noise<12>, fill_noise<13>, fill_noise<14>, fill_noise<15> };
+
+void apply_noise(LatticeHandle lattice, int index) {
+    const task* job = &lattice->tasks[index];
+    noiseFills[lattice->noiseProfile & LATTICE_NOISE_MODE_MASK](lattice, &lattice->batches[job->batch], job->begin, job->end);
+}
@@ -0,0 +1,190 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    Subscriptions to the output layer, so controllers are told of changes rather than polling Lattice_Read for them. Each tick
+    checks only the cells subscribed to, against the output plane it has just published. Events for callbacks are held until the
+    tick has released the program lock and then handed over a subscription at a time; the rest are queued for Lattice_Wait_Events.
+*/
+#include "pch.h"
+#include "lattice.h"
+#include <algorithm>
+#include <cmath>
+
+/// <summary>
+/// returns the position of a subscription in the subscriptions of the lattice, or -1. Must be called with the notify lock held.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="id"></param>
+/// <returns></returns>
+static int find_subscription(LatticeHandle lattice, int id) {
+    for (int s = 0; s < lattice->subscriptions.size(); s++) {
+        if (lattice->subscriptions[s].id == id) return s;
+    }
+    return -1;
+}
+
+/// <summary>
+/// returns true if a cell of a subscription meets its trigger with the given charge, moving the charge it is measured from on
+/// </summary>
+/// <param name="watch"></param>
+/// <param name="cell">The cell, as an index into the reference of the subscription.</param>
+/// <param name="value"></param>
+/// <returns></returns>
+static bool meets_trigger(subscription* watch, int cell, CELL_TYPE value) {
+    double last = watch->reference[cell];
+    switch (watch->trigger) {
+    case LATTICE_TRIGGER_CROSS:
+        watch->reference[cell] = value;
+        return (last >= watch->level) != ((double)value >= watch->level);
+    case LATTICE_TRIGGER_CHANGE:
+        if (std::abs(value - last) <= watch->level) return false;
+        watch->reference[cell] = value;
+        return true;
+    default:
+        if (std::abs(value - last) > watch->level) {
+            watch->reference[cell] = value;
+            watch->settled[cell] = 0;
+            return false;
+        }
+        // Raised once as the cell settles, and again only after it has moved.
+        if (watch->settled[cell] >= watch->ticks) return false;
+        return ++watch->settled[cell] == watch->ticks;
+    }
+}
+
+void check_subscriptions(LatticeHandle lattice) {
+    long long frame = lattice->tick.load(std::memory_order_relaxed);
+    const CELL_TYPE* plane = lattice->outputs[frame & 1];
+    long long tick = lattice->outputTicks[frame & 1];
+    bool queued = false;
+    std::lock_guard<std::mutex> lock(lattice->notifyLock);
+    for (int s = 0; s < lattice->subscriptions.size(); s++) {
+        subscription* watch = &lattice->subscriptions[s];
+        for (int j = 0; j < watch->depth; j++) {
+            const CELL_TYPE* row = &plane[(size_t)(watch->z + j) * lattice->yMax + watch->y];
+            for (int i = 0; i < watch->height; i++) {
+                int cell = j * watch->height + i;
+                if (!watch->primed) {
+                    watch->reference[cell] = row[i];
+                    continue;
+                }
+                if (!meets_trigger(watch, cell, row[i])) continue;
+
+                lattice_event event = { watch->id, watch->y + i, watch->z + j, watch->trigger, row[i], tick };
+                if (watch->callback) lattice->notified.push_back(event);
+                else {
+                    if (lattice->events.size() >= NOTIFY_MAX_QUEUED) lattice->events.pop_front();
+                    lattice->events.push_back(event);
+                    queued = true;
+                }
+            }
+        }
+        watch->primed = true;
+    }
+    if (queued) lattice->eventWake.notify_all();
+}
+
+void deliver_events(LatticeHandle lattice) {
+    if (!lattice->watching.load(std::memory_order_relaxed)) return;
+    std::lock_guard<std::recursive_mutex> delivery(lattice->deliverLock);
+    std::vector<lattice_event> batch;
+    {
+        std::lock_guard<std::mutex> lock(lattice->notifyLock);
+        if (lattice->notified.empty()) return;
+        batch.swap(lattice->notified);
+    }
+
+    // Events are queued tick by tick, so after several ticks those of one subscription are gathered up, still in tick order.
+    std::stable_sort(batch.begin(), batch.end(), [](const lattice_event& a, const lattice_event& b) {
+        return a.subscription < b.subscription;
+    });
+    for (size_t first = 0, last; first < batch.size(); first = last) {
+        for (last = first + 1; last < batch.size() && batch[last].subscription == batch[first].subscription; last++);
+        lattice_callback callback = NULL;
+        void* context = NULL;
+        {
+            // An earlier callback may have ended the subscription.
+            std::lock_guard<std::mutex> lock(lattice->notifyLock);
+            int s = find_subscription(lattice, batch[first].subscription);
+            if (s < 0) continue;
+            callback = lattice->subscriptions[s].callback;
+            context = lattice->subscriptions[s].context;
+        }
+        callback(context, &batch[first], (int)(last - first));
+    }
+
+    // Handing the buffer back saves the next tick allocating one.
+    batch.clear();
+    std::lock_guard<std::mutex> lock(lattice->notifyLock);
+    if (lattice->notified.empty()) lattice->notified.swap(batch);
+}
+
+void prime_subscriptions(LatticeHandle lattice) {
+    std::lock_guard<std::mutex> lock(lattice->notifyLock);
+    for (int s = 0; s < lattice->subscriptions.size(); s++) {
+        subscription* watch = &lattice->subscriptions[s];
+        watch->primed = false;
+        std::fill(watch->settled.begin(), watch->settled.end(), 0);
+    }
+}
+
+int Lattice_Subscribe(LatticeHandle lattice, int Y, int Z, int height, int depth, int trigger, CELL_TYPE level, int ticks, lattice_callback callback,
+    void* context, int* id) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (!id || height < 1 || depth < 1 || Y < 0 || Z < 0 || Y > lattice->yMax - height || Z > lattice->zMax - depth)
+        return LATTICE_STATE_ERR_BAD_CONFIG;
+    if (trigger < LATTICE_TRIGGER_CROSS || trigger > LATTICE_TRIGGER_SETTLE) return LATTICE_STATE_ERR_BAD_CONFIG;
+    if (trigger != LATTICE_TRIGGER_CROSS && level < 0) return LATTICE_STATE_ERR_BAD_CONFIG;
+    if (trigger == LATTICE_TRIGGER_SETTLE && ticks < 1) return LATTICE_STATE_ERR_BAD_CONFIG;
+
+    subscription watch = {};
+    watch.y = Y;
+    watch.z = Z;
+    watch.height = height;
+    watch.depth = depth;
+    watch.trigger = trigger;
+    watch.level = level;
+    watch.ticks = ticks;
+    watch.callback = callback;
+    watch.context = context;
+    watch.reference.resize((size_t)height * depth);
+    if (trigger == LATTICE_TRIGGER_SETTLE) watch.settled.resize((size_t)height * depth);
+
+    std::lock_guard<std::mutex> lock(lattice->notifyLock);
+    watch.id = ++lattice->nextSubscription;
+    lattice->subscriptions.push_back(std::move(watch));
+    lattice->watching = true;
+    *id = lattice->nextSubscription;
+    return LATTICE_STATE_OKAY;
+}
+
+int Lattice_Unsubscribe(LatticeHandle lattice, int id) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    // Taking the delivery lock waits out any callback running on another thread.
+    std::lock_guard<std::recursive_mutex> delivery(lattice->deliverLock);
+    std::lock_guard<std::mutex> lock(lattice->notifyLock);
+    int s = find_subscription(lattice, id);
+    if (s < 0) return LATTICE_STATE_ERR_BAD_CONFIG;
+    lattice->subscriptions.erase(lattice->subscriptions.begin() + s);
+    auto raised = [id](const lattice_event& event) { return event.subscription == id; };
+    lattice->notified.erase(std::remove_if(lattice->notified.begin(), lattice->notified.end(), raised), lattice->notified.end());
+    lattice->events.erase(std::remove_if(lattice->events.begin(), lattice->events.end(), raised), lattice->events.end());
+    lattice->watching = !lattice->subscriptions.empty();
+    return LATTICE_STATE_OKAY;
+}
+
+int Lattice_Wait_Events(LatticeHandle lattice, lattice_event* events, int capacity, int timeout, int* count) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (!events || !count || capacity < 1) return LATTICE_STATE_ERR_BAD_CONFIG;
+    std::unique_lock<std::mutex> lock(lattice->notifyLock);
+    auto queued = [lattice] { return !lattice->events.empty(); };
+    if (timeout < 0) lattice->eventWake.wait(lock, queued);
+    else lattice->eventWake.wait_for(lock, std::chrono::milliseconds(timeout), queued);
+
+    int taken = std::min(capacity, (int)lattice->events.size());
+    std::copy(lattice->events.begin(), lattice->events.begin() + taken, events);
+    lattice->events.erase(lattice->events.begin(), lattice->events.begin() + taken);
+    *count = taken;
+    return LATTICE_STATE_OKAY;
+}
@@ -0,0 +1,136 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    Worker pool used to evaluate the large levels of a tick in parallel.
+*/
+#include "pch.h"
+#include "lattice.h"
+#include <chrono>
+
+worker_pool::worker_pool() {
+    queues = new task_queue[1];
+    queues[0].range = 0;
+    participants = 1;
+    lattice = 0;
+    tasks = 0;
+    dt = 0;
+    noise = false;
+    epoch = 0;
+    completed = 0;
+    flags = 0;
+    busy = 0;
+    stopping = false;
+    sleeping = 0;
+}
+worker_pool::~worker_pool() {
+    resize(1);
+    delete[] queues;
+}
+
+void worker_pool::resize(int threads) {
+    if (threads < 1) threads = 1;
+    if (threads == participants) return;
+
+    {
+        std::lock_guard<std::mutex> lock(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (int i = 0; i < workers.size(); i++)
+        workers[i].join();
+    workers.clear();
+    stopping = false;
+
+    delete[] queues;
+    queues = new task_queue[threads];
+    for (int i = 0; i < threads; i++)
+        queues[i].range = 0;
+    participants = threads;
+    for (int i = 1; i < threads; i++)
+        workers.push_back(std::thread(&worker_pool::worker_main, this, i));
+}
+
+/// <summary>
+/// takes a task index from a queue, from the head if it is the caller's own queue or the tail if stealing
+/// </summary>
+/// <param name="queue"></param>
+/// <param name="steal"></param>
+/// <param name="index"></param>
+/// <returns>false once the queue is empty.</returns>
+static bool take_task(task_queue* queue, bool steal, int* index) {
+    unsigned long long range = queue->range.load(std::memory_order_acquire);
+    while (true) {
+        unsigned long long head = range & 0xffffffff, tail = range >> 32;
+        if (head >= tail) return false;
+        unsigned long long next = steal ? ((tail - 1) << 32) | head : (tail << 32) | (head + 1);
+        if (queue->range.compare_exchange_weak(range, next, std::memory_order_acq_rel)) {
+            *index = (int)(steal ? tail - 1 : head);
+            return true;
+        }
+    }
+}
+
+void worker_pool::work(int participant) {
+    auto start = std::chrono::steady_clock::now();
+    int index;
+    for (int victim = 0; victim < participants;) {
+        int queue = (participant + victim) % participants;
+        if (!take_task(&queues[queue], queue != participant, &index)) {
+            victim++;
+            continue;
+        }
+        int result = run_task(lattice, tasks[index], dt, noise);
+        if (result) flags.fetch_or(result, std::memory_order_relaxed);
+        completed.fetch_add(1, std::memory_order_release);
+    }
+    auto end = std::chrono::steady_clock::now();
+    busy += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+void worker_pool::worker_main(int participant) {
+    unsigned seen = epoch.load();
+    while (true) {
+        int spins = 0;
+        while (epoch.load() == seen && !stopping) {
+            if (++spins < POOL_SPIN) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepLock);
+            sleeping++;
+            wake.wait(lock, [&] { return epoch.load() != seen || stopping; });
+            sleeping--;
+            spins = 0;
+        }
+        if (stopping) return;
+        seen = epoch.load();
+        work(participant);
+    }
+}
+
+int worker_pool::run(int first, int last) {
+    int total = last - first;
+    completed.store(0, std::memory_order_relaxed);
+    flags.store(0, std::memory_order_relaxed);
+    for (int p = 0; p < participants; p++) {
+        unsigned long long head = first + (long long)total * p / participants;
+        unsigned long long tail = first + (long long)total * (p + 1) / participants;
+        queues[p].range.store((tail << 32) | head, std::memory_order_release);
+    }
+
+    epoch++;
+    if (sleeping) {
+        std::lock_guard<std::mutex> lock(sleepLock);
+        wake.notify_all();
+    }
+
+    work(0);
+    while (completed.load(std::memory_order_acquire) < total)
+        std::this_thread::yield();
+    return flags.load(std::memory_order_relaxed);
+}
+
+long long worker_pool::take_busy() {
+    return busy.exchange(0);
+}
@@ -0,0 +1,616 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    Program images: a lattice's program, charges and compiled schedule saved as they are held in memory, so loading one is a
+    handful of copies out of a mapped file rather than a Lattice_Program call per cell. Checkpoints hold the same image in memory
+    along with the state of the run, so a lattice can be wound back to one or another lattice forked from it without compiling.
+*/
+#include "pch.h"
+#include "lattice.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define PROGRAM_MAGIC 0x47504c41    // "ALPG"
+#define PROGRAM_VERSION 1
+#define PROGRAM_ALIGN 8             // Sections start on a multiple of this many bytes from the start of the image.
+
+// The start of a program image. The sections follow in the order SIMU_Lattice_Save writes them, each padded to PROGRAM_ALIGN: the
+// sparse bricks, charges, cores, links and modifiers of each stored axis, integrators and endpoints, then the compiled schedule as
+// batches, batchCells, batchSources, batchModifiers, consumerOffsets and consumers. The arrays are stored as the library holds them,
+// so an image only loads into a build with the same cell type. Batches are stored as image_batch records, holding only what the
+// schedule decided; link_batches works out the rest again on loading, so the same program always saves to the same image.
+typedef struct program_header {
+    int magic;
+    int version;
+    int cellSize;           // sizeof(CELL_TYPE)
+    int fixedPoint;         // 1 if built with CELL_TYPE_USE_FIXED_POINT
+    int connections;        // CONNECTION_COUNT
+    int X, Y, Z, storage;
+    int cells;              // cells stored of each array: MAX, or the allocated bricks with LATTICE_STORAGE_SPARSE
+    int bricks;
+    int integrators;
+    int endpoints;
+    int batches;
+    int slots;              // batchCells
+    int lines;              // batchSources and batchModifiers
+    int consumers;
+    CELL_TYPE underbus;
+} program_header;
+
+// A batch as stored in a program image.
+typedef struct image_batch {
+    int level;
+    int core;
+    int inputs;
+    int count;
+    char pattern[ALL_CONNECTIONS];  // of each input line, and 0 past them
+} image_batch;
+
+// A file mapped read only into memory.
+typedef struct mapped_file {
+    const char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} mapped_file;
+
+/// <summary>
+/// maps a whole file into memory
+/// </summary>
+/// <param name="map"></param>
+/// <param name="path"></param>
+/// <returns>false if the file cannot be opened or mapped, or is empty.</returns>
+static bool map_file(mapped_file* map, const char* path) {
+#ifdef _WIN32
+    map->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (map->file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(map->file, &size) || size.QuadPart == 0) {
+        CloseHandle(map->file);
+        return false;
+    }
+    map->size = (size_t)size.QuadPart;
+    map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    map->data = map->mapping ? (const char*)MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0) : 0;
+    if (!map->data) {
+        if (map->mapping) CloseHandle(map->mapping);
+        CloseHandle(map->file);
+        return false;
+    }
+    return true;
+#else
+    int file = open(path, O_RDONLY);
+    if (file < 0) return false;
+    struct stat info;
+    if (fstat(file, &info) || info.st_size == 0) {
+        close(file);
+        return false;
+    }
+    map->size = (size_t)info.st_size;
+    void* data = mmap(0, map->size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file); // the mapping keeps the file open
+    if (data == MAP_FAILED) return false;
+    map->data = (const char*)data;
+    return true;
+#endif
+}
+/// <summary>
+/// unmaps a file mapped by map_file
+/// </summary>
+/// <param name="map"></param>
+static void unmap_file(mapped_file* map) {
+#ifdef _WIN32
+    UnmapViewOfFile(map->data);
+    CloseHandle(map->mapping);
+    CloseHandle(map->file);
+#else
+    munmap((void*)map->data, map->size);
+#endif
+}
+
+/// <summary>
+/// returns the next section of an image, count elements of the given size, moving offset past it
+/// </summary>
+/// <param name="map"></param>
+/// <param name="offset"></param>
+/// <param name="count"></param>
+/// <param name="size"></param>
+/// <returns>0 if the section runs past the end of the image.</returns>
+static const void* read_section(const mapped_file* map, size_t* offset, int count, size_t size) {
+    size_t bytes = (size_t)count * size;
+    if (count < 0 || *offset > map->size || bytes > map->size - *offset) return 0;
+    const void* section = map->data + *offset;
+    *offset += (bytes + PROGRAM_ALIGN - 1) / PROGRAM_ALIGN * PROGRAM_ALIGN;
+    return section;
+}
+
+// The sections of a program image, found by read_image in a mapped file or a checkpoint.
+typedef struct program_image {
+    program_header header;
+    const int* brickIds;
+    const CELL_TYPE* charges;
+    const char* cores;
+    const char* links[CONNECTION_COUNT];
+    const CELL_TYPE* modifiers[CONNECTION_COUNT];
+    const int* integrators;
+    const int* endpoints;
+    const image_batch* batches;
+    const int* batchCells;
+    const int* batchSources;
+    const CELL_TYPE* batchModifiers;
+    const int* consumerOffsets;
+    const int* consumers;
+} program_image;
+
+// A lattice as SIMU_Lattice_Checkpoint found it: its program image held in memory, and the state of a run that is not part of
+// its program.
+struct lattice_checkpoint {
+    std::vector<char> data;
+    program_image image;                // sections of data
+    long long programVersion;
+    long long tick;                     // as reported by Lattice_Read_Tick
+    int noiseProfile;
+    double timestep;
+    int mode;
+    std::vector<CELL_TYPE> inputs;
+    std::vector<unsigned char> taskDirty;
+    std::vector<float> lineHeat;
+    std::vector<float> flux;
+    std::vector<int> residuals;
+    int isIntegrating;
+    int integrationMethod;
+    double integrationTolerance;
+    double integrationStep;
+};
+
+// Where write_section puts an image: a file for SIMU_Lattice_Save, memory for SIMU_Lattice_Checkpoint, or neither to measure it.
+typedef struct image_sink {
+    std::ofstream* file;
+    std::vector<char>* memory;
+    size_t size;        // bytes written so far
+} image_sink;
+
+/// <summary>
+/// writes a section of an image, padded to PROGRAM_ALIGN
+/// </summary>
+/// <param name="sink"></param>
+/// <param name="data"></param>
+/// <param name="count"></param>
+/// <param name="size"></param>
+static void write_section(image_sink* sink, const void* data, size_t count, size_t size) {
+    static const char padding[PROGRAM_ALIGN] = {};
+    size_t bytes = count * size;
+    size_t pad = (PROGRAM_ALIGN - bytes % PROGRAM_ALIGN) % PROGRAM_ALIGN;
+    if (sink->file) {
+        sink->file->write((const char*)data, bytes);
+        sink->file->write(padding, pad);
+    }
+    if (sink->memory && bytes) sink->memory->insert(sink->memory->end(), (const char*)data, (const char*)data + bytes);
+    if (sink->memory) sink->memory->insert(sink->memory->end(), padding, padding + pad);
+    sink->size += bytes + pad;
+}
+
+/// <summary>
+/// returns true if every entry of a list of cells lies in [0, cells)
+/// </summary>
+static bool get_cells_valid(const int* list, int count, int cells) {
+    for (int i = 0; i < count; i++) {
+        if (list[i] < 0 || list[i] >= cells) return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// writes the program image of a lattice. Must be called with the program lock held, on a compiled program.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="sink"></param>
+static void write_image(LatticeHandle lattice, image_sink* sink) {
+    program_header header = {};
+    header.magic = PROGRAM_MAGIC;
+    header.version = PROGRAM_VERSION;
+    header.cellSize = sizeof(CELL_TYPE);
+#ifdef CELL_TYPE_USE_FIXED_POINT
+    header.fixedPoint = 1;
+#endif
+    header.connections = CONNECTION_COUNT;
+    header.X = lattice->xMax;
+    header.Y = lattice->yMax;
+    header.Z = lattice->zMax;
+    header.storage = lattice->storage;
+    header.bricks = (int)lattice->brickIds.size();
+    header.cells = lattice->storage == LATTICE_STORAGE_SPARSE ? header.bricks * BRICK_CELLS : lattice->MAX;
+    header.integrators = (int)lattice->integrators.size();
+    header.endpoints = (int)lattice->endpoints.size();
+    header.batches = (int)lattice->batches.size();
+    header.slots = (int)lattice->batchCells.size();
+    header.lines = (int)lattice->batchSources.size();
+    header.consumers = (int)lattice->consumers.size();
+    header.underbus = lattice->underbusCharge;
+
+    write_section(sink, &header, 1, sizeof(header));
+    write_section(sink, lattice->brickIds.data(), header.bricks, sizeof(int));
+    write_section(sink, lattice->charges, header.cells, sizeof(CELL_TYPE));
+    write_section(sink, lattice->cores, header.cells, sizeof(char));
+    for (int i = 0; i < CONNECTION_COUNT; i++) {
+        write_section(sink, lattice->links[i], header.cells, sizeof(char));
+        write_section(sink, lattice->modifiers[i], header.cells, sizeof(CELL_TYPE));
+    }
+    write_section(sink, lattice->integrators.data(), header.integrators, sizeof(int));
+    write_section(sink, lattice->endpoints.data(), header.endpoints, sizeof(int));
+    // Value initialized, so unused patterns and padding are written as 0.
+    std::vector<image_batch> batches(header.batches);
+    for (int b = 0; b < header.batches; b++) {
+        const batch* work = &lattice->batches[b];
+        image_batch* record = &batches[b];
+        record->level = work->level;
+        record->core = work->core;
+        record->inputs = work->inputs;
+        record->count = work->count;
+        for (int k = 0; k < work->inputs; k++)
+            record->pattern[k] = work->pattern[k];
+    }
+    write_section(sink, batches.data(), header.batches, sizeof(image_batch));
+    write_section(sink, lattice->batchCells.data(), header.slots, sizeof(int));
+    write_section(sink, lattice->batchSources.data(), header.lines, sizeof(int));
+    write_section(sink, lattice->batchModifiers.data(), header.lines, sizeof(CELL_TYPE));
+    write_section(sink, lattice->consumerOffsets.data(), header.slots + 1, sizeof(int));
+    write_section(sink, lattice->consumers.data(), header.consumers, sizeof(int));
+}
+
+int SIMU_Lattice_Save(LatticeHandle lattice, const char* path) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (!path) return LATTICE_STATE_ERR_BAD_CONFIG;
+    program_guard lock(lattice);
+    compile_program(lattice);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) return LATTICE_STATE_ERR_BAD_FILE;
+    image_sink sink = { &file, 0, 0 };
+    write_image(lattice, &sink);
+    file.close();
+    return file ? LATTICE_STATE_OKAY : LATTICE_STATE_ERR_BAD_FILE;
+}
+
+/// <summary>
+/// returns true if the batches of an image hold exactly its slots and lines, in level order, and each consumer is one of its tasks
+/// </summary>
+static bool get_batches_valid(const program_header* header, const image_batch* batches, const int* consumerOffsets, const int* consumers) {
+    long long slots = 0, lines = 0, tasks = 0;
+    for (int b = 0; b < header->batches; b++) {
+        const image_batch* work = &batches[b];
+        if (work->count < 1 || work->inputs < 0 || work->inputs > ALL_CONNECTIONS) return false;
+        if (work->core < LATTICE_PROG_CORE_HOLDVAL || work->core > LATTICE_PROG_CORE_INT) return false;
+        if (work->level < 0 || (b > 0 && work->level < batches[b - 1].level)) return false;
+        slots += work->count;
+        lines += (long long)work->count * work->inputs;
+        tasks += (work->count + POOL_TASK_CELLS - 1) / POOL_TASK_CELLS;
+    }
+    if (slots != header->slots || lines != header->lines) return false;
+    if (consumerOffsets[0] != 0 || consumerOffsets[header->slots] != header->consumers) return false;
+    for (int i = 0; i < header->slots; i++) {
+        if (consumerOffsets[i + 1] < consumerOffsets[i]) return false;
+    }
+    return get_cells_valid(consumers, header->consumers, (int)std::min(tasks, (long long)INT_MAX));
+}
+
+/// <summary>
+/// returns true if the bricks of a sparse image each lie in the lattice and are stored once, and fill its cells exactly
+/// </summary>
+static bool get_bricks_valid(const program_header* header, const int* brickIds) {
+    if (header->storage != LATTICE_STORAGE_SPARSE) return header->bricks == 0;
+    if (header->cells != header->bricks * BRICK_CELLS) return false;
+    long long bricks = (long long)((header->X + BRICK_MASK) >> BRICK_BITS) * ((header->Y + BRICK_MASK) >> BRICK_BITS)
+        * ((header->Z + BRICK_MASK) >> BRICK_BITS);
+    std::vector<char> stored((size_t)std::min(bricks, (long long)INT_MAX));
+    for (int b = 0; b < header->bricks; b++) {
+        if (brickIds[b] < 0 || brickIds[b] >= stored.size() || stored[brickIds[b]]) return false;
+        stored[brickIds[b]] = 1;
+    }
+    return true;
+}
+
+/// <summary>
+/// returns true if no cell is listed twice
+/// </summary>
+static bool get_cells_unique(const int* list, int count, int cells) {
+    std::vector<char> listed(cells);
+    for (int i = 0; i < count; i++) {
+        if (listed[list[i]]) return false;
+        listed[list[i]] = 1;
+    }
+    return true;
+}
+
+/// <summary>
+/// finds the sections of a program image held in memory. Every section is checked, and every cell the image refers to is checked to
+/// lie in its storage, so a damaged image is rejected rather than run.
+/// </summary>
+/// <param name="map"></param>
+/// <param name="image"></param>
+/// <returns>LATTICE_STATE_ERR_BAD_FILE if the image is damaged, or was not saved by this build of the library.</returns>
+static int read_image(const mapped_file* map, program_image* image) {
+    if (map->size < sizeof(program_header)) return LATTICE_STATE_ERR_BAD_FILE;
+    program_header& header = image->header;
+    memcpy(&header, map->data, sizeof(header));
+#ifdef CELL_TYPE_USE_FIXED_POINT
+    int fixedPoint = 1;
+#else
+    int fixedPoint = 0;
+#endif
+    if (header.magic != PROGRAM_MAGIC || header.version != PROGRAM_VERSION || header.cellSize != sizeof(CELL_TYPE)
+        || header.fixedPoint != fixedPoint || header.connections != CONNECTION_COUNT)
+        return LATTICE_STATE_ERR_BAD_FILE;
+
+    size_t offset = 0;
+    read_section(map, &offset, 1, sizeof(header));
+    image->brickIds = (const int*)read_section(map, &offset, header.bricks, sizeof(int));
+    image->charges = (const CELL_TYPE*)read_section(map, &offset, header.cells, sizeof(CELL_TYPE));
+    image->cores = (const char*)read_section(map, &offset, header.cells, sizeof(char));
+    bool complete = image->brickIds && image->charges && image->cores;
+    for (int i = 0; i < CONNECTION_COUNT; i++) {
+        image->links[i] = (const char*)read_section(map, &offset, header.cells, sizeof(char));
+        image->modifiers[i] = (const CELL_TYPE*)read_section(map, &offset, header.cells, sizeof(CELL_TYPE));
+        complete = complete && image->links[i] && image->modifiers[i];
+    }
+    image->integrators = (const int*)read_section(map, &offset, header.integrators, sizeof(int));
+    image->endpoints = (const int*)read_section(map, &offset, header.endpoints, sizeof(int));
+    image->batches = (const image_batch*)read_section(map, &offset, header.batches, sizeof(image_batch));
+    image->batchCells = (const int*)read_section(map, &offset, header.slots, sizeof(int));
+    image->batchSources = (const int*)read_section(map, &offset, header.lines, sizeof(int));
+    image->batchModifiers = (const CELL_TYPE*)read_section(map, &offset, header.lines, sizeof(CELL_TYPE));
+    image->consumerOffsets = (const int*)read_section(map, &offset, header.slots + 1, sizeof(int));
+    image->consumers = (const int*)read_section(map, &offset, header.consumers, sizeof(int));
+    if (!complete || !image->integrators || !image->endpoints || !image->batches || !image->batchCells || !image->batchSources
+        || !image->batchModifiers || !image->consumerOffsets || !image->consumers)
+        return LATTICE_STATE_ERR_BAD_FILE;
+
+    if (!get_bricks_valid(&header, image->brickIds)
+        || !get_cells_valid(image->integrators, header.integrators, header.cells)
+        || !get_cells_unique(image->integrators, header.integrators, header.cells)
+        || !get_cells_valid(image->endpoints, header.endpoints, header.cells)
+        || !get_cells_valid(image->batchCells, header.slots, header.cells)
+        || !get_cells_valid(image->batchSources, header.lines, header.cells)
+        || !get_batches_valid(&header, image->batches, image->consumerOffsets, image->consumers))
+        return LATTICE_STATE_ERR_BAD_FILE;
+    return LATTICE_STATE_OKAY;
+}
+
+/// <summary>
+/// replaces the program, charges and compiled schedule of a lattice with those of an image read by read_image. The lattice must have
+/// the dimensions and storage of the image, and the program lock must be held.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="image"></param>
+/// <returns>LATTICE_STATE_ERR_BAD_FILE if the image does not fit the storage of the lattice.</returns>
+static int apply_image(LatticeHandle lattice, const program_image* image) {
+    const program_header* header = &image->header;
+    if (header->storage == LATTICE_STORAGE_SPARSE) {
+        // Bricks are allocated in the order they were saved, so every cell keeps its position in memory. Storage past them may
+        // hold bricks allocated since, and is cleared so a brick allocated there later starts unprogrammed.
+        std::fill(lattice->brickTable.begin(), lattice->brickTable.end(), -1);
+        for (int b = 0; b < header->bricks; b++)
+            lattice->brickTable[image->brickIds[b]] = b;
+        lattice->brickIds.assign(image->brickIds, image->brickIds + header->bricks);
+        if (header->cells > lattice->MAX) resize_storage(lattice, header->cells);
+        int spare = lattice->MAX - header->cells;
+        std::fill(lattice->charges + header->cells, lattice->charges + lattice->MAX, 0);
+        memset(lattice->cores + header->cells, 0, spare);
+        for (int i = 0; i < CONNECTION_COUNT; i++) {
+            memset(lattice->links[i] + header->cells, 0, spare);
+            std::fill(lattice->modifiers[i] + header->cells, lattice->modifiers[i] + lattice->MAX, 0);
+        }
+    }
+    else if (header->cells != lattice->MAX) {
+        return LATTICE_STATE_ERR_BAD_FILE;
+    }
+
+    memcpy(lattice->charges, image->charges, header->cells * sizeof(CELL_TYPE));
+    memcpy(lattice->cores, image->cores, header->cells);
+    for (int i = 0; i < CONNECTION_COUNT; i++) {
+        memcpy(lattice->links[i], image->links[i], header->cells);
+        memcpy(lattice->modifiers[i], image->modifiers[i], header->cells * sizeof(CELL_TYPE));
+    }
+    for (int i = 0; i < lattice->integrators.size(); i++)
+        lattice->integratorIndex[lattice->integrators[i]] = -1;
+    lattice->integrators.assign(image->integrators, image->integrators + header->integrators);
+    for (int i = 0; i < header->integrators; i++)
+        lattice->integratorIndex[image->integrators[i]] = i;
+    lattice->endpoints.assign(image->endpoints, image->endpoints + header->endpoints);
+    lattice->underbusCharge = header->underbus;
+
+    // The schedule is already compiled, leaving only what is worked out from it per lattice.
+    lattice->batches.assign(header->batches, batch());
+    for (int b = 0; b < header->batches; b++) {
+        const image_batch* record = &image->batches[b];
+        batch* work = &lattice->batches[b];
+        work->level = record->level;
+        work->core = (char)record->core;
+        work->inputs = record->inputs;
+        work->count = record->count;
+        for (int k = 0; k < record->inputs; k++)
+            work->pattern[k] = record->pattern[k];
+    }
+    lattice->batchCells.assign(image->batchCells, image->batchCells + header->slots);
+    lattice->batchSources.assign(image->batchSources, image->batchSources + header->lines);
+    lattice->batchModifiers.assign(image->batchModifiers, image->batchModifiers + header->lines);
+    lattice->consumerOffsets.assign(image->consumerOffsets, image->consumerOffsets + header->slots + 1);
+    lattice->consumers.assign(image->consumers, image->consumers + header->consumers);
+    link_batches(lattice);
+    compile_tasks(lattice);
+    compile_slots(lattice);
+    compile_noise(lattice);
+    lattice->inputsDirty = true;
+    lattice->dirty = false;
+    return LATTICE_STATE_OKAY;
+}
+
+int SIMU_Lattice_Load(LatticeHandle* handle, const char* path, int noise, double ts) {
+    if (!handle || !path) return LATTICE_STATE_ERR_BAD_CONFIG;
+    mapped_file map;
+    if (!map_file(&map, path)) return LATTICE_STATE_ERR_BAD_FILE;
+    program_image image;
+    int flag = read_image(&map, &image);
+    LatticeHandle lattice = 0;
+    if (flag == LATTICE_STATE_OKAY)
+        flag = SIMU_Lattice_Init(&lattice, image.header.X, image.header.Y, image.header.Z, noise, ts, image.header.storage);
+    if (flag == LATTICE_STATE_OKAY) {
+        program_guard lock(lattice);
+        flag = apply_image(lattice, &image);
+    }
+    unmap_file(&map);
+    if (flag != LATTICE_STATE_OKAY) {
+        if (lattice) SIMU_Lattice_Destroy(lattice);
+        return flag;
+    }
+    *handle = lattice;
+    return LATTICE_STATE_OKAY;
+}
+
+/// <summary>
+/// returns a number no lattice's program has had, to tell programs apart by
+/// </summary>
+static long long new_program_version() {
+    static std::atomic<long long> versions(0);
+    return ++versions;
+}
+
+int SIMU_Lattice_Checkpoint(LatticeHandle lattice, CheckpointHandle* handle) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (!handle) return LATTICE_STATE_ERR_BAD_CONFIG;
+    lattice_checkpoint* checkpoint = new lattice_checkpoint();
+    {
+        program_guard lock(lattice);
+        compile_program(lattice);
+        if (!lattice->programVersion) lattice->programVersion = new_program_version();
+
+        image_sink measure = {};
+        write_image(lattice, &measure);
+        checkpoint->data.reserve(measure.size);
+        image_sink sink = { 0, &checkpoint->data, 0 };
+        write_image(lattice, &sink);
+
+        checkpoint->programVersion = lattice->programVersion;
+        checkpoint->noiseProfile = lattice->noiseProfile;
+        checkpoint->timestep = lattice->timestep;
+        checkpoint->mode = lattice->mode;
+        int plane = lattice->yMax * lattice->zMax;
+        checkpoint->inputs.assign(lattice->inputs, lattice->inputs + plane);
+        checkpoint->taskDirty.resize(lattice->tasks.size());
+        for (int t = 0; t < lattice->tasks.size(); t++)
+            checkpoint->taskDirty[t] = lattice->taskDirty[t].load(std::memory_order_relaxed);
+        checkpoint->lineHeat = lattice->lineHeat;
+        checkpoint->flux = lattice->flux;
+        checkpoint->residuals = lattice->residuals;
+        checkpoint->tick = lattice->tick.load(std::memory_order_relaxed) - lattice->tickOffset;
+        checkpoint->isIntegrating = lattice->isIntegrating;
+        checkpoint->integrationMethod = lattice->integrationMethod;
+        checkpoint->integrationTolerance = lattice->integrationTolerance;
+        checkpoint->integrationStep = lattice->integrationStep;
+    }
+    mapped_file map = {};
+    map.data = checkpoint->data.data();
+    map.size = checkpoint->data.size();
+    read_image(&map, &checkpoint->image);
+    *handle = checkpoint;
+    return LATTICE_STATE_OKAY;
+}
+
+/// <summary>
+/// returns the lattice to the state held by a checkpoint, other than its program. Must be called with the program lock held, after
+/// the program has been restored or found unchanged.
+/// </summary>
+/// <param name="lattice"></param>
+/// <param name="checkpoint"></param>
+/// <param name="quick">Set if the schedule is the one the checkpoint was taken with, so which tasks were due can be restored too.</param>
+static void restore_state(LatticeHandle lattice, const lattice_checkpoint* checkpoint, bool quick) {
+    if (quick) {
+        memcpy(lattice->charges, checkpoint->image.charges, checkpoint->image.header.cells * sizeof(CELL_TYPE));
+        if (!lattice->dirty && lattice->tasks.size() == checkpoint->taskDirty.size()) {
+            for (int t = 0; t < lattice->tasks.size(); t++)
+                lattice->taskDirty[t].store(checkpoint->taskDirty[t], std::memory_order_relaxed);
+        }
+    }
+    if (lattice->lineHeat.size() == checkpoint->lineHeat.size()) lattice->lineHeat = checkpoint->lineHeat;
+    if (lattice->flux.size() == checkpoint->flux.size()) lattice->flux = checkpoint->flux;
+    // The batches point into the residuals, so they are copied over rather than replaced.
+    if (lattice->residuals.size() == checkpoint->residuals.size())
+        std::copy(checkpoint->residuals.begin(), checkpoint->residuals.end(), lattice->residuals.begin());
+    std::copy(checkpoint->inputs.begin(), checkpoint->inputs.end(), lattice->inputs);
+    lattice->inputsDirty = true;
+    lattice->underbusCharge = checkpoint->image.header.underbus;
+    lattice->isIntegrating = checkpoint->isIntegrating;
+    lattice->integrationMethod = checkpoint->integrationMethod;
+    lattice->integrationTolerance = checkpoint->integrationTolerance;
+    lattice->integrationStep = checkpoint->integrationStep;
+
+    // The outputs are published as a tick of their own, numbered as the tick the checkpoint was taken after.
+    lattice->tickOffset = lattice->tick.load(std::memory_order_relaxed) + 1 - checkpoint->tick;
+    store_outputs(lattice);
+    prime_subscriptions(lattice);
+}
+
+int SIMU_Lattice_Restore(LatticeHandle lattice, CheckpointHandle checkpoint) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (!checkpoint) return LATTICE_STATE_ERR_BAD_CONFIG;
+    const program_header* header = &checkpoint->image.header;
+    if (header->X != lattice->xMax || header->Y != lattice->yMax || header->Z != lattice->zMax || header->storage != lattice->storage)
+        return LATTICE_STATE_ERR_BAD_CONFIG;
+    {
+        program_guard lock(lattice);
+        if (lattice->noiseProfile != checkpoint->noiseProfile) {
+            lattice->noiseProfile = checkpoint->noiseProfile;
+            lattice->dirty = true; // batches are recompiled with or without KERNEL_NOISE
+        }
+        // Unless the lattice has been reprogrammed since the checkpoint, only the charges need copying.
+        bool quick = lattice->programVersion && lattice->programVersion == checkpoint->programVersion
+            && lattice->brickIds.size() == header->bricks;
+        if (!quick) {
+            int flag = apply_image(lattice, &checkpoint->image);
+            if (flag != LATTICE_STATE_OKAY) return flag;
+            lattice->programVersion = checkpoint->programVersion;
+        }
+        restore_state(lattice, checkpoint, quick);
+    }
+    return LATTICE_STATE_OKAY;
+}
+
+int SIMU_Lattice_Fork(LatticeHandle* handle, CheckpointHandle checkpoint) {
+    if (!handle || !checkpoint) return LATTICE_STATE_ERR_BAD_CONFIG;
+    const program_header* header = &checkpoint->image.header;
+    LatticeHandle lattice;
+    int flag = SIMU_Lattice_Init(&lattice, header->X, header->Y, header->Z, checkpoint->noiseProfile, checkpoint->timestep, header->storage);
+    if (flag != LATTICE_STATE_OKAY) return flag;
+    SIMU_Run_Mode(lattice, checkpoint->mode);
+    {
+        program_guard lock(lattice);
+        flag = apply_image(lattice, &checkpoint->image);
+        if (flag == LATTICE_STATE_OKAY) {
+            lattice->programVersion = checkpoint->programVersion;
+            restore_state(lattice, checkpoint, true);
+        }
+    }
+    if (flag != LATTICE_STATE_OKAY) {
+        SIMU_Lattice_Destroy(lattice);
+        return flag;
+    }
+    *handle = lattice;
+    return LATTICE_STATE_OKAY;
+}
+
+int SIMU_Checkpoint_Destroy(CheckpointHandle checkpoint) {
+    if (!checkpoint) return LATTICE_STATE_ERR_BAD_CONFIG;
+    delete checkpoint;
+    return LATTICE_STATE_OKAY;
+}
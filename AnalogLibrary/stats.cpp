@@ -0,0 +1,197 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    The counters behind SIMU_Get_Stats. Each tick adds to them once, with relaxed atomics, from the totals operate_tasks already
+    keeps; regions are counted per task, and only for tasks with a cell in one. Readers copy the counters out one by one, so a
+    read racing a tick may see part of it, but never holds the tick up.
+*/
+#include "pch.h"
+#include "lattice.h"
+#include <algorithm>
+
+/// <summary>
+/// returns the bucket of the tick duration histogram for a tick of the given wall time
+/// </summary>
+/// <param name="nanos"></param>
+/// <returns></returns>
+static int get_bucket(long long nanos) {
+    long long micros = nanos / 1000;
+    int bucket = 0;
+    while (micros && bucket < LATTICE_STATS_BUCKETS - 1) {
+        micros >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void record_tick(LatticeHandle lattice, long long nanos, int flags, long long cells, long long lines) {
+    stats_counters* stats = &lattice->stats;
+    stats->ticks.fetch_add(1, std::memory_order_relaxed);
+    if (cells) stats->activeTicks.fetch_add(1, std::memory_order_relaxed);
+    stats->cellsEvaluated.fetch_add(cells, std::memory_order_relaxed);
+    stats->lastTickCells.store(cells, std::memory_order_relaxed);
+    stats->connectionsTraversed.fetch_add(lines, std::memory_order_relaxed);
+    stats->tickNanos.fetch_add(nanos, std::memory_order_relaxed);
+    if (nanos > stats->maxTickNanos.load(std::memory_order_relaxed)) stats->maxTickNanos.store(nanos, std::memory_order_relaxed);
+    stats->tickHistogram[get_bucket(nanos)].fetch_add(1, std::memory_order_relaxed);
+    if (!flags) return;
+
+    stats->flags.fetch_or(flags, std::memory_order_relaxed);
+    for (int bit = 0; bit < LATTICE_STATS_FLAGS; bit++) {
+        if (flags & (1 << bit)) stats->flagTicks[bit].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void record_pacing(LatticeHandle lattice, long long late, long long missed) {
+    stats_counters* stats = &lattice->stats;
+    stats->pacedTicks.fetch_add(1, std::memory_order_relaxed);
+    if (missed) stats->missedTicks.fetch_add(missed, std::memory_order_relaxed);
+    stats->jitterNanos.fetch_add(late, std::memory_order_relaxed);
+    if (late > stats->maxJitterNanos.load(std::memory_order_relaxed)) stats->maxJitterNanos.store(late, std::memory_order_relaxed);
+    stats->jitterHistogram[get_bucket(late)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void record_integration(LatticeHandle lattice, long long steps, long long rejected) {
+    stats_counters* stats = &lattice->stats;
+    stats->integrationSteps.fetch_add(steps, std::memory_order_relaxed);
+    if (rejected) stats->rejectedSteps.fetch_add(rejected, std::memory_order_relaxed);
+}
+
+void record_regions(LatticeHandle lattice, int index, int flags) {
+    unsigned mask = lattice->taskRegions[index];
+    const int* cells = &lattice->taskRegionCells[(size_t)index * LATTICE_STATS_REGIONS];
+    // The tick in progress, as store_outputs will number it.
+    long long tick = lattice->tick.load(std::memory_order_relaxed) + 1;
+    for (int r = 0; r < LATTICE_STATS_REGIONS; r++) {
+        if (!(mask & (1u << r))) continue;
+        region_counters* region = &lattice->stats.regions[r];
+        region->cellsEvaluated.fetch_add(cells[r], std::memory_order_relaxed);
+        if (!flags) continue;
+        region->flags.fetch_or(flags, std::memory_order_relaxed);
+        if (region->lastFlagged.exchange(tick, std::memory_order_relaxed) != tick)
+            region->flaggedTicks.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void compile_regions(LatticeHandle lattice) {
+    lattice->taskRegions.clear();
+    lattice->taskRegionCells.clear();
+    const region_counters* regions = lattice->stats.regions;
+    bool any = false;
+    for (int r = 0; r < LATTICE_STATS_REGIONS; r++)
+        any |= regions[r].width > 0;
+    if (!any) return;
+
+    lattice->taskRegions.assign(lattice->tasks.size(), 0);
+    lattice->taskRegionCells.assign(lattice->tasks.size() * LATTICE_STATS_REGIONS, 0);
+    for (int t = 0; t < lattice->tasks.size(); t++) {
+        const task* job = &lattice->tasks[t];
+        const batch* work = &lattice->batches[job->batch];
+        int* counts = &lattice->taskRegionCells[(size_t)t * LATTICE_STATS_REGIONS];
+        for (int i = job->begin; i < job->end; i++) {
+            int x, y, z;
+            get_coords(lattice, work->cells[i], &x, &y, &z);
+            for (int r = 0; r < LATTICE_STATS_REGIONS; r++) {
+                const region_counters* region = &regions[r];
+                if (x < region->x || x >= region->x + region->width) continue;
+                if (y < region->y || y >= region->y + region->height) continue;
+                if (z < region->z || z >= region->z + region->depth) continue;
+                counts[r]++;
+                lattice->taskRegions[t] |= 1 << r;
+            }
+        }
+    }
+}
+
+int SIMU_Get_Stats(LatticeHandle lattice, lattice_stats* stats) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    const stats_counters* counters = &lattice->stats;
+    stats->ticks = counters->ticks.load(std::memory_order_relaxed);
+    stats->activeTicks = counters->activeTicks.load(std::memory_order_relaxed);
+    stats->cellsEvaluated = counters->cellsEvaluated.load(std::memory_order_relaxed);
+    stats->lastTickCells = counters->lastTickCells.load(std::memory_order_relaxed);
+    stats->connectionsTraversed = counters->connectionsTraversed.load(std::memory_order_relaxed);
+    stats->tickNanos = counters->tickNanos.load(std::memory_order_relaxed);
+    stats->maxTickNanos = counters->maxTickNanos.load(std::memory_order_relaxed);
+    for (int b = 0; b < LATTICE_STATS_BUCKETS; b++)
+        stats->tickHistogram[b] = counters->tickHistogram[b].load(std::memory_order_relaxed);
+    for (int f = 0; f < LATTICE_STATS_FLAGS; f++)
+        stats->flagTicks[f] = counters->flagTicks[f].load(std::memory_order_relaxed);
+    stats->flags = counters->flags.load(std::memory_order_relaxed);
+    stats->pacedTicks = counters->pacedTicks.load(std::memory_order_relaxed);
+    stats->missedTicks = counters->missedTicks.load(std::memory_order_relaxed);
+    stats->jitterNanos = counters->jitterNanos.load(std::memory_order_relaxed);
+    stats->maxJitterNanos = counters->maxJitterNanos.load(std::memory_order_relaxed);
+    for (int b = 0; b < LATTICE_STATS_BUCKETS; b++)
+        stats->jitterHistogram[b] = counters->jitterHistogram[b].load(std::memory_order_relaxed);
+    stats->integrationSteps = counters->integrationSteps.load(std::memory_order_relaxed);
+    stats->rejectedSteps = counters->rejectedSteps.load(std::memory_order_relaxed);
+    for (int r = 0; r < LATTICE_STATS_REGIONS; r++) {
+        const region_counters* region = &counters->regions[r];
+        stats->regions[r].cellsEvaluated = region->cellsEvaluated.load(std::memory_order_relaxed);
+        stats->regions[r].flaggedTicks = region->flaggedTicks.load(std::memory_order_relaxed);
+        stats->regions[r].flags = region->flags.load(std::memory_order_relaxed);
+    }
+    return LATTICE_STATE_OKAY;
+}
+
+/// <summary>
+/// sets the counters of a region back to 0
+/// </summary>
+/// <param name="region"></param>
+static void reset_region(region_counters* region) {
+    region->cellsEvaluated.store(0, std::memory_order_relaxed);
+    region->flaggedTicks.store(0, std::memory_order_relaxed);
+    region->lastFlagged.store(-1, std::memory_order_relaxed);
+    region->flags.store(0, std::memory_order_relaxed);
+}
+
+int SIMU_Reset_Stats(LatticeHandle lattice) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    stats_counters* counters = &lattice->stats;
+    counters->ticks.store(0, std::memory_order_relaxed);
+    counters->activeTicks.store(0, std::memory_order_relaxed);
+    counters->cellsEvaluated.store(0, std::memory_order_relaxed);
+    counters->lastTickCells.store(0, std::memory_order_relaxed);
+    counters->connectionsTraversed.store(0, std::memory_order_relaxed);
+    counters->tickNanos.store(0, std::memory_order_relaxed);
+    counters->maxTickNanos.store(0, std::memory_order_relaxed);
+    for (int b = 0; b < LATTICE_STATS_BUCKETS; b++)
+        counters->tickHistogram[b].store(0, std::memory_order_relaxed);
+    for (int f = 0; f < LATTICE_STATS_FLAGS; f++)
+        counters->flagTicks[f].store(0, std::memory_order_relaxed);
+    counters->flags.store(0, std::memory_order_relaxed);
+    counters->pacedTicks.store(0, std::memory_order_relaxed);
+    counters->missedTicks.store(0, std::memory_order_relaxed);
+    counters->jitterNanos.store(0, std::memory_order_relaxed);
+    counters->maxJitterNanos.store(0, std::memory_order_relaxed);
+    for (int b = 0; b < LATTICE_STATS_BUCKETS; b++)
+        counters->jitterHistogram[b].store(0, std::memory_order_relaxed);
+    counters->integrationSteps.store(0, std::memory_order_relaxed);
+    counters->rejectedSteps.store(0, std::memory_order_relaxed);
+    for (int r = 0; r < LATTICE_STATS_REGIONS; r++)
+        reset_region(&counters->regions[r]);
+    return LATTICE_STATE_OKAY;
+}
+
+int SIMU_Stats_Region(LatticeHandle lattice, int region, int X, int Y, int Z, int width, int height, int depth) {
+    if (!lattice) return LATTICE_STATE_ERR_NOT_INIT;
+    if (region < 0 || region >= LATTICE_STATS_REGIONS) return LATTICE_STATE_ERR_BAD_CONFIG;
+    bool unset = width == 0 || height == 0 || depth == 0;
+    if (!unset && (width < 0 || height < 0 || depth < 0 || !get_in_bounds(lattice, X, Y, Z)
+        || !get_in_bounds(lattice, X + width - 1, Y + height - 1, Z + depth - 1)))
+        return LATTICE_STATE_ERR_BAD_CONFIG;
+
+    program_guard lock(lattice);
+    region_counters* counters = &lattice->stats.regions[region];
+    counters->x = X;
+    counters->y = Y;
+    counters->z = Z;
+    counters->width = unset ? 0 : width;
+    counters->height = height;
+    counters->depth = depth;
+    reset_region(counters);
+    compile_regions(lattice);
+    return LATTICE_STATE_OKAY;
+}
@@ -0,0 +1,160 @@
+/*
+    Analog Lattice Library
+    by Harris C. McRae, 2024
+
+    The portable thread layer: pinning the simulation thread to a CPU, running it under the realtime scheduler, and sleeping it
+    precisely, on Windows and POSIX alike. Paced ticks are waited for by sleeping until shortly before they are due and spinning
+    the rest of the way, so they start within microseconds of their deadline without a core spinning between ticks.
+*/
+#include "pch.h"
+#include "lattice.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause()
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+static long long get_nanos(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+std::thread::native_handle_type current_thread() {
+#ifdef _WIN32
+    return GetCurrentThread();
+#else
+    return pthread_self();
+#endif
+}
+
+bool set_thread_affinity(std::thread::native_handle_type thread, int cpu) {
+#ifdef _WIN32
+    DWORD_PTR process, system;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system)) return false;
+    if (cpu >= 0) {
+        if (cpu >= (int)sizeof(DWORD_PTR) * 8 || !(process & ((DWORD_PTR)1 << cpu))) return false;
+        process = (DWORD_PTR)1 << cpu;
+    }
+    return SetThreadAffinityMask(thread, process) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpu >= CPU_SETSIZE) return false;
+    if (cpu >= 0) CPU_SET(cpu, &set);
+    else {
+        for (int c = 0; c < CPU_SETSIZE; c++)
+            CPU_SET(c, &set);
+    }
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+#else
+    return cpu < 0; // no affinity to set
+#endif
+}
+
+bool set_thread_realtime(std::thread::native_handle_type thread, bool realtime) {
+#ifdef _WIN32
+    return SetThreadPriority(thread, realtime ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_NORMAL) != 0;
+#else
+    sched_param param = {};
+    // Below the kernel's own realtime threads, so a spinning simulation thread cannot starve them.
+    if (realtime) param.sched_priority = std::min(sched_get_priority_max(SCHED_FIFO), 50);
+    return pthread_setschedparam(thread, realtime ? SCHED_FIFO : SCHED_OTHER, &param) == 0;
+#endif
+}
+
+void prepare_timing_thread() {
+#ifdef __linux__
+    // By default a sleep may wake up to 50us late so the kernel can batch wakeups; paced ticks need it to wake on time.
+    prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+#endif
+}
+
+#ifdef _WIN32
+// A high resolution waitable timer for each thread that sleeps, as Sleep only wakes on the system timer tick.
+struct sleep_timer {
+    HANDLE handle;
+    sleep_timer() {
+        handle = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    }
+    ~sleep_timer() {
+        if (handle) CloseHandle(handle);
+    }
+};
+#endif
+
+/// <summary>
+/// sleeps the calling thread until the given time, as closely as the platform allows
+/// </summary>
+/// <param name="wake"></param>
+static void sleep_until(std::chrono::steady_clock::time_point wake) {
+#ifdef _WIN32
+    static thread_local sleep_timer timer;
+    long long nanos = get_nanos(wake - std::chrono::steady_clock::now());
+    if (nanos <= 0) return;
+    LARGE_INTEGER due;
+    due.QuadPart = -(nanos / 100); // relative, in 100ns units
+    if (timer.handle && SetWaitableTimer(timer.handle, &due, 0, NULL, NULL, FALSE)) {
+        WaitForSingleObject(timer.handle, INFINITE);
+        return;
+    }
+    std::this_thread::sleep_until(wake);
+#elif defined(__linux__)
+    // steady_clock is CLOCK_MONOTONIC, so the deadline can be slept to directly rather than as a length that may already be stale.
+    long long nanos = get_nanos(wake.time_since_epoch());
+    timespec until;
+    until.tv_sec = (time_t)(nanos / 1000000000);
+    until.tv_nsec = (long)(nanos % 1000000000);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+#else
+    std::this_thread::sleep_until(wake);
+#endif
+}
+
+void pace_tick(LatticeHandle lattice, pace_state* pace) {
+    auto now = std::chrono::steady_clock::now();
+    if (pace->restart) {
+        pace->restart = false;
+        pace->deadline = now;
+        return;
+    }
+    pace->deadline += std::chrono::nanoseconds(pace->period);
+
+    if (now >= pace->deadline) {
+        // The last tick ran past when this one was due, so it starts at once. Whole periods it ran past are skipped rather than
+        // run back to back, and the schedule keeps its phase.
+        long long late = get_nanos(now - pace->deadline);
+        long long missed = late / pace->period;
+        pace->deadline += std::chrono::nanoseconds(missed * pace->period);
+        record_pacing(lattice, late - missed * pace->period, missed);
+        return;
+    }
+
+    // Sleep until twice the time sleeps usually wake late before the deadline. Averaged rather than taken from the latest wake, so
+    // the odd sleep held up by the scheduler does not turn the next hundred waits into spins.
+    long long spin = std::min(pace->oversleep * 2 + PACE_MIN_SPIN_NANOS, pace->period);
+    auto wake = pace->deadline - std::chrono::nanoseconds(spin);
+    if (now < wake) {
+        sleep_until(wake);
+        long long over = get_nanos(std::chrono::steady_clock::now() - wake);
+        pace->oversleep += (std::min(over, pace->period) - pace->oversleep) / 16;
+    }
+    while ((now = std::chrono::steady_clock::now()) < pace->deadline)
+        cpu_relax();
+    record_pacing(lattice, get_nanos(now - pace->deadline), 0);
+}
@@ -0,0 +1,244 @@
+// IntegratorBench.cpp : Compares the LATTICE_INTEGRATE methods on ODEs with known solutions, printing one JSON object per method
+// and timestep, and then per workload the fastest run of each method that kept within the target error. Builds with the Visual
+// Studio project here, or on Linux with the CMakeLists.txt at the root of the repository.
+//
+// Usage: IntegratorBench [workload|all] [copies] [target error]
+//   decay        x' = -k x, from x = 0.9.
+//   oscillator   x' = w v, v' = -w x, from x = 0.8 and v = 0.
+//   logistic     x' = r x (1 - x), from x = 0.1, with 1 - x and the product worked out by SUM and MULT cells.
+// Each workload is run as copies side by side along Y, with k, w or r spread from 1 down to 0.5, for SIM_SECONDS of simulated
+// time in LATTICE_RUN_STEPPED mode.
+//
+// For each method and timestep, reports:
+//   ticks_per_sec           Stepped ticks per second of wall time.
+//   sim_seconds_per_sec     Simulated seconds per second of wall time, the measure to compare methods by.
+//   max_error               The largest difference of any integrator from the exact solution at the end.
+//   steps, rejected         Integration steps taken and, with LATTICE_INTEGRATE_ADAPTIVE, taken again shorter.
+//
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include "AnalogLibrary.h"
+
+using namespace std;
+
+#define SIM_SECONDS 8.0
+#define DEFAULT_COPIES 256
+#define DEFAULT_TARGET_ERROR 1e-3
+
+typedef struct workload {
+    const char* name;
+    int X;                                      // Length of the lattice along X. Each copy takes two rows along Y.
+    void (*program)(LatticeHandle lattice, int copy, double rate);
+    int (*write)(LatticeHandle lattice, int copy);  // Writes the inputs a copy needs, if any.
+    double (*error)(LatticeHandle lattice, int copy, double rate, double t);
+} workload;
+
+const char* methods[] = { "euler", "heun", "rk4", "adaptive" };
+const double timesteps[] = { 1, 0.5, 0.2, 0.1, 0.05, 0.02, 0.01, 0.005, 0.002, 0.001 };
+
+CELL_TYPE charge(double value) {
+    return (CELL_TYPE)(value * CELL_ONE);
+}
+
+double examine(LatticeHandle lattice, int X, int Y) {
+    CELL_TYPE cell = 0;
+    SIMU_Lattice_Examine(lattice, X, Y, 0, &cell);
+    return (double)cell / CELL_ONE;
+}
+
+// Programs a cell to integrate, starting from the given charge.
+void integrator(LatticeHandle lattice, int X, int Y, double start) {
+    Lattice_Program_SetUnderbus(lattice, charge(start));
+    Lattice_Program_Core(lattice, X, Y, 0, LATTICE_PROG_CORE_HOLDVAL);
+    Lattice_Program_Core(lattice, X, Y, 0, LATTICE_PROG_CORE_INT);
+}
+
+// Connects a line, multiplied by coefficient unless it is 1.
+void connect(LatticeHandle lattice, int X, int Y, int code, double coefficient) {
+    if (coefficient != 1) {
+        Lattice_Program_SetUnderbus(lattice, charge(coefficient));
+        code |= LATTICE_PROG_CONNECT_CONFIG_MOD_COEFF;
+    }
+    Lattice_Program_Connect(lattice, X, Y, 0, code);
+}
+
+int no_inputs(LatticeHandle lattice, int copy) {
+    return 0;
+}
+
+// x integrates around a loop of three SUM cells, the first multiplying it by -k.
+//   y + 1:  c <- b
+//   y:      x -> a
+void decay_program(LatticeHandle lattice, int copy, double rate) {
+    int y = copy * 2;
+    integrator(lattice, 1, y, 0.9);
+    Lattice_Program_Core(lattice, 2, y, 0, LATTICE_PROG_CORE_SUM);
+    Lattice_Program_Core(lattice, 2, y + 1, 0, LATTICE_PROG_CORE_SUM);
+    Lattice_Program_Core(lattice, 1, y + 1, 0, LATTICE_PROG_CORE_SUM);
+    connect(lattice, 1, y, LATTICE_PROG_CONNECT_PX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS, -rate);
+    connect(lattice, 2, y, LATTICE_PROG_CONNECT_PY | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS, 1);
+    connect(lattice, 2, y + 1, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG, 1);
+    connect(lattice, 1, y + 1, LATTICE_PROG_CONNECT_NY | LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG, 1);
+}
+
+double decay_error(LatticeHandle lattice, int copy, double rate, double t) {
+    return fabs(examine(lattice, 1, copy * 2) - 0.9 * exp(-rate * t));
+}
+
+// x and v integrate each other: v reads x directly, and x reads v around two SUM cells.
+//   y + 1:  h2 <- h1
+//   y:      x  -> v
+void oscillator_program(LatticeHandle lattice, int copy, double rate) {
+    int y = copy * 2;
+    integrator(lattice, 1, y, 0.8);
+    integrator(lattice, 2, y, 0);
+    Lattice_Program_Core(lattice, 2, y + 1, 0, LATTICE_PROG_CORE_SUM);
+    Lattice_Program_Core(lattice, 1, y + 1, 0, LATTICE_PROG_CORE_SUM);
+    connect(lattice, 1, y, LATTICE_PROG_CONNECT_PX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS, -rate);
+    connect(lattice, 2, y, LATTICE_PROG_CONNECT_PY | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS, rate);
+    connect(lattice, 2, y + 1, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG, 1);
+    connect(lattice, 1, y + 1, LATTICE_PROG_CONNECT_NY | LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG, 1);
+}
+
+double oscillator_error(LatticeHandle lattice, int copy, double rate, double t) {
+    double x = 0.8 * cos(rate * t), v = -0.8 * sin(rate * t);
+    return max(fabs(examine(lattice, 1, copy * 2) - x), fabs(examine(lattice, 2, copy * 2) - v));
+}
+
+// x integrates m = (r x) * (1 - x). g and h carry r x round to m, t and s work out 1 - x from the 1 written to the input layer.
+//   y + 1:  1 -> s -> m <- h
+//   y:           t <- x -> g
+void logistic_program(LatticeHandle lattice, int copy, double rate) {
+    int y = copy * 2;
+    integrator(lattice, 2, y, 0.1);
+    Lattice_Program_Core(lattice, 3, y, 0, LATTICE_PROG_CORE_SUM);
+    Lattice_Program_Core(lattice, 3, y + 1, 0, LATTICE_PROG_CORE_SUM);
+    Lattice_Program_Core(lattice, 1, y, 0, LATTICE_PROG_CORE_SUM);
+    Lattice_Program_Core(lattice, 1, y + 1, 0, LATTICE_PROG_CORE_SUM);
+    Lattice_Program_Core(lattice, 2, y + 1, 0, LATTICE_PROG_CORE_MULT);
+    connect(lattice, 2, y, LATTICE_PROG_CONNECT_PX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS, rate);
+    connect(lattice, 3, y, LATTICE_PROG_CONNECT_PY | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS, 1);
+    connect(lattice, 1, y, LATTICE_PROG_CONNECT_PX | LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG | LATTICE_PROG_CONNECT_CONFIG_INVERT, 1);
+    connect(lattice, 0, y + 1, LATTICE_PROG_CONNECT_PX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS, 1);
+    connect(lattice, 1, y, LATTICE_PROG_CONNECT_PY | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS, 1);
+    connect(lattice, 2, y + 1, LATTICE_PROG_CONNECT_PX | LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG, 1);
+    connect(lattice, 1, y + 1, LATTICE_PROG_CONNECT_PX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS, 1);
+    connect(lattice, 2, y, LATTICE_PROG_CONNECT_PY | LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG, 1);
+}
+
+int logistic_write(LatticeHandle lattice, int copy) {
+    return Lattice_Write(lattice, copy * 2 + 1, 0, charge(1));
+}
+
+double logistic_error(LatticeHandle lattice, int copy, double rate, double t) {
+    return fabs(examine(lattice, 2, copy * 2) - 1 / (1 + (1 / 0.1 - 1) * exp(-rate * t)));
+}
+
+const workload workloads[] = {
+    { "decay", 3, decay_program, no_inputs, decay_error },
+    { "oscillator", 3, oscillator_program, no_inputs, oscillator_error },
+    { "logistic", 4, logistic_program, logistic_write, logistic_error },
+};
+
+// The rate of a copy, from 1 for the first down to 0.5 for the last.
+double get_rate(int copy, int copies) {
+    return 1 - 0.5 * copy / copies;
+}
+
+typedef struct result {
+    double simSecondsPerSec;
+    double maxError;
+} result;
+
+// Runs a workload with one method and timestep, or returns a negative rate if the lattice could not be set up.
+result run(const workload& w, int copies, int method, double dt) {
+    result r = { -1, 0 };
+    LatticeHandle lattice;
+    if (SIMU_Lattice_Init(&lattice, w.X, copies * 2, 1, LATTICE_NOISE_MODE_NONE, dt)) {
+        cerr << w.name << ": failed to initialize the lattice!" << endl;
+        return r;
+    }
+    SIMU_Run_Mode(lattice, LATTICE_RUN_STEPPED);
+    int flags = 0;
+    Lattice_Program_Begin(lattice);
+    for (int c = 0; c < copies; c++)
+        w.program(lattice, c, get_rate(c, copies));
+    flags |= Lattice_Program_Commit(lattice);
+    for (int c = 0; c < copies; c++)
+        flags |= w.write(lattice, c);
+    flags |= SIMU_Integration_Method(lattice, method);
+    if (flags) {
+        cerr << w.name << ": failed to program the lattice!" << endl;
+        SIMU_Lattice_Destroy(lattice);
+        return r;
+    }
+
+    // A tick before integrating compiles the program and settles the cells the integrators read, so neither is timed.
+    SIMU_Lattice_Step(lattice, 1);
+    Lattice_Start_Integration(lattice);
+    SIMU_Reset_Stats(lattice);
+
+    int ticks = (int)(SIM_SECONDS / dt + 0.5);
+    auto start = chrono::steady_clock::now();
+    int raised = SIMU_Lattice_Step(lattice, ticks);
+    double seconds = (double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count() / 1e9;
+
+    for (int c = 0; c < copies; c++)
+        r.maxError = max(r.maxError, w.error(lattice, c, get_rate(c, copies), ticks * dt));
+    lattice_stats stats;
+    SIMU_Get_Stats(lattice, &stats);
+    SIMU_Lattice_Destroy(lattice);
+
+    r.simSecondsPerSec = ticks * dt / seconds;
+    cout << "{\"workload\":\"" << w.name << "\",\"method\":\"" << methods[method] << "\",\"dt\":" << dt << ",\"ticks\":" << ticks
+        << ",\"ticks_per_sec\":" << ticks / seconds << ",\"sim_seconds_per_sec\":" << r.simSecondsPerSec
+        << ",\"max_error\":" << r.maxError << ",\"steps\":" << stats.integrationSteps << ",\"rejected\":" << stats.rejectedSteps
+        << ",\"overflow\":" << ((raised & LATTICE_STATE_ERR_OVERFLOW_CELL) ? "true" : "false") << "}" << endl;
+    return r;
+}
+
+int main(int argc, char** argv)
+{
+    string name = argc > 1 ? argv[1] : "all";
+    int copies = argc > 2 ? atoi(argv[2]) : 0;
+    double target = argc > 3 ? atof(argv[3]) : 0;
+    if (copies <= 0) copies = DEFAULT_COPIES;
+    if (target <= 0) target = DEFAULT_TARGET_ERROR;
+
+    int found = 0;
+    for (const workload& w : workloads) {
+        if (name != "all" && name != w.name) continue;
+        found++;
+
+        cout.precision(6);
+        string best = "";
+        for (int m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+            result fastest = { -1, 0 };
+            double fastestDt = 0;
+            for (double dt : timesteps) {
+                result r = run(w, copies, m, dt);
+                if (r.simSecondsPerSec < 0) return 1;
+                if (r.maxError <= target && r.simSecondsPerSec > fastest.simSecondsPerSec) {
+                    fastest = r;
+                    fastestDt = dt;
+                }
+            }
+            if (!best.empty()) best += ",";
+            best += string("\"") + methods[m] + "\":";
+            if (fastest.simSecondsPerSec < 0) best += "null";
+            else best += "{\"dt\":" + to_string(fastestDt) + ",\"sim_seconds_per_sec\":" + to_string(fastest.simSecondsPerSec) + "}";
+        }
+        cout << "{\"workload\":\"" << w.name << "\",\"target_error\":" << target << ",\"fastest\":{" << best << "}}" << endl;
+    }
+    if (!found) {
+        cerr << "Usage: IntegratorBench [all|decay|oscillator|logistic] [copies] [target error]" << endl;
+        return 1;
+    }
+    return 0;
+}
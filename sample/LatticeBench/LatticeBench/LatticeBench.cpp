@@ -0,0 +1,388 @@
+// LatticeBench.cpp : Runs scalable workloads through the library and prints one JSON object per workload, so results can be
+// collected and compared across releases. Builds with the Visual Studio project here, or on Linux with the CMakeLists.txt at
+// the root of the repository.
+//
+// Usage: LatticeBench [workload|all] [scale] [ticks]
+//   linear       LinearSearch over scale entries: a 7 x 2*scale x 4 lattice holding the comparison, multiplier and signal cells.
+//   chain        256 SUM chains scale cells deep along X.
+//   multtree     A scale x 32 x 32 block of MULT cells, each the product of the cells behind it on X, Y and Z.
+//   integrators  A bank of scale x scale integrators, each fed by a SUM cell from the input layer.
+//   sparse       scale random wires on a sparse 256 x 256 x 256 lattice, each wandering from the input layer towards +X.
+//
+// For each workload, reports:
+//   ticks_per_sec, cells_per_sec  Stepped ticks with a new input layer every tick, and the programmed cells evaluated per second.
+//   latency_us                    Threaded mode: time from a write until Lattice_Wait has seen it reach the outputs.
+//   program_ms                    Time to program the lattice in one transaction and compile it.
+//   peak_rss_kb                   Peak resident memory of the process. On Linux it is reset before each workload.
+//
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+#include "AnalogLibrary.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <Psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+#define WARMUP_TICKS 3
+#define BENCH_TICKS 50
+#define LATENCY_SAMPLES 200
+#define SETTLE_TICKS 2 // ticks after a write before the outputs are sure to have seen it.
+#define LINEAR_MAX_VALUE 128
+
+typedef struct workload {
+    const char* name;
+    int scale;                      // The default scale.
+    int storage;
+    int integrating;                // Whether integration is started before running.
+    void (*size)(int scale, int* X, int* Y, int* Z);
+    long long (*program)(LatticeHandle lattice, int scale); // Returns the number of cells programmed, or -1 on failure.
+} workload;
+
+// Counts the cores programmed, so cells_per_sec is the same measure for every workload.
+struct program_counter {
+    LatticeHandle lattice;
+    long long cells = 0;
+    int flags = 0;
+
+    void core(int X, int Y, int Z, int code) {
+        flags |= Lattice_Program_Core(lattice, X, Y, Z, code);
+        cells++;
+    }
+    void connect(int X, int Y, int Z, int code) {
+        flags |= Lattice_Program_Connect(lattice, X, Y, Z, code);
+    }
+    long long result() {
+        return flags ? -1 : cells;
+    }
+};
+
+void linear_size(int scale, int* X, int* Y, int* Z) {
+    *X = 7; *Y = scale * 2; *Z = 4;
+}
+
+// The LinearSearch sample's program, over scale entries.
+long long linear_program(LatticeHandle lattice, int scale) {
+    program_counter p = { lattice };
+    std::default_random_engine rng(1);
+    std::uniform_int_distribution<int> values(0, LINEAR_MAX_VALUE - 1);
+
+    for (int i = 0, y = 0; i < scale; i++, y += 2) {
+        int value = values(rng);
+
+        // Input carry
+        p.core(1, y + 0, 1, LATTICE_PROG_CORE_SUM);
+        p.core(1, y + 1, 1, LATTICE_PROG_CORE_SUM);
+        if (y > 0) p.connect(1, y + 0, 1, LATTICE_PROG_CONNECT_NY | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+        p.connect(1, y + 1, 1, LATTICE_PROG_CONNECT_NY | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+
+        // Value store
+        Lattice_Program_SetUnderbus(lattice, value, LINEAR_MAX_VALUE);
+        p.core(2, y, 1, LATTICE_PROG_CORE_HOLDVAL);
+        Lattice_Program_SetUnderbus(lattice, (CELL_TYPE)CELL_ONE);
+        p.core(3, y, 1, LATTICE_PROG_CORE_HOLDVAL);
+
+        // C1 and C2
+        p.core(2, y + 1, 1, LATTICE_PROG_CORE_SUM);
+        p.connect(2, y + 1, 1, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS | LATTICE_PROG_CONNECT_CONFIG_INVERT);
+        p.connect(2, y + 1, 1, LATTICE_PROG_CONNECT_NY | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+        p.core(3, y + 1, 1, LATTICE_PROG_CORE_SUM);
+        Lattice_Program_SetUnderbus(lattice, (CELL_TYPE)0);
+        p.connect(3, y + 1, 1, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS | LATTICE_PROG_CONNECT_CONFIG_MOD_COMP |
+            LATTICE_PROG_CONNECT_CONFIG_ABSOLUTE | LATTICE_PROG_CONNECT_CONFIG_INVERT);
+        p.connect(3, y + 1, 1, LATTICE_PROG_CONNECT_NY | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+
+        // Signal base
+        p.core(4, y + 1, 1, LATTICE_PROG_CORE_SUM);
+        p.connect(4, y + 1, 1, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+
+        // Secondary value store and index store
+        Lattice_Program_SetUnderbus(lattice, value, LINEAR_MAX_VALUE);
+        p.core(3, y + 1, 0, LATTICE_PROG_CORE_HOLDVAL);
+        Lattice_Program_SetUnderbus(lattice, i % LINEAR_MAX_VALUE, LINEAR_MAX_VALUE);
+        p.core(3, y + 1, 2, LATTICE_PROG_CORE_HOLDVAL);
+
+        // Multipliers against the signal and the two stores
+        p.core(4, y + 1, 0, LATTICE_PROG_CORE_MULT);
+        p.core(4, y + 1, 2, LATTICE_PROG_CORE_MULT);
+        p.connect(4, y + 1, 0, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+        p.connect(4, y + 1, 0, LATTICE_PROG_CONNECT_PZ | LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG);
+        p.connect(4, y + 1, 2, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+        p.connect(4, y + 1, 2, LATTICE_PROG_CONNECT_NZ | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+
+        // Signal lines on x = 5, carried back to y = 0
+        p.core(5, y + 1, 0, LATTICE_PROG_CORE_SUM);
+        p.core(5, y + 1, 2, LATTICE_PROG_CORE_SUM);
+        p.connect(5, y + 1, 0, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+        p.connect(5, y + 1, 2, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+        p.core(5, y + 0, 0, LATTICE_PROG_CORE_MULT);
+        p.core(5, y + 0, 2, LATTICE_PROG_CORE_MULT);
+        p.connect(5, y + 0, 0, LATTICE_PROG_CONNECT_PY | LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG);
+        p.connect(5, y + 0, 2, LATTICE_PROG_CONNECT_PY | LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG);
+        if (i + 1 < scale) {
+            p.connect(5, y + 1, 0, LATTICE_PROG_CONNECT_PY | LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG);
+            p.connect(5, y + 1, 2, LATTICE_PROG_CONNECT_PY | LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG);
+        }
+
+        // Cancel signal base
+        p.core(5, y + 1, 1, LATTICE_PROG_CORE_SUM);
+        Lattice_Program_SetUnderbus(lattice, (CELL_TYPE)CELL_ONE);
+        p.core(6, y + 1, 1, LATTICE_PROG_CORE_HOLDVAL);
+        p.connect(5, y + 1, 1, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS | LATTICE_PROG_CONNECT_CONFIG_INVERT);
+        p.connect(5, y + 1, 1, LATTICE_PROG_CONNECT_PX | LATTICE_PROG_CONNECT_CONFIG_FLOW_NEG);
+    }
+
+    // Outputs on x = 6, input at {0, 1}
+    p.core(6, 0, 0, LATTICE_PROG_CORE_SUM);
+    p.core(6, 0, 2, LATTICE_PROG_CORE_SUM);
+    p.connect(6, 0, 0, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+    p.connect(6, 0, 2, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+    p.connect(1, 0, 1, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+    return p.result();
+}
+
+void chain_size(int scale, int* X, int* Y, int* Z) {
+    *X = scale + 1; *Y = 16; *Z = 16;
+}
+
+long long chain_program(LatticeHandle lattice, int scale) {
+    program_counter p = { lattice };
+    Lattice_Program_SetUnderbus(lattice, (CELL_TYPE)(0.999 * CELL_ONE));
+    for (int z = 0; z < 16; z++) {
+        for (int y = 0; y < 16; y++) {
+            for (int x = 1; x <= scale; x++) {
+                p.core(x, y, z, LATTICE_PROG_CORE_SUM);
+                p.connect(x, y, z, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_MOD_COEFF);
+            }
+        }
+    }
+    return p.result();
+}
+
+void multtree_size(int scale, int* X, int* Y, int* Z) {
+    *X = scale + 1; *Y = 32; *Z = 32;
+}
+
+// Every cell multiplies up to three cells behind it, so the output at the far corner is a product over the whole block.
+// The inputs are +-1, so the products neither overflow nor fade into denormals.
+long long multtree_program(LatticeHandle lattice, int scale) {
+    program_counter p = { lattice };
+    for (int z = 0; z < 32; z++) {
+        for (int y = 0; y < 32; y++) {
+            for (int x = 1; x <= scale; x++) {
+                p.core(x, y, z, LATTICE_PROG_CORE_MULT);
+                p.connect(x, y, z, LATTICE_PROG_CONNECT_NX);
+                if (y > 0) p.connect(x, y, z, LATTICE_PROG_CONNECT_NY);
+                if (z > 0) p.connect(x, y, z, LATTICE_PROG_CONNECT_NZ);
+            }
+        }
+    }
+    return p.result();
+}
+
+void integrators_size(int scale, int* X, int* Y, int* Z) {
+    *X = 3; *Y = scale; *Z = scale;
+}
+
+long long integrators_program(LatticeHandle lattice, int scale) {
+    program_counter p = { lattice };
+    Lattice_Program_SetUnderbus(lattice, (CELL_TYPE)(0.5 * CELL_ONE));
+    for (int z = 0; z < scale; z++) {
+        for (int y = 0; y < scale; y++) {
+            p.core(1, y, z, LATTICE_PROG_CORE_SUM);
+            p.connect(1, y, z, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_MOD_COEFF);
+            p.core(2, y, z, LATTICE_PROG_CORE_INT);
+            p.connect(2, y, z, LATTICE_PROG_CONNECT_NX);
+        }
+    }
+    return p.result();
+}
+
+#define SPARSE_SIZE 256
+
+void sparse_size(int scale, int* X, int* Y, int* Z) {
+    *X = SPARSE_SIZE; *Y = SPARSE_SIZE; *Z = SPARSE_SIZE;
+}
+
+// Each wire starts at a random cell of the input layer and steps +X, +Y or +Z at random until it leaves the lattice. Wires that
+// meet sum into each other, and as every step is towards +X, +Y or +Z the wiring never loops.
+long long sparse_program(LatticeHandle lattice, int scale) {
+    program_counter p = { lattice };
+    std::default_random_engine rng(1);
+    std::uniform_int_distribution<int> start(0, SPARSE_SIZE - 1), step(0, 3);
+    std::vector<bool> programmed((size_t)SPARSE_SIZE * SPARSE_SIZE * SPARSE_SIZE, false);
+    const int connect[] = { LATTICE_PROG_CONNECT_NX, LATTICE_PROG_CONNECT_NX, LATTICE_PROG_CONNECT_NY, LATTICE_PROG_CONNECT_NZ };
+
+    Lattice_Program_SetUnderbus(lattice, (CELL_TYPE)(0.9 * CELL_ONE));
+    for (int w = 0; w < scale; w++) {
+        int x = 0, y = start(rng), z = start(rng);
+        while (true) {
+            int s = x == 0 ? 0 : step(rng); // the first step leaves the input layer
+            int nx = x + (s < 2), ny = y + (s == 2), nz = z + (s == 3);
+            if (nx >= SPARSE_SIZE || ny >= SPARSE_SIZE || nz >= SPARSE_SIZE) break;
+            size_t cell = ((size_t)nz * SPARSE_SIZE + ny) * SPARSE_SIZE + nx;
+            if (!programmed[cell]) {
+                p.core(nx, ny, nz, LATTICE_PROG_CORE_SUM);
+                programmed[cell] = true;
+            }
+            // A wire crossing one already there may find the line connected.
+            Lattice_Program_Connect(lattice, nx, ny, nz, connect[s] | LATTICE_PROG_CONNECT_CONFIG_MOD_COEFF);
+            x = nx; y = ny; z = nz;
+        }
+    }
+    return p.result();
+}
+
+const workload workloads[] = {
+    { "linear", 4096, LATTICE_STORAGE_DEFAULT, 0, linear_size, linear_program },
+    { "chain", 1024, LATTICE_STORAGE_DEFAULT, 0, chain_size, chain_program },
+    { "multtree", 256, LATTICE_STORAGE_DEFAULT, 0, multtree_size, multtree_program },
+    { "integrators", 512, LATTICE_STORAGE_DEFAULT, 1, integrators_size, integrators_program },
+    { "sparse", 1024, LATTICE_STORAGE_SPARSE, 0, sparse_size, sparse_program },
+};
+
+// The input layer for a tick, different every tick so the whole program is evaluated. Every workload sees only values of +-1
+// or less, and the linear search looks for a different value each tick.
+void fill_inputs(const workload& w, vector<CELL_TYPE>& inputs, int tick) {
+    if (w.program == linear_program) {
+        std::fill(inputs.begin(), inputs.end(), (CELL_TYPE)0);
+        inputs[w.scale * 2 * 1] = (CELL_TYPE)((double)(tick * 37 % LINEAR_MAX_VALUE) / LINEAR_MAX_VALUE * CELL_ONE);
+        return;
+    }
+    CELL_TYPE charge = (CELL_TYPE)(tick & 1 ? CELL_ONE : -CELL_ONE);
+    if (w.program != multtree_program) charge = (CELL_TYPE)(charge / 2);
+    std::fill(inputs.begin(), inputs.end(), charge);
+}
+
+void reset_peak_rss() {
+#ifdef __linux__
+    // Writing 5 to clear_refs resets the peak resident set size of the process to its current size.
+    ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+long long peak_rss_kb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return -1;
+    return (long long)(counters.PeakWorkingSetSize / 1024);
+#else
+#ifdef __linux__
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return atoll(line.c_str() + 6);
+    }
+#endif
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) return -1;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+double percentile(const vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+double since(chrono::steady_clock::time_point start) {
+    return (double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+int run(const workload& w, int scale, int ticks) {
+    workload scaled = w;
+    scaled.scale = scale;
+    int X, Y, Z;
+    w.size(scale, &X, &Y, &Z);
+    reset_peak_rss();
+
+    LatticeHandle lattice;
+    if (SIMU_Lattice_Init(&lattice, X, Y, Z, LATTICE_NOISE_MODE_NONE, 0.001, w.storage)) {
+        cerr << w.name << ": failed to initialize a (" << X << ", " << Y << ", " << Z << ") lattice!" << endl;
+        return -1;
+    }
+    SIMU_Run_Mode(lattice, LATTICE_RUN_STEPPED);
+
+    auto start = chrono::steady_clock::now();
+    Lattice_Program_Begin(lattice);
+    long long cells = w.program(lattice, scale);
+    int flag = Lattice_Program_Commit(lattice);
+    double programNanos = since(start);
+    if (cells < 0 || flag) {
+        cerr << w.name << ": failed to program the lattice!" << endl;
+        SIMU_Lattice_Destroy(lattice);
+        return -1;
+    }
+    if (w.integrating) Lattice_Start_Integration(lattice);
+
+    // Throughput: stepped ticks, each with a new input layer.
+    vector<CELL_TYPE> inputs((size_t)Y * Z);
+    double nanos = 0;
+    for (int t = 0; t < WARMUP_TICKS + ticks; t++) {
+        fill_inputs(scaled, inputs, t);
+        Lattice_Write_Plane(lattice, inputs.data());
+        auto tick = chrono::steady_clock::now();
+        SIMU_Lattice_Step(lattice, 1);
+        if (t >= WARMUP_TICKS) nanos += since(tick);
+    }
+
+    // Latency: the simulation thread runs freely, and each write is timed until it has reached the outputs.
+    SIMU_Run_Mode(lattice, LATTICE_RUN_THREADED);
+    vector<double> latencies;
+    for (int s = 0; s < LATENCY_SAMPLES; s++) {
+        fill_inputs(scaled, inputs, s);
+        auto write = chrono::steady_clock::now();
+        Lattice_Write_Plane(lattice, inputs.data());
+        Lattice_Wait(lattice, SETTLE_TICKS);
+        latencies.push_back(since(write) / 1e3);
+    }
+    sort(latencies.begin(), latencies.end());
+    SIMU_Lattice_Destroy(lattice);
+
+    double seconds = nanos / 1e9;
+    cout << "{\"workload\":\"" << w.name << "\",\"scale\":" << scale
+        << ",\"dims\":[" << X << "," << Y << "," << Z << "],\"cells\":" << cells << ",\"ticks\":" << ticks
+        << ",\"ticks_per_sec\":" << ticks / seconds << ",\"cells_per_sec\":" << (double)cells * ticks / seconds
+        << ",\"latency_us\":{\"p50\":" << percentile(latencies, 0.5) << ",\"p90\":" << percentile(latencies, 0.9)
+        << ",\"p99\":" << percentile(latencies, 0.99) << ",\"max\":" << latencies.back() << "}"
+        << ",\"program_ms\":" << programNanos / 1e6 << ",\"peak_rss_kb\":" << peak_rss_kb() << "}" << endl;
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    string name = argc > 1 ? argv[1] : "all";
+    int scale = argc > 2 ? atoi(argv[2]) : 0;
+    int ticks = argc > 3 ? atoi(argv[3]) : BENCH_TICKS;
+    if (ticks <= 0) ticks = BENCH_TICKS;
+
+    int failed = 0, found = 0;
+    for (const workload& w : workloads) {
+        if (name != "all" && name != w.name) continue;
+        found++;
+        failed |= run(w, scale > 0 ? scale : w.scale, ticks);
+    }
+    if (!found) {
+        cerr << "Usage: LatticeBench [all|linear|chain|multtree|integrators|sparse] [scale] [ticks]" << endl;
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
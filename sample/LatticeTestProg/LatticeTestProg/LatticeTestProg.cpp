@@ -3,12 +3,13 @@
 
 #include <iostream>
 #include <stdlib.h>
-#include <Windows.h>
+#include <thread>
+#include <chrono>
 #include "AnalogLibrary.h"
 
 int main()
 {
-    if (SIMU_Lattice_Init(2, 2, 1, 0, (CELL_TYPE)1/10)) {
+    if (SIMU_Lattice_Init(2, 2, 1, 0, 0.1)) {
         std::cout << "Failed to initialize lattice!\n";
         return -1;
     }
@@ -23,20 +24,30 @@ int main()
         LATTICE_PROG_CONNECT_CONFIG_FLOW_POS |
         LATTICE_PROG_CONNECT_CONFIG_MOD_COMP);
 
-    CELL_TYPE v = 0.5;
+    CELL_TYPE v = (CELL_TYPE)(0.5 * CELL_ONE);
     Lattice_Start_Integration();
+    auto start = std::chrono::steady_clock::now();
     Lattice_Write(0, 0, v);
-    v = 0.35;
+    v = (CELL_TYPE)(0.35 * CELL_ONE);
     Lattice_Write(1, 0, v);
 
     SIMU_Lattice_Examine(0, 0, 0, &v);
-    std::cout << "Examined value at (0, 0, 0) is " << v << std::endl;
+    std::cout << "Examined value at (0, 0, 0) is " << (double)v / CELL_ONE << std::endl;
 
-    Sleep(1500);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
     Lattice_Read(0, 0, &v);
-    std::cout << "Output integrator value is " << v << std::endl;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Output integrator value is " << (double)v / CELL_ONE << std::endl;
+
+    // Each threaded tick moves the integrator by far less than the smallest fixed point charge, so it only keeps up with the 0.5
+    // per second it reads if those steps are carried from tick to tick. Some time passes before the first tick, hence the margin.
+    if ((double)v / CELL_ONE < 0.5 * elapsed / 2) {
+        std::cout << "Integrator fell behind: expected about " << 0.5 * elapsed << std::endl;
+        SIMU_Lattice_Destroy();
+        return -1;
+    }
     Lattice_Read(1, 0, &v);
-    std::cout << "Output comparator value is " << v << std::endl;
+    std::cout << "Output comparator value is " << (double)v / CELL_ONE << std::endl;
 
     SIMU_Lattice_Destroy();
     return 0;
@@ -0,0 +1,70 @@
+// LayoutBench.cpp : Compares the time per tick of each storage layout on a lattice larger than the last level cache.
+// Every inner cell integrates the cells behind it on X and Z, so each tick reads the -Z neighbour of every cell, which is
+// a whole XY plane away in the dense layout. Run it under a profiler (perf stat -e cache-misses, VTune) to see the misses.
+//
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include "AnalogLibrary.h"
+
+using namespace std;
+
+#define SIZE_X 64
+#define SIZE_Y 256
+#define SIZE_Z 256 // 4M cells, about 80MB of storage
+#define WARMUP_TICKS 2
+#define BENCH_TICKS 20
+
+const int layouts[] = { LATTICE_STORAGE_DENSE, LATTICE_STORAGE_PADDED, LATTICE_STORAGE_TILED };
+const char* layoutNames[] = { "dense", "padded", "tiled" };
+
+int program_lattice(LatticeHandle lattice) {
+    for (int z = 0; z < SIZE_Z; z++) {
+        for (int y = 0; y < SIZE_Y; y++) {
+            for (int x = 1; x < SIZE_X; x++) {
+                int flag = Lattice_Program_Core(lattice, x, y, z, LATTICE_PROG_CORE_INT);
+                flag |= Lattice_Program_Connect(lattice, x, y, z, LATTICE_PROG_CONNECT_NX);
+                if (z > 0) flag |= Lattice_Program_Connect(lattice, x, y, z, LATTICE_PROG_CONNECT_NZ);
+                if (flag) return flag;
+            }
+        }
+    }
+    return LATTICE_STATE_OKAY;
+}
+
+int main()
+{
+    const int cells = SIZE_X * SIZE_Y * SIZE_Z;
+    cout << "Lattice (" << SIZE_X << ", " << SIZE_Y << ", " << SIZE_Z << "), " << cells << " cells, " << BENCH_TICKS << " ticks per layout." << endl;
+
+    for (int l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+        LatticeHandle lattice;
+        if (SIMU_Lattice_Init(&lattice, SIZE_X, SIZE_Y, SIZE_Z, 0, 0.001, layouts[l])) {
+            cout << layoutNames[l] << ": failed to initialize lattice!" << endl;
+            continue;
+        }
+        SIMU_Run_Mode(lattice, LATTICE_RUN_STEPPED);
+        if (program_lattice(lattice)) {
+            cout << layoutNames[l] << ": failed to program lattice!" << endl;
+            SIMU_Lattice_Destroy(lattice);
+            continue;
+        }
+        vector<CELL_TYPE> inputs(SIZE_Y * SIZE_Z, (CELL_TYPE)(0.5 * CELL_ONE));
+        Lattice_Write_Plane(lattice, inputs.data());
+        Lattice_Start_Integration(lattice);
+        SIMU_Lattice_Step(lattice, WARMUP_TICKS); // compiles the program and brings the lattice into cache as far as it fits
+
+        auto start = chrono::steady_clock::now();
+        SIMU_Lattice_Step(lattice, BENCH_TICKS);
+        auto end = chrono::steady_clock::now();
+        double nanos = (double)chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+
+        CELL_TYPE probe = 0;
+        SIMU_Lattice_Examine(lattice, 1, SIZE_Y / 2, SIZE_Z - 1, &probe);
+        cout << layoutNames[l] << ": " << nanos / BENCH_TICKS / 1e6 << " ms per tick, "
+            << nanos / BENCH_TICKS / cells << " ns per cell (probe " << (double)probe / CELL_ONE << ")" << endl;
+        SIMU_Lattice_Destroy(lattice);
+    }
+    return 0;
+}
@@ -3,14 +3,16 @@
 
 #include <iostream>
 #include <stdlib.h>
-#include <Windows.h>
 #include "AnalogLibrary.h"
 #include <vector>
 #include <random>
+#include <thread>
+#include <chrono>
 
 using namespace std;
 
 #define MAX_VALUE (int)128
+#define SETTLE_TICKS 2 // ticks after a write before the outputs are read: the tick in progress may have missed the write.
 
 vector<int> creation_array = { 10, 50, 32, 64, 2, 8, 3 };
 
@@ -27,6 +29,8 @@ int initialize_sim(vector<int> data) {
         cout << "Simulation spans a region (7, " << (size * 2) << ", 4) (" << (7 * size * 2 * 4) << " cells) \n";
     }
 
+    // Staged and applied together, so the simulation never runs a half built program.
+    Lattice_Program_Begin();
     for (int i = 0, y = 0; i < size; i++, y += 2) {
         // Set up the input carry
         Lattice_Program_Core(1, y + 0, 1, LATTICE_PROG_CORE_SUM);
@@ -42,7 +46,7 @@ int initialize_sim(vector<int> data) {
         // Write the value initial store
         Lattice_Program_SetUnderbus(data[i], MAX_VALUE);
         Lattice_Program_Core(2, y, 1, LATTICE_PROG_CORE_HOLDVAL);
-        Lattice_Program_SetUnderbus(1);
+        Lattice_Program_SetUnderbus(CELL_ONE);
         Lattice_Program_Core(3, y, 1, LATTICE_PROG_CORE_HOLDVAL);
 
         // Write C1 and C2 cells
@@ -125,7 +129,7 @@ int initialize_sim(vector<int> data) {
 
         // Write cancel signal base
         Lattice_Program_Core(5, y + 1, 1, LATTICE_PROG_CORE_SUM);
-        Lattice_Program_SetUnderbus(1);
+        Lattice_Program_SetUnderbus(CELL_ONE);
         Lattice_Program_Core(6, y + 1, 1, LATTICE_PROG_CORE_HOLDVAL);
         Lattice_Program_Connect(5, y + 1, 1,
             LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS | LATTICE_PROG_CONNECT_CONFIG_INVERT);
@@ -153,11 +157,21 @@ int initialize_sim(vector<int> data) {
     // Connect to layer 0 at z=1 the input
 
     Lattice_Program_Connect(1, 0, 1, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_FLOW_POS);
+    Lattice_Program_Commit();
 
-    Sleep(1000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
     return 0;
 }
 
+// Reads the found value and its index from one tick of the output layer.
+void read_result(int* value, int* index) {
+    vector<int> outputs(creation_array.size() * 2 * 4);
+    long long tick = 0;
+    Lattice_Read_Snapshot(MAX_VALUE, outputs.data(), &tick);
+    *value = outputs[0];
+    *index = outputs[2 * creation_array.size() * 2];
+}
+
 int main()
 {
     if (initialize_sim(creation_array)) {
@@ -170,39 +184,52 @@ int main()
 
     cout << "Simulation running at approximately " << SIMU_Poll_Rate() << " Hz" << endl;
 
-    // Test values: have to sleep for a tiny amount of time to get the output.
+    // Test values: wait for the write to reach the outputs, then read both from the same tick.
 
     // Check for every number in creation_array
     for (int i = 0; i < creation_array.size(); i++) {
         cout << endl;
         cout << "Looking for value " << creation_array[i] << "..." << endl;
-        float tmp = 0;
+        CELL_TYPE tmp = 0;
         SIMU_Lattice_Examine(3, (2*i) + 1, 0, &tmp);
-        cout << "Expecting value " << tmp << " * " << MAX_VALUE << " (" << (tmp * MAX_VALUE) << ")" << endl;
+        cout << "Expecting value " << (double)tmp / CELL_ONE << " * " << MAX_VALUE << " (" << ((double)tmp / CELL_ONE * MAX_VALUE) << ")" << endl;
         Lattice_Write(0, 1, creation_array[i], MAX_VALUE);
-        Sleep(100);
+        Lattice_Wait(SETTLE_TICKS);
         int a, b = 0;
-        Lattice_Read(0, 0, MAX_VALUE, &a);
-        Lattice_Read(0, 2, MAX_VALUE, &b);
+        read_result(&a, &b);
         cout << "Found value " << a << " at index " << b << endl;
 
         SIMU_Lattice_Examine(4, (2 * i) + 1, 1, &tmp);
-        cout << "Signal value at cell is " << tmp << endl;
+        cout << "Signal value at cell is " << (double)tmp / CELL_ONE << endl;
         SIMU_Lattice_Examine(4, (2 * i) + 1, 0, &tmp);
-        cout << "Z_0 mult value is " << tmp << endl;
+        cout << "Z_0 mult value is " << (double)tmp / CELL_ONE << endl;
         SIMU_Lattice_Examine(5, (2 * i) + 1, 0, &tmp);
-        cout << "Z_0 signal layer value is " << tmp << endl;
+        cout << "Z_0 signal layer value is " << (double)tmp / CELL_ONE << endl;
     }
 
     // Check for numbers that arent there
     cout << endl << "Looking for value 72" << endl;
     Lattice_Write(0, 1, 72, MAX_VALUE);
-    Sleep(100);
+    Lattice_Wait(SETTLE_TICKS);
     int a, b = 0;
-    Lattice_Read(0, 0, MAX_VALUE, &a);
-    Lattice_Read(0, 2, MAX_VALUE, &b);
+    read_result(&a, &b);
     cout << "Found value " << a << " at index " << b << endl << endl;
 
+    // Every lookup again, evaluated in one call: each query is an input plane with its value at {0, 1}.
+    vector<int> queries(creation_array);
+    queries.push_back(72);
+    int plane = creation_array.size() * 2 * 4;
+    vector<int> inputs(queries.size() * plane, 0), results(queries.size() * plane);
+    for (int q = 0; q < queries.size(); q++)
+        inputs[q * plane + creation_array.size() * 2] = queries[q];
+    if (Lattice_Evaluate_Batch(inputs.data(), MAX_VALUE, queries.size(), results.data()) & LATTICE_STATE_ERR_BAD_CONFIG) {
+        cout << "Failed to evaluate the batch!" << endl;
+    }
+    for (int q = 0; q < queries.size(); q++) {
+        cout << "Batch: looking for value " << queries[q] << ", found value " << results[q * plane] << " at index "
+            << results[q * plane + 2 * creation_array.size() * 2] << endl;
+    }
+
     SIMU_Lattice_Destroy();
     cout << endl << "Simulation destroyed." << endl << endl;
     return 0;
@@ -0,0 +1,79 @@
+// NoiseBench.cpp : Measures the cost of each noise mode per tick. Every inner cell sums the cells behind it on X and Z through
+// coefficient lines, so the whole lattice is evaluated every tick whether or not noise is on.
+//
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include "AnalogLibrary.h"
+
+using namespace std;
+
+#define SIZE_X 64
+#define SIZE_Y 128
+#define SIZE_Z 128 // 1M cells
+#define WARMUP_TICKS 2
+#define BENCH_TICKS 20
+
+const int modes[] = {
+    LATTICE_NOISE_MODE_NONE,
+    LATTICE_NOISE_MODE_RANDOM,
+    LATTICE_NOISE_MODE_INDUCTIVE,
+    LATTICE_NOISE_MODE_RESISTIVE,
+    LATTICE_NOISE_MODE_RESISTIVE | LATTICE_NOISE_MODE_HEAT_RESISTIVE,
+    LATTICE_NOISE_MODE_RANDOM | LATTICE_NOISE_MODE_INDUCTIVE | LATTICE_NOISE_MODE_RESISTIVE | LATTICE_NOISE_MODE_HEAT_RESISTIVE,
+};
+const char* modeNames[] = { "none", "random", "inductive", "resistive", "heat resistive", "all" };
+
+int program_lattice(LatticeHandle lattice) {
+    Lattice_Program_SetUnderbus(lattice, (CELL_TYPE)(0.5 * CELL_ONE));
+    for (int z = 0; z < SIZE_Z; z++) {
+        for (int y = 0; y < SIZE_Y; y++) {
+            for (int x = 1; x < SIZE_X; x++) {
+                int flag = Lattice_Program_Core(lattice, x, y, z, LATTICE_PROG_CORE_SUM);
+                flag |= Lattice_Program_Connect(lattice, x, y, z, LATTICE_PROG_CONNECT_NX | LATTICE_PROG_CONNECT_CONFIG_MOD_COEFF);
+                if (z > 0) flag |= Lattice_Program_Connect(lattice, x, y, z, LATTICE_PROG_CONNECT_NZ | LATTICE_PROG_CONNECT_CONFIG_MOD_COEFF);
+                if (flag) return flag;
+            }
+        }
+    }
+    return LATTICE_STATE_OKAY;
+}
+
+int main()
+{
+    const int cells = SIZE_X * SIZE_Y * SIZE_Z;
+    cout << "Lattice (" << SIZE_X << ", " << SIZE_Y << ", " << SIZE_Z << "), " << cells << " cells, " << BENCH_TICKS << " ticks per noise mode." << endl;
+
+    double baseline = 0;
+    for (int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        LatticeHandle lattice;
+        if (SIMU_Lattice_Init(&lattice, SIZE_X, SIZE_Y, SIZE_Z, modes[m], 0.001)) {
+            cout << modeNames[m] << ": failed to initialize lattice!" << endl;
+            continue;
+        }
+        SIMU_Run_Mode(lattice, LATTICE_RUN_STEPPED);
+        if (program_lattice(lattice)) {
+            cout << modeNames[m] << ": failed to program lattice!" << endl;
+            SIMU_Lattice_Destroy(lattice);
+            continue;
+        }
+        double nanos = 0;
+        for (int t = 0; t < WARMUP_TICKS + BENCH_TICKS; t++) {
+            // A new input every tick, so every cell changes and is evaluated even without noise.
+            vector<CELL_TYPE> inputs(SIZE_Y * SIZE_Z, (CELL_TYPE)((t & 1 ? 0.5 : 0.25) * CELL_ONE));
+            Lattice_Write_Plane(lattice, inputs.data());
+
+            auto start = chrono::steady_clock::now();
+            SIMU_Lattice_Step(lattice, 1);
+            auto end = chrono::steady_clock::now();
+            if (t >= WARMUP_TICKS) nanos += (double)chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+        }
+        if (m == 0) baseline = nanos;
+
+        cout << modeNames[m] << ": " << nanos / BENCH_TICKS / 1e6 << " ms per tick, "
+            << nanos / BENCH_TICKS / cells << " ns per cell, " << nanos / baseline << "x the cost without noise" << endl;
+        SIMU_Lattice_Destroy(lattice);
+    }
+    return 0;
+}